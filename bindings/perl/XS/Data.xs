@@ -50,7 +50,10 @@ property(self, p)
         
     CODE:
         buf = swish_hash_fetch(self->properties->hash, p);
-        RETVAL = newSVpvn((char*)xmlBufferContent(buf), xmlBufferLength(buf));
+        if (buf == NULL)
+            RETVAL = newSVpvn("", 0);
+        else
+            RETVAL = newSVpvn((char*)xmlBufferContent(buf), xmlBufferLength(buf));
         
     OUTPUT:
         RETVAL
@@ -65,7 +68,10 @@ metaname(self, m)
         
     CODE:
         buf = xmlHashLookup(self->metanames->hash, m);
-        RETVAL = newSVpvn((char*)xmlBufferContent(buf), xmlBufferLength(buf));
+        if (buf == NULL)
+            RETVAL = newSVpvn("", 0);
+        else
+            RETVAL = newSVpvn((char*)xmlBufferContent(buf), xmlBufferLength(buf));
         
     OUTPUT:
         RETVAL
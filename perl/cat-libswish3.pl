@@ -27,11 +27,17 @@ my @files = qw(
     namedbuffer.c
     string.c
     times.c
+    trace.c
+    xinclude.c
+    querycache.c
+    dedup.c
+    manifest.c
     swish.c
     analyzer.c
     property.c
     metaname.c
     header.c
+    configcache.c
     tokenizer.c
 
 );
@@ -90,6 +96,7 @@ void *alloca (size_t);
 #include <stdio.h>
 #include <locale.h>
 #include <stdarg.h>
+#include <setjmp.h>
 #include <assert.h>
 #include <wchar.h>
 #include <limits.h>
@@ -100,6 +107,9 @@ void *alloca (size_t);
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <iconv.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <time.h>
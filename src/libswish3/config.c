@@ -81,6 +81,24 @@ static void merge_metanames(
     xmlHashTablePtr metas1,
     xmlHashTablePtr metas2
 );
+static void free_limits(
+    swish_Limits *limits,
+    xmlChar *key
+);
+static void limits_printer(
+    swish_Limits *limits,
+    xmlChar *str,
+    xmlChar *key
+);
+static void copy_limits(
+    swish_Limits *limits2,
+    xmlHashTablePtr limits1,
+    xmlChar *key
+);
+static void merge_limits(
+    xmlHashTablePtr limits1,
+    xmlHashTablePtr limits2
+);
 static void
 free_stringlist(
     swish_StringList *strlist,
@@ -116,6 +134,18 @@ free_stringlist(
     swish_stringlist_free(strlist);
 }
 
+static void
+free_limits(
+    swish_Limits *limits,
+    xmlChar *key
+)
+{
+    if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+        SWISH_DEBUG_MSG("   freeing config->limits %s", key);
+
+    swish_xfree(limits);
+}
+
 static void
 free_props(
     swish_Property *prop,
@@ -167,6 +197,7 @@ swish_config_free(
     xmlHashFree(config->mimes, (xmlHashDeallocator)free_string);
     xmlHashFree(config->index, (xmlHashDeallocator)free_string);
     xmlHashFree(config->stringlists, (xmlHashDeallocator)free_stringlist);
+    xmlHashFree(config->limits, (xmlHashDeallocator)free_limits);
     swish_config_flags_free(config->flags);
 
     if (config->ref_cnt != 0) {
@@ -190,6 +221,7 @@ swish_config_init_flags(
     flags->cascade_meta_context = SWISH_FALSE;  /* add tokens to every metaname in the stack */
     flags->ignore_xmlns = SWISH_TRUE;
     flags->follow_xinclude = SWISH_TRUE;
+    flags->skip_binary = SWISH_TRUE;
     flags->undef_metas = SWISH_UNDEF_METAS_INDEX;
     flags->undef_attrs = SWISH_UNDEF_ATTRS_DISABLE;
     flags->max_meta_id = -1;
@@ -226,6 +258,7 @@ swish_config_flags_debug(
     SWISH_DEBUG_MSG("config->cascade_meta_context == %d", flags->cascade_meta_context);
     SWISH_DEBUG_MSG("config->ignore_xmlns == %d", flags->ignore_xmlns);
     SWISH_DEBUG_MSG("config->follow_xinclude == %d", flags->follow_xinclude);
+    SWISH_DEBUG_MSG("config->skip_binary == %d", flags->skip_binary);
     SWISH_DEBUG_MSG("config->undef_metas == %d", flags->undef_metas);
     SWISH_DEBUG_MSG("config->undef_attrs == %d", flags->undef_attrs);
     SWISH_DEBUG_MSG("config->max_meta_id == %d", flags->max_meta_id);
@@ -238,11 +271,14 @@ swish_config_init(
 )
 {
     swish_Config *config;
+    swish_MemSubsystem prev_mem;
 
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
         SWISH_DEBUG_MSG("init config");
     }
 
+    prev_mem = swish_mem_enter(SWISH_MEM_CONFIG);
+
 /* the hashes will automatically grow as needed so we init with sane starting size */
     config = swish_xmalloc(sizeof(swish_Config));
     config->flags = swish_config_init_flags();
@@ -253,6 +289,7 @@ swish_config_init(
     config->index = swish_hash_init(8);
     config->tag_aliases = swish_hash_init(8);   /* alias => real */
     config->stringlists = swish_hash_init(8);
+    config->limits = swish_hash_init(8);
     config->mimes = NULL;
     config->ref_cnt = 0;
     config->stash = NULL;
@@ -261,6 +298,7 @@ swish_config_init(
         SWISH_DEBUG_MSG("config ptr 0x%x", (long int)config);
     }
 
+    swish_mem_leave(prev_mem);
     return config;
 
 }
@@ -273,10 +311,13 @@ swish_config_set_default(
     swish_Property *tmpprop;
     swish_MetaName *tmpmeta;
     xmlChar *tmpbuf;
+    swish_MemSubsystem prev_mem;
 
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
         SWISH_DEBUG_MSG("setting default config");
 
+    prev_mem = swish_mem_enter(SWISH_MEM_CONFIG);
+
 /* we xstrdup a lot in order to consistently free in swish_config_free() */
 
 /* MIME types */
@@ -365,6 +406,8 @@ swish_config_set_default(
     swish_hash_add(config->tag_aliases, (xmlChar *)SWISH_BODY_TAG,
                    swish_xstrdup((xmlChar *)SWISH_PROP_DESCRIPTION));
 
+    swish_mem_leave(prev_mem);
+
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         SWISH_DEBUG_MSG("config_set_default done");
         swish_config_debug(config);
@@ -378,7 +421,11 @@ swish_config_add(
     xmlChar *conf
 )
 {
+    swish_MemSubsystem prev_mem;
+
+    prev_mem = swish_mem_enter(SWISH_MEM_CONFIG);
     config = swish_config_parse(config, conf);
+    swish_mem_leave(prev_mem);
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
         swish_config_debug(config);
 
@@ -440,6 +487,17 @@ metaname_printer(
     swish_metaname_debug(meta);
 }
 
+static void
+limits_printer(
+    swish_Limits *limits,
+    xmlChar *str,
+    xmlChar *key
+)
+{
+    SWISH_DEBUG_MSG(" %s:  %s => bytes %ld tokens %u seconds %.3f", str, key,
+                    (long)limits->max_bytes, limits->max_tokens, limits->max_seconds);
+}
+
 /* PUBLIC */
 void
 swish_config_debug(
@@ -459,6 +517,7 @@ swish_config_debug(
     xmlHashScan(config->mimes, (xmlHashScanner)config_printer, "mimes");
     xmlHashScan(config->index, (xmlHashScanner)config_printer, "index");
     xmlHashScan(config->tag_aliases, (xmlHashScanner)config_printer, "tag_aliases");
+    xmlHashScan(config->limits, (xmlHashScanner)limits_printer, "limits");
     swish_config_flags_debug(config->flags);
 }
 
@@ -493,12 +552,15 @@ copy_property(
     prop1->verbatim = prop2->verbatim;
     if (prop1->alias_for != NULL) {
         swish_xfree(prop1->alias_for);
+        prop1->alias_for = NULL;
     }
     if (prop2->alias_for != NULL) {
         prop1->alias_for = swish_xstrdup(prop2->alias_for);
     }
     prop1->max = prop2->max;
     prop1->sort = prop2->sort;
+    prop1->presort = prop2->presort;
+    prop1->sort_length = prop2->sort_length;
 
 }
 
@@ -584,6 +646,55 @@ merge_stringlists(
     xmlHashScan(strlists2, (xmlHashScanner)copy_strlist, strlists1);
 }
 
+static void
+copy_limits(
+    swish_Limits *limits2,
+    xmlHashTablePtr limits1,
+    xmlChar *key
+)
+{
+    swish_Limits *limits;
+    if (swish_hash_exists(limits1, key)) {
+        limits = swish_hash_fetch(limits1, key);
+    }
+    else {
+        limits = swish_xmalloc(sizeof(swish_Limits));
+        swish_hash_add(limits1, key, limits);
+    }
+    *limits = *limits2;
+}
+
+static void
+merge_limits(
+    xmlHashTablePtr limits1,
+    xmlHashTablePtr limits2
+)
+{
+    xmlHashScan(limits2, (xmlHashScanner)copy_limits, limits1);
+}
+
+/*
+* the Limits for a document: its MIME type's if there are any,
+* else its parser's, else the default ones, else NULL.
+*/
+swish_Limits *
+swish_config_get_limits(
+    swish_Config *config,
+    xmlChar *mime,
+    xmlChar *parser
+)
+{
+    swish_Limits *limits = NULL;
+
+    if (mime != NULL)
+        limits = swish_hash_fetch(config->limits, mime);
+    if (limits == NULL && parser != NULL)
+        limits = swish_hash_fetch(config->limits, parser);
+    if (limits == NULL)
+        limits = swish_hash_fetch(config->limits, BAD_CAST SWISH_DEFAULT_PARSER);
+    return limits;
+}
+
 void
 swish_config_merge(
     swish_Config *config1,
@@ -592,6 +703,7 @@ swish_config_merge(
 {
 
     xmlChar *v;
+    swish_MemSubsystem prev_mem;
 
 /* values in config2 override and are set in config1 */
 
@@ -602,6 +714,7 @@ swish_config_merge(
         swish_config_debug(config1);
     }
 
+    prev_mem = swish_mem_enter(SWISH_MEM_CONFIG);
 
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         SWISH_DEBUG_MSG("merge properties");
@@ -643,6 +756,11 @@ swish_config_merge(
     }
     merge_stringlists(config1->stringlists, config2->stringlists);
 
+    if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
+        SWISH_DEBUG_MSG("merge limits");
+    }
+    merge_limits(config1->limits, config2->limits);
+
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         SWISH_DEBUG_MSG("merge complete");
     }
@@ -667,6 +785,11 @@ swish_config_merge(
             swish_string_to_boolean(swish_hash_fetch(config2->misc, BAD_CAST SWISH_FOLLOW_XINCLUDE));
     }
     config1->flags->follow_xinclude = config2->flags->follow_xinclude;
+    if (swish_hash_exists(config2->misc, BAD_CAST SWISH_SKIP_BINARY)) {
+        config2->flags->skip_binary =
+            swish_string_to_boolean(swish_hash_fetch(config2->misc, BAD_CAST SWISH_SKIP_BINARY));
+    }
+    config1->flags->skip_binary = config2->flags->skip_binary;
     if (swish_hash_exists(config2->misc, BAD_CAST SWISH_UNDEFINED_METATAGS)) {
         v = swish_hash_fetch(config2->misc, BAD_CAST SWISH_UNDEFINED_METATAGS);
         if (xmlStrEqual(v, BAD_CAST "error")) {
@@ -722,6 +845,7 @@ swish_config_merge(
         config1->flags->max_prop_id = config2->flags->max_prop_id;
     }
 
+    swish_mem_leave(prev_mem);
 
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         SWISH_DEBUG_MSG("flags set");
@@ -0,0 +1,548 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* configcache.c -- binary copy of a parsed config file
+ *
+ * swish_config_cache_save() writes what an XML config file (and every
+ * IncludeConfigFile under it) parsed to, next to it as FILE.cache, along
+ * with the size and mtime of each of those files. swish_config_cache_load()
+ * reads the whole cache in one go and rebuilds the swish_Config from it
+ * without the XML reader, as long as none of the files has changed.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "libswish3.h"
+#endif
+
+extern int SWISH_DEBUG;
+
+#define NULL_STRING 0xffffffffULL   /* string length that stands for NULL */
+
+typedef struct
+{
+    const xmlChar *p;
+    const xmlChar *end;
+    boolean ok;                     /* FALSE once we have read past end */
+} cache_cursor;
+
+static char *
+cache_path(
+    const char *filename
+)
+{
+    char *path;
+    size_t len;
+
+    len = strlen(filename) + strlen(SWISH_CONFIG_CACHE_EXT) + 1;
+    path = swish_xmalloc(len);
+    snprintf(path, len, "%s%s", filename, SWISH_CONFIG_CACHE_EXT);
+    return path;
+}
+
+/*
+* writing. integers are big-endian, strings are a 4 byte length then bytes.
+*/
+
+static void
+put_str(
+    FILE *fh,
+    const xmlChar *str
+)
+{
+    int len;
+
+    if (str == NULL) {
+        swish_io_write_uint(fh, NULL_STRING, 4);
+        return;
+    }
+    len = xmlStrlen(str);
+    swish_io_write_uint(fh, (uint64_t)len, 4);
+    fwrite(str, 1, len, fh);
+}
+
+static void
+put_string_entry(
+    xmlChar *value,
+    FILE *fh,
+    xmlChar *key
+)
+{
+    put_str(fh, key);
+    put_str(fh, value);
+}
+
+static void
+put_string_hash(
+    FILE *fh,
+    xmlHashTablePtr hash
+)
+{
+    swish_io_write_uint(fh, hash == NULL ? 0 : (uint64_t)xmlHashSize(hash), 4);
+    if (hash != NULL)
+        xmlHashScan(hash, (xmlHashScanner)put_string_entry, fh);
+}
+
+static void
+put_metaname(
+    swish_MetaName *meta,
+    FILE *fh,
+    xmlChar *name
+)
+{
+    put_str(fh, name);
+    swish_io_write_uint(fh, (uint32_t)meta->id, 4);
+    swish_io_write_uint(fh, (uint32_t)meta->bias, 4);
+    put_str(fh, meta->alias_for);
+}
+
+static void
+put_property(
+    swish_Property *prop,
+    FILE *fh,
+    xmlChar *name
+)
+{
+    put_str(fh, name);
+    swish_io_write_uint(fh, (uint32_t)prop->id, 4);
+    swish_io_write_uint(fh, (uint32_t)prop->type, 4);
+    swish_io_write_uint(fh, prop->max, 4);
+    swish_io_write_uint(fh, prop->sort_length, 4);
+    swish_io_write_uint(fh, prop->ignore_case, 1);
+    swish_io_write_uint(fh, prop->verbatim, 1);
+    swish_io_write_uint(fh, prop->sort, 1);
+    swish_io_write_uint(fh, prop->presort, 1);
+    put_str(fh, prop->alias_for);
+}
+
+static void
+put_stringlist(
+    swish_StringList *sl,
+    FILE *fh,
+    xmlChar *key
+)
+{
+    unsigned int i;
+
+    put_str(fh, key);
+    swish_io_write_uint(fh, sl->n, 4);
+    for (i = 0; i < sl->n; i++)
+        put_str(fh, sl->word[i]);
+}
+
+static void
+put_limits(
+    swish_Limits *limits,
+    FILE *fh,
+    xmlChar *key
+)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &limits->max_seconds, sizeof(bits));
+    put_str(fh, key);
+    swish_io_write_uint(fh, (uint64_t)limits->max_bytes, 8);
+    swish_io_write_uint(fh, limits->max_tokens, 4);
+    swish_io_write_uint(fh, bits, 8);
+}
+
+/*
+* reading. every get_*() checks the bounds and clears cur->ok instead
+* of reading past the end, so a truncated cache is just a stale one.
+*/
+
+static uint64_t
+get_uint(
+    cache_cursor *cur,
+    int nbytes
+)
+{
+    uint64_t n = 0;
+
+    if (!cur->ok || cur->end - cur->p < nbytes) {
+        cur->ok = SWISH_FALSE;
+        return 0;
+    }
+    while (nbytes--)
+        n = (n << 8) | *cur->p++;
+    return n;
+}
+
+static xmlChar *
+get_str(
+    cache_cursor *cur
+)
+{
+    uint64_t len;
+    xmlChar *str;
+
+    len = get_uint(cur, 4);
+    if (!cur->ok || len == NULL_STRING)
+        return NULL;
+    if ((uint64_t)(cur->end - cur->p) < len) {
+        cur->ok = SWISH_FALSE;
+        return NULL;
+    }
+    str = swish_xstrndup(cur->p, (int)len);
+    cur->p += len;
+    return str;
+}
+
+static void
+get_string_hash(
+    cache_cursor *cur,
+    xmlHashTablePtr hash
+)
+{
+    uint64_t i, n;
+    xmlChar *key, *value;
+
+    n = get_uint(cur, 4);
+    for (i = 0; cur->ok && i < n; i++) {
+        key = get_str(cur);
+        value = get_str(cur);
+        if (key == NULL || value == NULL) {
+            cur->ok = SWISH_FALSE;
+        }
+        else {
+            swish_hash_add(hash, key, value);
+        }
+        if (key != NULL)
+            swish_xfree(key);
+        if (!cur->ok && value != NULL)
+            swish_xfree(value);
+    }
+}
+
+/* SWISH_TRUE if every file the cache was made from is as it was then */
+static boolean
+deps_unchanged(
+    cache_cursor *cur
+)
+{
+    uint64_t i, n, size, mtime;
+    xmlChar *path;
+    struct stat st;
+    boolean fresh = SWISH_TRUE;
+
+    n = get_uint(cur, 2);
+    for (i = 0; cur->ok && i < n; i++) {
+        size = get_uint(cur, 8);
+        mtime = get_uint(cur, 8);
+        if ((path = get_str(cur)) == NULL)
+            return SWISH_FALSE;
+        if (stat((char *)path, &st) || (uint64_t)st.st_size != size
+            || (uint64_t)st.st_mtime != mtime) {
+            if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+                SWISH_DEBUG_MSG("config cache is stale: %s has changed", path);
+            fresh = SWISH_FALSE;
+        }
+        swish_xfree(path);
+        if (!fresh)
+            return SWISH_FALSE;
+    }
+    return cur->ok;
+}
+
+/*
+* the cache keeps the parsed config's id => MetaName/Property maps
+* implicitly, in each entry's id. put them back for a loaded config.
+*/
+static void
+add_id(
+    xmlHashTablePtr ids,
+    int id,
+    void *value
+)
+{
+    xmlChar *id_str;
+
+    id_str = swish_int_to_string(id);
+    if (!swish_hash_exists(ids, id_str))
+        swish_hash_add(ids, id_str, value);
+    swish_xfree(id_str);
+}
+
+static void
+get_config(
+    cache_cursor *cur,
+    swish_Config *config
+)
+{
+    uint64_t i, j, n, nwords, bits;
+    xmlChar *name, *word;
+    swish_MetaName *meta;
+    swish_Property *prop;
+    swish_StringList *sl;
+    swish_Limits *limits;
+
+    config->flags->tokenize = get_uint(cur, 1);
+    config->flags->cascade_meta_context = get_uint(cur, 1);
+    config->flags->ignore_xmlns = get_uint(cur, 1);
+    config->flags->follow_xinclude = get_uint(cur, 1);
+    config->flags->skip_binary = get_uint(cur, 1);
+    config->flags->undef_metas = (int32_t)get_uint(cur, 4);
+    config->flags->undef_attrs = (int32_t)get_uint(cur, 4);
+    config->flags->max_meta_id = (int32_t)get_uint(cur, 4);
+    config->flags->max_prop_id = (int32_t)get_uint(cur, 4);
+
+    get_string_hash(cur, config->misc);
+    get_string_hash(cur, config->index);
+    get_string_hash(cur, config->parsers);
+    get_string_hash(cur, config->mimes);
+    get_string_hash(cur, config->tag_aliases);
+
+    n = get_uint(cur, 4);
+    for (i = 0; cur->ok && i < n; i++) {
+        if ((name = get_str(cur)) == NULL) {
+            cur->ok = SWISH_FALSE;
+            break;
+        }
+        meta = swish_metaname_init(name);
+        meta->ref_cnt++;
+        meta->id = (int32_t)get_uint(cur, 4);
+        meta->bias = (int32_t)get_uint(cur, 4);
+        meta->alias_for = get_str(cur);
+        swish_hash_add(config->metanames, meta->name, meta);
+        if (meta->alias_for == NULL)
+            add_id(config->flags->meta_ids, meta->id, meta);
+    }
+
+    n = get_uint(cur, 4);
+    for (i = 0; cur->ok && i < n; i++) {
+        if ((name = get_str(cur)) == NULL) {
+            cur->ok = SWISH_FALSE;
+            break;
+        }
+        prop = swish_property_init(name);
+        prop->ref_cnt++;
+        prop->id = (int32_t)get_uint(cur, 4);
+        prop->type = (int32_t)get_uint(cur, 4);
+        prop->max = get_uint(cur, 4);
+        prop->sort_length = get_uint(cur, 4);
+        prop->ignore_case = get_uint(cur, 1);
+        prop->verbatim = get_uint(cur, 1);
+        prop->sort = get_uint(cur, 1);
+        prop->presort = get_uint(cur, 1);
+        prop->alias_for = get_str(cur);
+        swish_hash_add(config->properties, prop->name, prop);
+        if (prop->alias_for == NULL)
+            add_id(config->flags->prop_ids, prop->id, prop);
+    }
+
+    n = get_uint(cur, 4);
+    for (i = 0; cur->ok && i < n; i++) {
+        if ((name = get_str(cur)) == NULL) {
+            cur->ok = SWISH_FALSE;
+            break;
+        }
+        sl = swish_stringlist_init();
+        nwords = get_uint(cur, 4);
+        for (j = 0; cur->ok && j < nwords; j++) {
+            if ((word = get_str(cur)) != NULL)
+                swish_stringlist_add_string(sl, word);
+        }
+        swish_hash_add(config->stringlists, name, sl);
+        swish_xfree(name);
+    }
+
+    n = get_uint(cur, 4);
+    for (i = 0; cur->ok && i < n; i++) {
+        if ((name = get_str(cur)) == NULL) {
+            cur->ok = SWISH_FALSE;
+            break;
+        }
+        limits = swish_xmalloc(sizeof(swish_Limits));
+        limits->max_bytes = (off_t)get_uint(cur, 8);
+        limits->max_tokens = get_uint(cur, 4);
+        bits = get_uint(cur, 8);
+        memcpy(&limits->max_seconds, &bits, sizeof(bits));
+        swish_hash_add(config->limits, name, limits);
+        swish_xfree(name);
+    }
+}
+
+/*
+* the config that filename parsed to when the cache was saved, or NULL
+* if there is no cache or filename or any file it included has changed
+* size or mtime since. the caller frees it with swish_config_free().
+*/
+swish_Config *
+swish_config_cache_load(
+    const char *filename
+)
+{
+    char *path;
+    FILE *fh;
+    struct stat st;
+    xmlChar *buf;
+    cache_cursor cur;
+    swish_Config *config;
+
+    path = cache_path(filename);
+    fh = fopen(path, "rb");
+    if (fh == NULL || fstat(fileno(fh), &st)) {
+        if (fh != NULL)
+            fclose(fh);
+        swish_xfree(path);
+        return NULL;
+    }
+
+/* one read for the lot */
+    buf = swish_xmalloc(st.st_size + 1);
+    if (fread(buf, 1, st.st_size, fh) != (size_t)st.st_size) {
+        fclose(fh);
+        swish_xfree(buf);
+        swish_xfree(path);
+        return NULL;
+    }
+    fclose(fh);
+
+    cur.p = buf;
+    cur.end = buf + st.st_size;
+    cur.ok = st.st_size >= 4 && !memcmp(buf, SWISH_CONFIG_CACHE_MAGIC, 4);
+    cur.p += 4;
+
+/* a cache from another version of this code is stale, not corrupt */
+    if (cur.ok && get_uint(&cur, 2) != SWISH_CONFIG_CACHE_VERSION) {
+        if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+            SWISH_DEBUG_MSG("config cache %s is from another version", path);
+        cur.ok = SWISH_FALSE;
+    }
+    if (!cur.ok || !deps_unchanged(&cur)) {
+        swish_xfree(buf);
+        swish_xfree(path);
+        return NULL;
+    }
+
+    config = swish_config_init();
+    config->mimes = swish_hash_init(8);
+    get_config(&cur, config);
+    if (!cur.ok || cur.p != cur.end) {
+        SWISH_WARN("config cache %s is corrupt; ignoring it", path);
+        swish_config_free(config);
+        config = NULL;
+    }
+    else if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
+        SWISH_DEBUG_MSG("config read from cache %s", path);
+    }
+
+    swish_xfree(buf);
+    swish_xfree(path);
+    return config;
+}
+
+/*
+* write config, as parsed from filename, to filename's cache. deps lists
+* filename and every file it included. a file modified within the last
+* second is not trusted to show its next change in its mtime, so then no
+* cache is written. failing to write is not an error: the next load
+* just parses the XML again.
+*/
+void
+swish_config_cache_save(
+    swish_Config *config,
+    const char *filename,
+    swish_StringList *deps
+)
+{
+    char *path, *tmp;
+    size_t tmp_len;
+    FILE *fh;
+    struct stat st;
+    unsigned int i;
+    time_t now;
+    int err;
+
+    path = cache_path(filename);
+    tmp_len = strlen(path) + 5;
+    tmp = swish_xmalloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", path);
+
+    now = time(NULL);
+    for (i = 0; i < deps->n; i++) {
+        if (stat((char *)deps->word[i], &st) || st.st_mtime >= now - 1) {
+            if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+                SWISH_DEBUG_MSG("not caching config: %s is too new", deps->word[i]);
+            goto done;
+        }
+    }
+
+    if ((fh = fopen(tmp, "wb")) == NULL) {
+        if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+            SWISH_DEBUG_MSG("can't write config cache %s: %s", tmp, strerror(errno));
+        goto done;
+    }
+
+    fwrite(SWISH_CONFIG_CACHE_MAGIC, 1, 4, fh);
+    swish_io_write_uint(fh, SWISH_CONFIG_CACHE_VERSION, 2);
+    swish_io_write_uint(fh, deps->n, 2);
+    for (i = 0; i < deps->n; i++) {
+        stat((char *)deps->word[i], &st);
+        swish_io_write_uint(fh, (uint64_t)st.st_size, 8);
+        swish_io_write_uint(fh, (uint64_t)st.st_mtime, 8);
+        put_str(fh, deps->word[i]);
+    }
+
+    swish_io_write_uint(fh, config->flags->tokenize, 1);
+    swish_io_write_uint(fh, config->flags->cascade_meta_context, 1);
+    swish_io_write_uint(fh, config->flags->ignore_xmlns, 1);
+    swish_io_write_uint(fh, config->flags->follow_xinclude, 1);
+    swish_io_write_uint(fh, config->flags->skip_binary, 1);
+    swish_io_write_uint(fh, (uint32_t)config->flags->undef_metas, 4);
+    swish_io_write_uint(fh, (uint32_t)config->flags->undef_attrs, 4);
+    swish_io_write_uint(fh, (uint32_t)config->flags->max_meta_id, 4);
+    swish_io_write_uint(fh, (uint32_t)config->flags->max_prop_id, 4);
+
+    put_string_hash(fh, config->misc);
+    put_string_hash(fh, config->index);
+    put_string_hash(fh, config->parsers);
+    put_string_hash(fh, config->mimes);
+    put_string_hash(fh, config->tag_aliases);
+
+    swish_io_write_uint(fh, (uint64_t)xmlHashSize(config->metanames), 4);
+    xmlHashScan(config->metanames, (xmlHashScanner)put_metaname, fh);
+    swish_io_write_uint(fh, (uint64_t)xmlHashSize(config->properties), 4);
+    xmlHashScan(config->properties, (xmlHashScanner)put_property, fh);
+    swish_io_write_uint(fh, (uint64_t)xmlHashSize(config->stringlists), 4);
+    xmlHashScan(config->stringlists, (xmlHashScanner)put_stringlist, fh);
+    swish_io_write_uint(fh, (uint64_t)xmlHashSize(config->limits), 4);
+    xmlHashScan(config->limits, (xmlHashScanner)put_limits, fh);
+
+    err = ferror(fh);
+    if (fclose(fh) || err || rename(tmp, path)) {
+        if (SWISH_DEBUG & SWISH_DEBUG_CONFIG)
+            SWISH_DEBUG_MSG("can't write config cache %s", path);
+        unlink(tmp);
+    }
+    else if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
+        SWISH_DEBUG_MSG("config cached in %s", path);
+    }
+
+  done:
+    swish_xfree(tmp);
+    swish_xfree(path);
+}
@@ -0,0 +1,264 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* dedup.c -- spot byte-identical documents before parsing them
+ *
+ * Each document's raw bytes are hashed with swish_hash64(). The hash and
+ * size are looked up in a fixed-size open-addressed table; a match means
+ * we have seen this content before, under the uri stored with it. When
+ * all SWISH_DEDUP_PROBE slots for a hash are taken the first is
+ * overwritten, so memory stays bounded and old documents are forgotten.
+ *
+ * The table can be saved to and loaded from a file, so a duplicate can be
+ * recognised across runs.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libswish3.h"
+#endif
+
+extern int SWISH_DEBUG;
+
+swish_DedupTable *
+swish_dedup_init(
+    unsigned long max_entries
+)
+{
+    swish_DedupTable *table;
+    unsigned long nslots;
+
+    nslots = SWISH_DEDUP_PROBE;
+    while (nslots < max_entries)
+        nslots <<= 1;
+
+    table = swish_xmalloc(sizeof(swish_DedupTable));
+    table->slots = swish_xmalloc(nslots * sizeof(swish_DedupEntry));
+    memset(table->slots, 0, nslots * sizeof(swish_DedupEntry));
+    table->nslots = nslots;
+    table->n = 0;
+    table->hits = 0;
+    table->misses = 0;
+    return table;
+}
+
+void
+swish_dedup_free(
+    swish_DedupTable *table
+)
+{
+    unsigned long i;
+
+    for (i = 0; i < table->nslots; i++) {
+        if (table->slots[i].uri != NULL)
+            swish_xfree(table->slots[i].uri);
+    }
+    swish_xfree(table->slots);
+    swish_xfree(table);
+}
+
+/*
+* the slot holding (hash, size), or the slot it should go in
+*/
+static swish_DedupEntry *
+find_slot(
+    swish_DedupTable *table,
+    uint64_t hash,
+    off_t size
+)
+{
+    unsigned long i, mask;
+    swish_DedupEntry *e;
+
+    mask = table->nslots - 1;
+    for (i = 0; i < SWISH_DEDUP_PROBE; i++) {
+        e = &table->slots[(hash + i) & mask];
+        if (e->uri == NULL || (e->hash == hash && e->size == size))
+            return e;
+    }
+
+/* all taken: evict the first */
+    return &table->slots[hash & mask];
+}
+
+static void
+set_slot(
+    swish_DedupTable *table,
+    swish_DedupEntry *e,
+    uint64_t hash,
+    off_t size,
+    const xmlChar *uri
+)
+{
+    if (e->uri != NULL)
+        swish_xfree(e->uri);
+    else
+        table->n++;
+
+    e->hash = hash;
+    e->size = size;
+    e->uri = swish_xstrdup(uri);
+}
+
+/*
+* returns the uri of an earlier document of len bytes whose
+* swish_hash64() (seed 0) was hash, or NULL after remembering this one
+* as uri. the returned string belongs to the table.
+*/
+const xmlChar *
+swish_dedup_check(
+    swish_DedupTable *table,
+    uint64_t hash,
+    size_t len,
+    const xmlChar *uri
+)
+{
+    swish_DedupEntry *e;
+
+    e = find_slot(table, hash, (off_t)len);
+
+    if (e->uri != NULL && e->hash == hash && e->size == (off_t)len) {
+        table->hits++;
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+            SWISH_DEBUG_MSG("%s has the same content as %s", uri, e->uri);
+        return e->uri;
+    }
+
+    table->misses++;
+    set_slot(table, e, hash, (off_t)len, uri == NULL ? (xmlChar *)"" : uri);
+    return NULL;
+}
+
+/*
+* add the entries saved in filename to table. a missing file is not
+* an error (there is nothing to load on the first run). returns the
+* number of entries read.
+*
+* file layout, integers big-endian:
+*   magic[4] count[8] then count * ( hash[8] size[8] urilen[2] uri[urilen] )
+*/
+long
+swish_dedup_load(
+    swish_DedupTable *table,
+    const char *filename
+)
+{
+    FILE *fh;
+    char magic[4];
+    uint64_t count = 0, hash = 0, size = 0, urilen = 0;
+    xmlChar *uri;
+    long i;
+
+    fh = fopen(filename, "rb");
+    if (fh == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        SWISH_CROAK("failed to open dedup file %s: %s", filename, strerror(errno));
+    }
+
+    /* close and free before croaking: a caller may catch the croak */
+    if (fread(magic, 1, 4, fh) != 4 || memcmp(magic, SWISH_DEDUP_MAGIC, 4)
+        || !swish_io_read_uint(fh, &count, 8)) {
+        fclose(fh);
+        SWISH_CROAK("%s is not a dedup file", filename);
+    }
+
+    for (i = 0; i < (long)count; i++) {
+        if (!swish_io_read_uint(fh, &hash, 8) || !swish_io_read_uint(fh, &size, 8)
+            || !swish_io_read_uint(fh, &urilen, 2)) {
+            fclose(fh);
+            SWISH_CROAK("dedup file %s is truncated at entry %ld", filename, i);
+        }
+        uri = swish_xmalloc(urilen + 1);
+        if (fread(uri, 1, urilen, fh) != urilen) {
+            swish_xfree(uri);
+            fclose(fh);
+            SWISH_CROAK("dedup file %s is truncated at entry %ld", filename, i);
+        }
+        uri[urilen] = '\0';
+        set_slot(table, find_slot(table, hash, (off_t)size), hash, (off_t)size, uri);
+        swish_xfree(uri);
+    }
+
+    if (fclose(fh)) {
+        SWISH_CROAK("error closing dedup file %s", filename);
+    }
+    return i;
+}
+
+/*
+* write table to filename, via a temporary file renamed into place so
+* a crash never leaves a partial file. returns the number of entries.
+*/
+long
+swish_dedup_save(
+    swish_DedupTable *table,
+    const char *filename
+)
+{
+    FILE *fh;
+    char *tmp;
+    size_t tmp_len;
+    unsigned long i;
+    int urilen, err;
+    swish_DedupEntry *e;
+
+    tmp_len = strlen(filename) + 5;
+    tmp = swish_xmalloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", filename);
+
+    fh = fopen(tmp, "wb");
+    if (fh == NULL) {
+        err = errno;
+        swish_xfree(tmp);
+        SWISH_CROAK("failed to open %s.tmp: %s", filename, strerror(err));
+    }
+
+    fwrite(SWISH_DEDUP_MAGIC, 1, 4, fh);
+    swish_io_write_uint(fh, table->n, 8);
+    for (i = 0; i < table->nslots; i++) {
+        e = &table->slots[i];
+        if (e->uri == NULL)
+            continue;
+        urilen = xmlStrlen(e->uri);
+        if (urilen > 0xffff)
+            urilen = 0xffff;
+        swish_io_write_uint(fh, e->hash, 8);
+        swish_io_write_uint(fh, (uint64_t)e->size, 8);
+        swish_io_write_uint(fh, (uint64_t)urilen, 2);
+        fwrite(e->uri, 1, urilen, fh);
+    }
+
+    err = ferror(fh);
+    if (fclose(fh) || err) {
+        swish_xfree(tmp);
+        SWISH_CROAK("error writing %s.tmp", filename);
+    }
+    if (rename(tmp, filename)) {
+        err = errno;
+        swish_xfree(tmp);
+        SWISH_CROAK("failed to rename %s.tmp to %s: %s", filename, filename, strerror(err));
+    }
+    swish_xfree(tmp);
+    return (long)table->n;
+}
@@ -55,6 +55,9 @@ swish_docinfo_init(
     docinfo->ext = NULL;
     docinfo->action = NULL;
     docinfo->is_gzipped = SWISH_FALSE;
+    docinfo->duplicate_of = NULL;
+    docinfo->truncated = SWISH_FALSE;
+    docinfo->binary = NULL;
 
     /*
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
@@ -112,6 +115,9 @@ swish_docinfo_free(
     if (ptr->parser != NULL)
         swish_xfree(ptr->parser);
 
+    if (ptr->duplicate_of != NULL)
+        swish_xfree(ptr->duplicate_of);
+
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY)
         SWISH_DEBUG_MSG("freeing docinfo ptr");
     swish_xfree(ptr);
@@ -285,6 +291,12 @@ swish_docinfo_debug(
     SWISH_DEBUG_MSG("  parser: %s", docinfo->parser);
     SWISH_DEBUG_MSG("  nwords: %d", docinfo->nwords);
     SWISH_DEBUG_MSG("  is_gzipped: %d", docinfo->is_gzipped);
+    if (docinfo->duplicate_of != NULL)
+        SWISH_DEBUG_MSG("  duplicate of: %s", docinfo->duplicate_of);
+    if (docinfo->truncated)
+        SWISH_DEBUG_MSG("  truncated: over its Limits");
+    if (docinfo->binary != NULL)
+        SWISH_DEBUG_MSG("  skipped as binary: %s", docinfo->binary);
     
     swish_xfree(ts);
 }
@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <err.h>
 #include <string.h>
+#include <setjmp.h>
 #include <libxml/globals.h>
 
 #include "libswish3.h"
@@ -35,6 +36,7 @@ extern int SWISH_DEBUG;
 extern int SWISH_WARNINGS;
 
 static FILE *error_handle = NULL;
+static SWISH_THREAD_LOCAL swish_ErrorFrame *error_frame = NULL;
 
 void
 swish_set_error_handle(
@@ -44,6 +46,30 @@ swish_set_error_handle(
     error_handle = where;
 }
 
+/*
+* while a frame is pushed, swish_croak() in this thread
+* longjmps to it instead of exiting
+*/
+void
+swish_error_push(
+    swish_ErrorFrame *frame
+)
+{
+    frame->msg[0] = '\0';
+    frame->prev = error_frame;
+    error_frame = frame;
+}
+
+/* safe to call more than once for the same frame */
+void
+swish_error_pop(
+    swish_ErrorFrame *frame
+)
+{
+    if (error_frame == frame)
+        error_frame = frame->prev;
+}
+
 void
 swish_croak(
     const char *file,
@@ -54,6 +80,7 @@ swish_croak(
 )
 {
     va_list args;
+    swish_ErrorFrame *frame;
 
     if (!error_handle)
         error_handle = stderr;
@@ -64,6 +91,15 @@ swish_croak(
     fprintf(error_handle, "\n");
     va_end(args);
 
+    if (error_frame != NULL) {
+        frame = error_frame;
+        error_frame = frame->prev;
+        va_start(args, msgfmt);
+        vsnprintf(frame->msg, SWISH_MAXSTRLEN, msgfmt, args);
+        va_end(args);
+        longjmp(frame->env, 1);
+    }
+
     if (!errno)
         errno = 1;
 
@@ -128,6 +164,18 @@ swish_err_msg(
             msg = "No such file or directory";
             break;
 
+        case SWISH_ERR_DOC_FAILED:
+            msg = "Document failed to parse";
+            break;
+
+        case SWISH_ERR_DOC_UNCHANGED:
+            msg = "Document unchanged since last run";
+            break;
+
+        case SWISH_ERR_DOC_OTHER_SHARD:
+            msg = "Document belongs to another shard";
+            break;
+
         default:
             msg = "Unknown error";
     }
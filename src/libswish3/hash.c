@@ -21,6 +21,7 @@
 
 #ifndef LIBSWISH3_SINGLE_FILE
 #include <stdlib.h>
+#include <string.h>
 
 #include "libswish3.h"
 #endif
@@ -200,3 +201,48 @@ swish_hash_dump(
     xmlHashScan(hash, (xmlHashScanner) dump_hash_value, (xmlChar*)label);
     SWISH_DEBUG_MSG("end hash_dump for %s [0x%x]", label, hash);
 }
+
+/*
+* 64-bit hash of len bytes, for content rather than hash table keys.
+* MurmurHash64A by Austin Appleby (public domain), reading 8 bytes at a time.
+*/
+uint64_t
+swish_hash64(
+    const void *buf,
+    size_t len,
+    uint64_t seed
+)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *end = p + (len & ~(size_t)7);
+    uint64_t h = seed ^ (len * m);
+    uint64_t k;
+
+    while (p != end) {
+        memcpy(&k, p, 8);   /* unaligned-safe; compiles to a single load */
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        p += 8;
+    }
+
+    switch (len & 7) {
+        case 7: h ^= (uint64_t)p[6] << 48; /* fall through */
+        case 6: h ^= (uint64_t)p[5] << 40; /* fall through */
+        case 5: h ^= (uint64_t)p[4] << 32; /* fall through */
+        case 4: h ^= (uint64_t)p[3] << 24; /* fall through */
+        case 3: h ^= (uint64_t)p[2] << 16; /* fall through */
+        case 2: h ^= (uint64_t)p[1] << 8; /* fall through */
+        case 1: h ^= (uint64_t)p[0];
+                h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
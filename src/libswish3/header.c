@@ -20,6 +20,10 @@
 /* read/write the swish.xml header file */
 
 #ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
 #include <libxml/xmlreader.h>
 #include <libxml/xmlwriter.h>
 #include <libxml/encoding.h>
@@ -39,12 +43,14 @@ typedef struct
     boolean isparser;
     boolean isalias;
     boolean ismime;
+    boolean islimits;
     const xmlChar *parent_name;
     xmlChar *conf_file;
     swish_Config *config;
     boolean is_valid;
     unsigned int prop_id;
     unsigned int meta_id;
+    swish_StringList *deps;     // files read, for swish_config_cache_save()
 } headmaker;
 
 typedef struct
@@ -84,6 +90,10 @@ static void read_property(
     xmlTextReaderPtr reader,
     headmaker * h
 );
+static void read_limits(
+    xmlTextReaderPtr reader,
+    headmaker * h
+);
 static void process_node(
     xmlTextReaderPtr reader,
     headmaker * h
@@ -108,6 +118,15 @@ static void read_header(
     char *filename,
     headmaker * h
 );
+static void load_header(
+    char *filename,
+    headmaker * h
+);
+static boolean merge_header(
+    char *filename,
+    swish_Config *c,
+    swish_StringList *deps
+);
 static void test_meta_alias_for(
     swish_MetaName *meta,
     swish_Config *c,
@@ -164,6 +183,11 @@ static void write_parser(
     xmlTextWriterPtr writer,
     xmlChar *key
 );
+static void write_limit(
+    swish_Limits *limits,
+    xmlTextWriterPtr writer,
+    xmlChar *key
+);
 static void write_parsers(
     xmlTextWriterPtr writer,
     xmlHashTablePtr parsers
@@ -224,6 +248,10 @@ handle_special_misc_flags(
         h->config->flags->ignore_xmlns = 
             swish_string_to_boolean(swish_hash_fetch(h->config->misc, BAD_CAST SWISH_IGNORE_XMLNS));
     }
+    if (swish_hash_exists(h->config->misc, BAD_CAST SWISH_SKIP_BINARY)) {
+        h->config->flags->skip_binary =
+            swish_string_to_boolean(swish_hash_fetch(h->config->misc, BAD_CAST SWISH_SKIP_BINARY));
+    }
     if (swish_hash_exists(h->config->misc, BAD_CAST SWISH_UNDEFINED_METATAGS)) {
         v = swish_hash_fetch(h->config->misc, BAD_CAST SWISH_UNDEFINED_METATAGS);
         if (xmlStrEqual(v, BAD_CAST "error")) {
@@ -673,6 +701,10 @@ process_node(
             reset_headmaker(h);
             return;
         }
+        else if (xmlStrEqual(name, (const xmlChar *)SWISH_LIMITS)) {
+            reset_headmaker(h);
+            return;
+        }
 
         //SWISH_DEBUG_MSG("END ELEMENT name %s  type %d  value %s", name, type, value);
 
@@ -707,7 +739,7 @@ process_node(
                         xmlFree(xuri); /* because we did not malloc it */
                         xmlFree(path); /* because we did not malloc it */
                     }
-                    swish_header_merge((char*)conf_file, h->config);
+                    merge_header((char*)conf_file, h->config, h->deps);
                     swish_xfree(conf_file);
                     return;
                 }
@@ -744,6 +776,11 @@ process_node(
             h->isalias = 1;
             return;
         }
+        else if (xmlStrEqual(name, (const xmlChar *)SWISH_LIMITS)) {
+            reset_headmaker(h);
+            h->islimits = 1;
+            return;
+        }
 
         //SWISH_DEBUG_MSG("NOT END ELEMENT name %s  type %d  value %s", name, type, value);
     }
@@ -774,6 +811,10 @@ process_node(
             read_key_values_pair(reader, h->config->tag_aliases, (xmlChar *)name);
             return;
         }
+        else if (h->islimits) {
+            read_limits(reader, h);
+            return;
+        }
         else if (xmlStrEqual((xmlChar *)SWISH_CLASS_ATTRIBUTES, (xmlChar *)name)) {
             read_key_value_stringlist(reader, h->config->stringlists, (xmlChar *)name);
             return;
@@ -792,6 +833,67 @@ process_node(
 
 }
 
+/*
+* <Limits><HTML bytes="1000000" seconds="5" /><default tokens="100000" /></Limits>
+* the element names a parser, or "default"; a mime="type/subtype"
+* attribute scopes it to that MIME type instead.
+*/
+static void
+read_limits(
+    xmlTextReaderPtr reader,
+    headmaker * h
+)
+{
+    swish_Limits *limits;
+    xmlChar *key;
+    const xmlChar *attr, *attr_val;
+
+    if (xmlTextReaderNodeType(reader) != XML_READER_TYPE_ELEMENT)
+        return;
+
+    limits = swish_xmalloc(sizeof(swish_Limits));
+    limits->max_bytes = 0;
+    limits->max_tokens = 0;
+    limits->max_seconds = 0;
+    key = swish_xstrdup(xmlTextReaderConstName(reader));
+
+    while (xmlTextReaderMoveToNextAttribute(reader) == 1) {
+        attr = xmlTextReaderConstName(reader);
+        attr_val = xmlTextReaderConstValue(reader);
+        if (xmlStrEqual(attr, BAD_CAST "bytes")) {
+            limits->max_bytes = (off_t)strtoll((char *)attr_val, NULL, 10);
+        }
+        else if (xmlStrEqual(attr, BAD_CAST "tokens")) {
+            limits->max_tokens = (unsigned int)strtoul((char *)attr_val, NULL, 10);
+        }
+        else if (xmlStrEqual(attr, BAD_CAST "seconds")) {
+            limits->max_seconds = strtod((char *)attr_val, NULL);
+        }
+        else if (xmlStrEqual(attr, BAD_CAST "mime")) {
+            swish_xfree(key);
+            key = swish_str_tolower((xmlChar *)attr_val);
+        }
+        else {
+            swish_xfree(limits);
+            swish_xfree(key);
+            SWISH_CROAK("unknown %s attribute: %s", SWISH_LIMITS, attr);
+        }
+    }
+
+    if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
+        SWISH_DEBUG_MSG("limits for %s: bytes %ld tokens %u seconds %.3f", key,
+                        (long)limits->max_bytes, limits->max_tokens, limits->max_seconds);
+    }
+
+    if (swish_hash_exists(h->config->limits, key)) {
+        swish_hash_replace(h->config->limits, key, limits);
+    }
+    else {
+        swish_hash_add(h->config->limits, key, limits);
+    }
+    swish_xfree(key);
+}
+
 static void
 read_key_value_stringlist(
     xmlTextReaderPtr reader,
@@ -940,6 +1042,9 @@ read_header(
     else {
         reader = xmlReaderForFile(filename, NULL, 0);
         h->conf_file = swish_xstrdup(BAD_CAST filename);
+        if (h->deps != NULL) {
+            swish_stringlist_add_string(h->deps, swish_xstrdup(BAD_CAST filename));
+        }
 
         if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
             SWISH_DEBUG_MSG("header parsed from file");
@@ -969,6 +1074,40 @@ read_header(
     xmlCleanupParser();
 }
 
+/*
+* read_header(), or with SWISH_CONFIG_CACHE set in the environment, take
+* the config from filename's binary cache if it is fresh, and write the
+* cache after reading the XML if it was not.
+*/
+static void
+load_header(
+    char *filename,
+    headmaker * h
+)
+{
+    swish_Config *cached;
+    const char *env;
+
+    env = getenv("SWISH_CONFIG_CACHE");
+    if (env == NULL || !swish_string_to_int((char *)env)
+        || !swish_fs_file_exists(BAD_CAST filename)) {
+        read_header(filename, h);
+        return;
+    }
+
+    if ((cached = swish_config_cache_load(filename)) != NULL) {
+        swish_config_free(h->config);
+        h->config = cached;
+        return;
+    }
+
+    h->deps = swish_stringlist_init();
+    read_header(filename, h);
+    swish_config_cache_save(h->config, filename, h->deps);
+    swish_stringlist_free(h->deps);
+    h->deps = NULL;
+}
+
 static void
 test_meta_alias_for(
     swish_MetaName *meta,
@@ -1023,6 +1162,7 @@ init_headmaker(
     h->prop_id = SWISH_PROP_THIS_MUST_COME_LAST_ID;
     h->meta_id = SWISH_META_THIS_MUST_COME_LAST_ID;
     h->conf_file = NULL;
+    h->deps = NULL;
     return h;
 }
 
@@ -1037,6 +1177,7 @@ reset_headmaker(
     h->isalias = 0;
     h->isparser = 0;
     h->ismime = 0;
+    h->islimits = 0;
     h->parent_name = NULL;
 }
 
@@ -1061,15 +1202,26 @@ swish_header_validate(
     return 1;                   /* how to test ? */
 }
 
-boolean
-swish_header_merge(
+/*
+* deps is NULL for a file named by the caller, which may come from the
+* cache, and the list being built for an IncludeConfigFile under one.
+*/
+static boolean
+merge_header(
     char *filename,
-    swish_Config *c
+    swish_Config *c,
+    swish_StringList *deps
 )
 {
     headmaker *h;
     h = init_headmaker();
-    read_header(filename, h);
+    if (deps == NULL) {
+        load_header(filename, h);
+    }
+    else {
+        h->deps = deps;
+        read_header(filename, h);
+    }
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         SWISH_DEBUG_MSG("read_header complete");
     }
@@ -1092,6 +1244,15 @@ swish_header_merge(
     return 1;
 }
 
+boolean
+swish_header_merge(
+    char *filename,
+    swish_Config *c
+)
+{
+    return merge_header(filename, c, NULL);
+}
+
 swish_Config *
 swish_header_read(
     char *filename
@@ -1100,7 +1261,7 @@ swish_header_read(
     headmaker *h;
     swish_Config *c;
     h = init_headmaker();
-    read_header(filename, h);
+    load_header(filename, h);
     c = h->config;
     if (h->conf_file != NULL) {
         swish_xfree(h->conf_file);
@@ -1306,6 +1467,44 @@ write_parsers(
     xmlHashScan(parsers, (xmlHashScanner)write_parser, writer);
 }
 
+static void
+write_limit(
+    swish_Limits *limits,
+    xmlTextWriterPtr writer,
+    xmlChar *key
+)
+{
+    int rc;
+
+/* MIME types are not valid element names */
+    if (xmlStrchr(key, '/') != NULL) {
+        write_open_tag(writer, BAD_CAST SWISH_DEFAULT_PARSER);
+        rc = xmlTextWriterWriteAttribute(writer, BAD_CAST "mime", key);
+        if (rc < 0) {
+            SWISH_CROAK("Error writing limits mime attribute for %s", key);
+        }
+    }
+    else {
+        write_open_tag(writer, key);
+    }
+    rc = xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "bytes", "%ld",
+                                           (long)limits->max_bytes);
+    if (rc < 0) {
+        SWISH_CROAK("Error writing limits bytes attribute for %s", key);
+    }
+    rc = xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "tokens", "%u",
+                                           limits->max_tokens);
+    if (rc < 0) {
+        SWISH_CROAK("Error writing limits tokens attribute for %s", key);
+    }
+    rc = xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "seconds", "%g",
+                                           limits->max_seconds);
+    if (rc < 0) {
+        SWISH_CROAK("Error writing limits seconds attribute for %s", key);
+    }
+    write_close_tag(writer);
+}
+
 static void
 write_mime(
     xmlChar *type,
@@ -1393,13 +1592,23 @@ swish_header_write(
 #else
     int rc;
     xmlTextWriterPtr writer;
+    char *tmp;
+    size_t tmp_len;
 
     if (SWISH_DEBUG & SWISH_DEBUG_CONFIG) {
         swish_config_debug(config);
     }
 
+/*
+* write beside uri and rename into place, so a reader (a search
+* server re-reading the header, say) never sees half a file
+*/
+    tmp_len = strlen(uri) + 5;
+    tmp = swish_xmalloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", uri);
+
 /* Create a new XmlWriter for uri, with no compression. */
-    writer = xmlNewTextWriterFilename((const char *)uri, 0);
+    writer = xmlNewTextWriterFilename((const char *)tmp, 0);
     if (writer == NULL) {
         SWISH_CROAK("Error creating the xml writer\n");
     }
@@ -1469,6 +1678,10 @@ swish_header_write(
     write_tag_aliases(writer, config->tag_aliases);
     write_close_tag(writer);
 
+    write_open_tag(writer, BAD_CAST SWISH_LIMITS);
+    xmlHashScan(config->limits, (xmlHashScanner)write_limit, writer);
+    write_close_tag(writer);
+
 /* misc tags have no parent */
     write_misc(writer, config->misc);
 
@@ -1479,5 +1692,9 @@ swish_header_write(
     }
 
     xmlFreeTextWriter(writer);
+    if (rename(tmp, uri)) {
+        SWISH_CROAK("failed to rename %s to %s: %s", tmp, uri, strerror(errno));
+    }
+    swish_xfree(tmp);
 #endif
 }
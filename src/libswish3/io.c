@@ -24,6 +24,9 @@
 #include <errno.h>
 #include <err.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <zlib.h>
 
 #include "libswish3.h"
@@ -37,6 +40,10 @@ static void no_nulls(
     xmlChar *buffer,
     long bytes_read
 );
+static off_t gz_isize(
+    xmlChar *filename,
+    off_t flen
+);
 
 /* substitute embedded null chars with a newline so we can treat the buffer as a whole
  * string based on similar code in swish-e ver2 file.c */
@@ -81,10 +88,13 @@ swish_io_slurp_fh(
 {
     size_t bytes_read;
     xmlChar *buffer;
+    swish_MemSubsystem prev_mem;
 
 /* printf("slurping %d bytes\n", flen); */
 
+    prev_mem = swish_mem_enter(SWISH_MEM_IO);
     buffer = swish_xmalloc(flen + 1);
+    swish_mem_leave(prev_mem);
     *buffer = '\0';
 
     bytes_read = fread(buffer, sizeof(xmlChar), flen, fh);
@@ -114,6 +124,7 @@ swish_io_slurp_file_len(
     size_t bytes_read;
     FILE *fp;
     xmlChar *buffer;
+    swish_MemSubsystem prev_mem;
 
     if (flen > SWISH_MAX_FILE_LEN) {
         flen = SWISH_MAX_FILE_LEN;
@@ -125,7 +136,9 @@ swish_io_slurp_file_len(
     if (SWISH_DEBUG & SWISH_DEBUG_IO)
         SWISH_DEBUG_MSG("slurp file '%s' [%ld bytes]", filename, flen);
 
+    prev_mem = swish_mem_enter(SWISH_MEM_IO);
     buffer = swish_xmalloc(flen + 1);
+    swish_mem_leave(prev_mem);
 
     if ((fp = fopen((char *)filename, "r")) == 0) {
         SWISH_CROAK("Error reading file %s: %s", filename, strerror(errno));
@@ -151,6 +164,107 @@ swish_io_slurp_file_len(
     return buffer;
 }
 
+/* map flen bytes of filename read-only into memory with a private (copy-on-write)
+ * mapping. Returns NULL if the file cannot be mapped in a way that leaves the
+ * buffer NUL-terminated, in which case the caller should slurp it instead.
+ * Free the return value with swish_io_munmap(). */
+xmlChar *
+swish_io_mmap_file(
+    xmlChar *filename,
+    off_t flen,
+    boolean binmode
+)
+{
+    int fd;
+    long pagesize;
+    void *map;
+
+    pagesize = sysconf(_SC_PAGESIZE);
+
+/* the tail of the last page is zero-filled, which gives us the terminating NUL
+ * for free. A file that ends exactly on a page boundary has no such tail. */
+    if (flen <= 0 || flen > SWISH_MAX_FILE_LEN || pagesize <= 0
+        || (flen % pagesize) == 0) {
+        return NULL;
+    }
+
+    if ((fd = open((char *)filename, O_RDONLY)) == -1) {
+        SWISH_CROAK("Error reading file %s: %s", filename, strerror(errno));
+    }
+
+    map = mmap(NULL, (size_t)flen, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (map == MAP_FAILED) {
+        if (SWISH_DEBUG & SWISH_DEBUG_IO)
+            SWISH_DEBUG_MSG("mmap failed for '%s': %s", filename, strerror(errno));
+        return NULL;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(map, (size_t)flen, MADV_SEQUENTIAL);
+#endif
+
+    if (SWISH_DEBUG & SWISH_DEBUG_IO)
+        SWISH_DEBUG_MSG("mmap file '%s' [%ld bytes]", filename, (long)flen);
+
+/* pages are only copied if no_nulls() actually has to write to them */
+    if (!binmode) {
+        no_nulls(filename, (xmlChar *)map, (long)flen);
+    }
+
+    return (xmlChar *)map;
+}
+
+void
+swish_io_munmap(
+    xmlChar *buffer,
+    off_t flen
+)
+{
+    if (munmap(buffer, (size_t)flen)) {
+        SWISH_WARN("munmap failed: %s", strerror(errno));
+    }
+}
+
+/* the last 4 bytes of a gzip file hold the uncompressed size (mod 2^32),
+ * little-endian. Returns 0 if it can't be read. Anyone can write those
+ * bytes, so it is only a hint: capped at SWISH_GZ_MAX_RATIO times the
+ * compressed size, and at SWISH_MAX_FILE_LEN. */
+static off_t
+gz_isize(
+    xmlChar *filename,
+    off_t flen
+)
+{
+    FILE *fp;
+    unsigned char trailer[4];
+    off_t isize;
+
+    isize = 0;
+    if (flen < 18) {            /* smaller than an empty gzip member */
+        return 0;
+    }
+    if ((fp = fopen((char *)filename, "rb")) == NULL) {
+        return 0;
+    }
+    if (fseek(fp, -4L, SEEK_END) == 0 && fread(trailer, 1, 4, fp) == 4) {
+        isize = (off_t)trailer[0]
+            | ((off_t)trailer[1] << 8)
+            | ((off_t)trailer[2] << 16)
+            | ((off_t)trailer[3] << 24);
+    }
+    fclose(fp);
+
+    if (isize > flen * SWISH_GZ_MAX_RATIO) {
+        isize = flen * SWISH_GZ_MAX_RATIO;
+    }
+    if (isize > SWISH_MAX_FILE_LEN) {
+        isize = SWISH_MAX_FILE_LEN;
+    }
+    return isize;
+}
+
 xmlChar *
 swish_io_slurp_gzfile_len(
     xmlChar *filename,
@@ -158,14 +272,35 @@ swish_io_slurp_gzfile_len(
     boolean binmode
 )
 {
-    off_t bytes_read, buffer_len;
-    int ret;
+    off_t buffer_len, buf_size, isize;
+    int bytes_read, ret;
+    unsigned char extra;
     gzFile fh;
     xmlChar *buffer;
-    unsigned int buf_size;
     int compression_rate = 3;   /* seems about right */
+    swish_MemSubsystem prev_mem;
     
-    buf_size = sizeof(xmlChar)*(*flen)*compression_rate;
+/* presize from the gzip trailer if we can, else guess. either way the buffer
+ * grows as needed, so the guess only affects how often we realloc. */
+    isize = gz_isize(filename, *flen);
+    if (isize) {
+        buf_size = isize + 1;
+    }
+    else {
+        buf_size = (*flen) * compression_rate;
+    }
+    if (buf_size < SWISH_BUFFER_CHUNK_SIZE) {
+        buf_size = SWISH_BUFFER_CHUNK_SIZE;
+    }
+    if (buf_size > SWISH_MAX_FILE_LEN + 1) {
+        buf_size = SWISH_MAX_FILE_LEN + 1;
+    }
+    if (SWISH_DEBUG & SWISH_DEBUG_IO) {
+        SWISH_DEBUG_MSG("gzip ISIZE for %s = %ld; initial buffer %ld",
+            filename, (long)isize, (long)buf_size);
+    }
+
+    prev_mem = swish_mem_enter(SWISH_MEM_IO);
     buffer = swish_xmalloc(buf_size);
     buffer_len = 0;
     fh = gzopen((char*)filename, "r");
@@ -173,33 +308,50 @@ swish_io_slurp_gzfile_len(
         SWISH_CROAK("Failed to open file '%s' for read: %s",
             filename, strerror(errno));
     }
-    while ((bytes_read = gzread(fh, buffer, buf_size)) != 0) {
+
+/* inflate incrementally, appending to the buffer. gzread() may legitimately
+ * return fewer bytes than asked for, so only 0 means EOF. Like a plain
+ * file, anything past SWISH_MAX_FILE_LEN is dropped. */
+    while (1) {
+        if (buffer_len >= SWISH_MAX_FILE_LEN) {
+            if (gzread(fh, &extra, 1) > 0) {
+                SWISH_WARN("max file len %ld exceeded - cannot read all of gzipped %s",
+                           SWISH_MAX_FILE_LEN, filename);
+            }
+            break;
+        }
+        if (buffer_len + 1 >= buf_size) {
+            buf_size *= 2;
+            if (buf_size > SWISH_MAX_FILE_LEN + 1) {
+                buf_size = SWISH_MAX_FILE_LEN + 1;
+            }
+            buffer = swish_xrealloc(buffer, buf_size);
+            if (SWISH_DEBUG & SWISH_DEBUG_IO) {
+                SWISH_DEBUG_MSG("grew buffer to %ld", (long)buf_size);
+            }
+        }
+        bytes_read = gzread(fh, buffer + buffer_len,
+                            (unsigned int)(buf_size - buffer_len - 1));
         if (bytes_read == -1) {
             SWISH_CROAK("Error reading gzipped file '%s': %s",
-                filename, strerror(errno));
+                filename, gzerror(fh, &ret));
         }
-        if (SWISH_DEBUG & SWISH_DEBUG_IO) {
-            SWISH_DEBUG_MSG("Read %d bytes from %s", bytes_read, filename);
-        }
-        if (bytes_read < buf_size) {
+        if (bytes_read == 0) {
             if (SWISH_DEBUG & SWISH_DEBUG_IO) {
                 SWISH_DEBUG_MSG("Read to end of file");
             }
-            buffer_len = bytes_read;
             break;
         }
-        buf_size *= compression_rate;
-        buffer = swish_xrealloc(buffer, buf_size);
-        if (SWISH_DEBUG & SWISH_DEBUG_IO) {
-            SWISH_DEBUG_MSG("grew buffer to %d", buf_size);
-        }
-        buffer_len = bytes_read;
-        ret = gzrewind(fh);
         if (SWISH_DEBUG & SWISH_DEBUG_IO) {
-            SWISH_DEBUG_MSG("gzrewind ret = %d", ret);
+            SWISH_DEBUG_MSG("Read %d bytes from %s", bytes_read, filename);
         }
+        buffer_len += bytes_read;
+    }
+    swish_mem_leave(prev_mem);
+    ret = gzclose(fh);
+    if (ret != Z_OK) {
+        SWISH_WARN("Error closing gzipped file '%s': %d", filename, ret);
     }
-    ret = gzclose(fh);    // TODO check for err?
         
     buffer[buffer_len] = '\0';
     
@@ -208,8 +360,8 @@ swish_io_slurp_gzfile_len(
     }
    
     if (SWISH_DEBUG & SWISH_DEBUG_IO) { 
-        SWISH_DEBUG_MSG("slurped gzipped file '%s' buffer_len=%d buf_size=%d orig flen=%d", 
-            filename, buffer_len, buf_size, *flen);
+        SWISH_DEBUG_MSG("slurped gzipped file '%s' buffer_len=%ld buf_size=%ld orig flen=%ld", 
+            filename, (long)buffer_len, (long)buf_size, (long)*flen);
     }
 
     /* set the flen pointer to the actual length */
@@ -295,3 +447,35 @@ swish_io_is_skippable_line(
     
     return SWISH_FALSE;
 }
+
+/* nbytes of n, most significant first */
+void
+swish_io_write_uint(
+    FILE *fh,
+    uint64_t n,
+    int nbytes
+)
+{
+    while (nbytes--) {
+        fputc((int)((n >> (nbytes * 8)) & 0xff), fh);
+    }
+}
+
+/* SWISH_FALSE at EOF */
+boolean
+swish_io_read_uint(
+    FILE *fh,
+    uint64_t *n,
+    int nbytes
+)
+{
+    int c;
+
+    *n = 0;
+    while (nbytes--) {
+        if ((c = fgetc(fh)) == EOF)
+            return SWISH_FALSE;
+        *n = (*n << 8) | (uint64_t)c;
+    }
+    return SWISH_TRUE;
+}
@@ -22,6 +22,8 @@
 #define __LIBSWISH3_H__
 
 #ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <setjmp.h>
 #include <sys/types.h>
 #include <stdint.h>
 #include <inttypes.h>
@@ -35,9 +37,20 @@
 #define SWISH_LIB_VERSION           VERSION
 #define SWISH_VERSION               "3.0.0"
 #define SWISH_BUFFER_CHUNK_SIZE     16384
+#define SWISH_NB_BUFFER_SIZE        256     /* initial size of each NamedBuffer value */
+#define SWISH_ARENA_BLOCK_SIZE      16384   /* per-document arena grows in these */
 #define SWISH_TOKEN_LIST_SIZE       1024
+#define SWISH_DEADLINE_STRIDE       4096    /* tokenizer checks the clock every this many chars */
 #define SWISH_MAXSTRLEN             2048
 #define SWISH_MAX_HEADERS           6
+/* swish_parse_fh_framed() record layout, integers big-endian:
+ *   magic[4] size[8] mtime[8] parser[1] (H|X|T or 0)
+ *   then uri, mime, encoding each as len[2] + bytes (len 0 == unset)
+ *   then size bytes of body
+ */
+#define SWISH_FRAME_MAGIC           "SW3F"
+#define SWISH_FRAME_MAGIC_LEN       4
+#define SWISH_FRAME_STRLEN_BYTES    2
 #define SWISH_RD_BUFFER_SIZE        65536   // used ??
 #define SWISH_MAX_WORD_LEN          256
 #define SWISH_MIN_WORD_LEN          1
@@ -61,6 +74,7 @@
 #define SWISH_PARSERS               "Parsers"
 #define SWISH_INDEX                 "Index"
 #define SWISH_ALIAS                 "TagAlias"
+#define SWISH_LIMITS                "Limits"
 #define SWISH_WORDS                 "Words"
 #define SWISH_DEFAULT_PARSER        "default"
 #define SWISH_PARSER_TXT            "TXT"
@@ -71,11 +85,15 @@
 #define SWISH_INDEX_NAME            "Name"
 #define SWISH_INDEX_LOCALE          "Locale"
 #define SWISH_INDEX_STEMMER_LANG    "Stemmer"
+#define SWISH_INDEX_BATCH_SIZE      "BatchSize"
+#define SWISH_INDEX_FLUSH_MB        "FlushMB"
+#define SWISH_INDEX_SORT_KEYS       "SortKeys"
 #define SWISH_DEFAULT_VALUE         "1"
 #define SWISH_TOKENIZE              "Tokenize"
 #define SWISH_CASCADE_META_CONTEXT  "CascadeMetaContext"
 #define SWISH_IGNORE_XMLNS          "IgnoreXMLNameSpaces"
 #define SWISH_FOLLOW_XINCLUDE       "FollowXInclude"
+#define SWISH_SKIP_BINARY           "SkipBinary"
 #define SWISH_UNDEFINED_METATAGS    "UndefinedMetaTags"
 #define SWISH_UNDEFINED_XML_ATTRIBUTES "UndefinedXMLAttributes"
 
@@ -97,6 +115,7 @@
 #define SWISH_LUCY_FORMAT         "Lucy"
 #define SWISH_INDEX_FILEFORMAT    "Native"
 #define SWISH_HEADER_FILE         "swish.xml"
+#define SWISH_MANIFEST_FILE       "swish.manifest"
 
 /* properties */
 #define SWISH_PROP_STRING          1
@@ -125,7 +144,10 @@
 
 /* error codes */
 typedef enum {
-    SWISH_ERR_NO_SUCH_FILE = 1
+    SWISH_ERR_NO_SUCH_FILE = 1,
+    SWISH_ERR_DOC_FAILED,           /* croaked while parsing; see swish_Parser->error_msg */
+    SWISH_ERR_DOC_UNCHANGED,        /* not parsed: the manifest says nothing changed */
+    SWISH_ERR_DOC_OTHER_SHARD       /* not parsed: the path hashes to another shard */
 } SWISH_ERR_CODES;
 
 /* built-in id values */
@@ -175,6 +197,19 @@ typedef enum {
 /* utils */
 #define SWISH_MAX_WORD_LEN        256
 #define SWISH_MAX_FILE_LEN        102400000 /* ~100 mb */
+#define SWISH_GZ_MAX_RATIO        32        /* presize gunzip buffers to at most this * compressed size */
+#define SWISH_MMAP_THRESHOLD      262144    /* mmap files at least this big */
+#define SWISH_SNIFF_LEN           4096      /* bytes swish_mime_sniff_binary() looks at */
+#define SWISH_XINCLUDE_CACHE_SIZE 8388608   /* bytes of parsed XIncludes kept per swish_3 */
+#define SWISH_QUERY_CACHE_ENTRIES 1000      /* default results kept by a search server */
+#define SWISH_QUERY_CACHE_SIZE  33554432    /* and their default total bytes */
+#define SWISH_DEDUP_ENTRIES       1048576   /* default swish_dedup_init() size */
+#define SWISH_DEDUP_PROBE         8         /* slots tried before evicting */
+#define SWISH_CONFIG_CACHE_EXT    ".cache"  /* swish_config_cache_save() file, after the XML name */
+#define SWISH_CONFIG_CACHE_MAGIC  "SW3C"    /* and its header */
+#define SWISH_CONFIG_CACHE_VERSION 1       /* after the magic; bump when the layout changes */
+#define SWISH_DEDUP_MAGIC         "SW3D"    /* swish_dedup_save() file header */
+#define SWISH_MANIFEST_MAGIC      "SW3M"    /* swish_manifest_save() file header */
 
 #if defined(WIN32) && !defined (__CYGWIN__)
 #define SWISH_PATH_SEP             '\\'
@@ -193,6 +228,7 @@ typedef enum {
 #define SWISH_LATIN1_ENCODING     "ISO8859-1"
 #define SWISH_LOCALE              "en_US.UTF-8"
 #define SWISH_ENCODING_ERROR      100
+#define SWISH_ENCODING_SNIFF_LEN  8192  /* bytes checked to guess text encoding */
 
 /* debugging levels */
 typedef enum {
@@ -206,6 +242,68 @@ typedef enum {
     SWISH_DEBUG_IO          = 128
 } SWISH_DEBUG_LEVELS;
 
+/* memory accounting buckets. see swish_mem_enter() */
+typedef enum {
+    SWISH_MEM_OTHER = 0,
+    SWISH_MEM_TOKENIZER,
+    SWISH_MEM_PARSER,
+    SWISH_MEM_NAMEDBUFFER,
+    SWISH_MEM_CONFIG,
+    SWISH_MEM_IO,
+    SWISH_MEM_NSUBSYSTEMS
+} swish_MemSubsystem;
+
+/* per-document timing buckets. see swish_PerfStats */
+typedef enum {
+    SWISH_PERF_OTHER = 0,
+    SWISH_PERF_READ,            /* slurp, mmap, gunzip */
+    SWISH_PERF_ENCODING,        /* sniffing and transcoding */
+    SWISH_PERF_PARSE,           /* libxml2 SAX and our callbacks */
+    SWISH_PERF_TOKENIZE,
+    SWISH_PERF_NAMEDBUFFER,
+    SWISH_PERF_HANDLER,
+    SWISH_PERF_NPHASES
+} swish_PerfPhase;
+#define SWISH_PERF_HIST_SIZE        32  /* log2 buckets */
+
+/* 
+ * compile with -DSWISH_NO_DEBUG (configure --disable-debug) to drop the
+ * SWISH_DEBUG tests from the parser and tokenizer hot paths altogether.
+ */
+#ifdef SWISH_NO_DEBUG
+#define SWISH_DEBUG_ON(level)       0
+#else
+#define SWISH_DEBUG_ON(level)       (SWISH_DEBUG & (level))
+#endif
+
+/* 
+ * trace events. SWISH_TRACE_EVENT() is empty unless built with -DSWISH_TRACE
+ * (configure --enable-trace). see swish_trace_dump()
+ */
+typedef enum {
+    SWISH_TRACE_DOC_START = 1,
+    SWISH_TRACE_DOC_END,
+    SWISH_TRACE_TAG_OPEN,
+    SWISH_TRACE_TAG_CLOSE,
+    SWISH_TRACE_FLUSH,          /* value is bytes flushed */
+    SWISH_TRACE_TOKENS          /* value is tokens added */
+} swish_TraceType;
+#define SWISH_TRACE_RING_SIZE       8192    /* events kept per thread */
+#define SWISH_TRACE_NAME_LEN        48
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#define SWISH_THREAD_LOCAL _Thread_local
+#else
+#define SWISH_THREAD_LOCAL __thread
+#endif
+
+#ifdef SWISH_TRACE
+#define SWISH_TRACE_EVENT(type, name, value)                        \
+    swish_trace_event((type), (const char *)(name), (long)(value))
+#else
+#define SWISH_TRACE_EVENT(type, name, value)
+#endif
+
 /* the FUNCTION__ logic below first appeared in Perl 5.8.8
  * mostly it is for Win32 compat
  */
@@ -243,6 +341,7 @@ typedef struct swish_3                  swish_3;
 typedef struct swish_StringList         swish_StringList;
 typedef struct swish_Config             swish_Config;
 typedef struct swish_ConfigFlags        swish_ConfigFlags;
+typedef struct swish_Limits             swish_Limits;
 typedef struct swish_ConfigValue        swish_ConfigValue;
 typedef struct swish_DocInfo            swish_DocInfo;
 typedef struct swish_MetaStackElement   swish_MetaStackElement;
@@ -259,11 +358,37 @@ typedef struct swish_TagStack           swish_TagStack;
 typedef struct swish_Analyzer           swish_Analyzer;
 typedef struct swish_Parser             swish_Parser;
 typedef struct swish_NamedBuffer        swish_NamedBuffer;
+typedef struct swish_Arena              swish_Arena;
+typedef struct swish_ArenaMark          swish_ArenaMark;
+typedef struct swish_Allocator          swish_Allocator;
+typedef struct swish_MemStats           swish_MemStats;
+typedef struct swish_PerfStats          swish_PerfStats;
+typedef struct swish_ErrorFrame         swish_ErrorFrame;
+typedef struct swish_XIncludeFragment   swish_XIncludeFragment;
+typedef struct swish_XIncludeCache      swish_XIncludeCache;
+typedef struct swish_XIncludeDep        swish_XIncludeDep;
+typedef struct swish_QueryResult        swish_QueryResult;
+typedef struct swish_QueryCache         swish_QueryCache;
+typedef struct swish_DedupEntry         swish_DedupEntry;
+typedef struct swish_DedupTable         swish_DedupTable;
+typedef struct swish_ManifestEntry      swish_ManifestEntry;
+typedef struct swish_Manifest           swish_Manifest;
 
 /*
 =head2 Data Structures
 */
 
+/* one document, or the sum over many */
+struct swish_PerfStats
+{
+    double          time[SWISH_PERF_NPHASES];   // seconds, exclusive per phase
+    unsigned long   bytes_in;
+    unsigned long   tokens_out;
+    unsigned long   ndocs;
+    unsigned long   time_hist[SWISH_PERF_HIST_SIZE];    // docs by log2(microseconds)
+    unsigned long   size_hist[SWISH_PERF_HIST_SIZE];    // docs by log2(bytes)
+};
+
 struct swish_3
 {
     int             ref_cnt;
@@ -271,6 +396,14 @@ struct swish_3
     swish_Config   *config;
     swish_Analyzer *analyzer;
     swish_Parser   *parser;
+    swish_PerfStats perf;           // totals over every document parsed
+    swish_XIncludeCache *xinclude_cache; // created on first XInclude
+    swish_DedupTable *dedup;        // content hashes seen; NULL is off
+    swish_Manifest *manifest;       // files seen last run; NULL is off
+    int             shard;          // parse only files whose path hashes to this
+    int             nshards;        // ... modulo nshards; 0 or 1 is every file
+    swish_Arena    *arena;          // emptied document arena for the next parse
+    swish_Arena    *scratch;        // per-tag strings, marked and released
 };
 
 struct swish_StringList
@@ -293,15 +426,25 @@ struct swish_Config
     xmlHashTablePtr              mimes;
     xmlHashTablePtr              index;
     xmlHashTablePtr              stringlists;
+    xmlHashTablePtr              limits;     /* MIME type, parser or "default" => swish_Limits */
     struct swish_ConfigFlags    *flags;      /* shortcuts for parsing */
 };
 
+/* per-document budgets. 0 means no limit. */
+struct swish_Limits
+{
+    off_t           max_bytes;      /* read no more of the body than this */
+    unsigned int    max_tokens;     /* stop once the TokenList holds this many */
+    double          max_seconds;    /* stop once parsing has taken this long */
+};
+
 struct swish_ConfigFlags
 {
     boolean         tokenize;
     boolean         cascade_meta_context;
     boolean         ignore_xmlns;
     boolean         follow_xinclude;
+    boolean         skip_binary;
     int             undef_metas;
     int             undef_attrs;
     int             max_meta_id;
@@ -315,7 +458,8 @@ struct swish_NamedBuffer
 {
     int             ref_cnt;    /* for bindings */
     void           *stash;      /* for bindings */
-    xmlHashTablePtr hash;       /* the meat */
+    xmlHashTablePtr hash;       /* the meat: name => xmlBuffer, created on first write */
+    xmlHashTablePtr conf;       /* names allowed without autovivify (config hash) */
 };
 
 struct swish_DocInfo
@@ -330,6 +474,9 @@ struct swish_DocInfo
     xmlChar *           parser;
     xmlChar *           action;
     boolean             is_gzipped;
+    xmlChar *           duplicate_of;   // uri of an earlier doc with the same bytes
+    boolean             truncated;      // a swish_Limits budget stopped the parse early
+    const char *        binary;         // why the body was skipped as binary, or NULL
     int                 ref_cnt;
 };
 
@@ -375,6 +522,9 @@ struct swish_TokenList
     xmlHashTablePtr     contexts;       // cache contexts
     xmlBufferPtr        buf;
     swish_Token**       tokens;
+    unsigned int        max_tokens;     // add_token ignores tokens past this; 0 is no limit
+    double              deadline;       // swish_time_monotonic() to stop at; 0 is none
+    boolean             truncated;      // out of max_tokens or past deadline; tokenizers stop
     int                 ref_cnt;
 };
 
@@ -393,14 +543,51 @@ struct swish_Tag
     xmlChar            *context;
     struct swish_Tag   *next;
     unsigned int        n;
+    xmlChar            *buf;            // raw, baked and context live here
+    int                 buf_size;
 };
 
 struct swish_TagStack
 {
     swish_Tag         *head;
     swish_Tag         *temp;
+    swish_Tag         *free;       // popped tags, reused by the next push
     unsigned int       count;
     char              *name;       // debugging aid -- name of the stack
+    swish_Arena       *arena;      // where tags are allocated
+};
+
+struct swish_Allocator
+{
+    void *  (*malloc_fn)(void *ctx, size_t size);
+    void *  (*realloc_fn)(void *ctx, void *ptr, size_t size);
+    void    (*free_fn)(void *ctx, void *ptr);
+    void     *ctx;                  // passed through to each function
+};
+
+struct swish_MemStats
+{
+    long int    calls;              // malloc + realloc calls
+    long int    frees;
+    long int    bytes;              // total bytes requested
+};
+
+struct swish_Arena
+{
+    int                      ref_cnt;    // ++ to keep it past free_parser_data
+    size_t                   block_size;
+    size_t                   nbytes;     // total bytes handed out
+    int                      nblocks;
+    struct swish_ArenaBlock *head;
+};
+
+struct swish_ArenaMark
+{
+    struct swish_ArenaBlock *block;      // arena->head when marked
+    struct swish_ArenaBlock *next;       // and what followed it
+    size_t                   used;
+    size_t                   nbytes;
+    int                      nblocks;
 };
 
 struct swish_Analyzer
@@ -422,6 +609,138 @@ struct swish_Parser
     void                 (*handler)(swish_ParserData*); // handler reference
     void                  *stash;               // for script bindings
     int                    verbosity;           
+    boolean                recover;             // croak fails the doc, not the process
+    int                    error;               // SWISH_ERR_* for the last failed doc
+    xmlChar               *error_msg;           // and its croak message
+    unsigned long          nfailed;             // docs failed since init
+};
+
+/* 
+ * a file XIncluded, directly or not, into a fragment, as it was
+ * when the fragment was parsed. size -1 means it was not there.
+ */
+struct swish_XIncludeDep
+{
+    xmlChar                *uri;
+    time_t                  mtime;
+    off_t                   size;
+};
+
+/* 
+ * a parsed XInclude target, ready to be merged into any document that
+ * includes it. valid while the file's mtime and size are unchanged,
+ * and those of every file it XIncludes in turn.
+ */
+struct swish_XIncludeFragment
+{
+    xmlChar                *uri;                // resolved path; also the hash key
+    time_t                  mtime;
+    off_t                   size;
+    boolean                 is_text;            // parse="text"
+    swish_XIncludeDep      *deps;               // nested XIncludes it was built from
+    unsigned int            ndeps;
+    unsigned int            nwords;
+    swish_TokenList        *tl;
+    swish_NamedBuffer      *properties;
+    swish_NamedBuffer      *metanames;
+    size_t                  bytes;              // what this costs the cache
+    swish_XIncludeFragment *prev;               // LRU list, newest first
+    swish_XIncludeFragment *next;
+};
+
+struct swish_XIncludeCache
+{
+    xmlHashTablePtr         hash;               // uri => fragment
+    swish_XIncludeFragment *head;
+    swish_XIncludeFragment *tail;
+    size_t                  bytes;
+    size_t                  max_bytes;
+    unsigned long           hits;
+    unsigned long           misses;
+};
+
+/*
+ * a cached search result: the docids it matched and its rendered output,
+ * valid while the cache's stamp is unchanged
+ */
+struct swish_QueryResult
+{
+    xmlChar                *key;                // swish_query_cache_key()
+    xmlChar                *output;             // NUL terminated, but may hold NULs
+    size_t                  len;
+    unsigned int           *docids;
+    unsigned int            ndocids;
+    size_t                  bytes;              // what this costs the cache
+    swish_QueryResult      *prev;               // LRU list, newest first
+    swish_QueryResult      *next;
+};
+
+struct swish_QueryCache
+{
+    xmlHashTablePtr         hash;               // key => result
+    swish_QueryResult      *head;
+    swish_QueryResult      *tail;
+    xmlChar                *stamp;              // index revision the results are from
+    unsigned long           n;
+    unsigned long           max_entries;
+    size_t                  bytes;
+    size_t                  max_bytes;
+    unsigned long           hits;
+    unsigned long           misses;
+};
+
+/*
+ * content hashes of documents already parsed. a fixed number of slots,
+ * so a full table forgets old documents rather than growing.
+ */
+struct swish_DedupEntry
+{
+    uint64_t                hash;
+    off_t                   size;
+    xmlChar                *uri;                // NULL if the slot is empty
+};
+
+struct swish_DedupTable
+{
+    swish_DedupEntry       *slots;
+    unsigned long           nslots;             // power of 2
+    unsigned long           n;
+    unsigned long           hits;
+    unsigned long           misses;
+};
+
+/*
+ * what swish_parse_file() saw of each file last time. a file whose
+ * size, mtime and inode all match is skipped without being opened;
+ * one whose content hash matches is read but not parsed.
+ */
+struct swish_ManifestEntry
+{
+    xmlChar                *path;
+    off_t                   size;
+    time_t                  mtime;
+    uint64_t                inode;
+    uint64_t                hash;               // swish_hash64() of the body
+    boolean                 seen;               // touched this run
+};
+
+struct swish_Manifest
+{
+    xmlHashTablePtr         entries;            // path => swish_ManifestEntry
+    swish_StringList       *roots;              // crawled this run; only these can lose files
+    unsigned long           unchanged;          // skipped this run
+    unsigned long           changed;            // parsed this run
+};
+
+/* 
+ * swish_croak() longjmps to the innermost pushed frame instead of exit()ing.
+ * the frame is popped before the jump, so the catcher sees the outer one.
+ */
+struct swish_ErrorFrame
+{
+    jmp_buf                env;
+    char                   msg[SWISH_MAXSTRLEN];
+    swish_ErrorFrame      *prev;
 };
 
 struct swish_ParserData
@@ -442,6 +761,26 @@ struct swish_ParserData
     swish_TokenIterator   *token_iterator;     // token container
     swish_NamedBuffer     *properties;         // buffer all properties
     swish_NamedBuffer     *metanames;          // buffer all metanames
+    swish_Arena           *arena;              // document-lifetime allocations
+    swish_PerfStats        perf;               // this document's counters
+    swish_PerfPhase        phase;              // phase being timed
+    double                 phase_start;        // when phase began
+    xmlChar               *body;               // slurped body, if docparser owns it
+    off_t                  body_len;           // its length, for munmap
+    boolean                body_mapped;        // body came from swish_io_mmap_file
+    void                  *oldsax;             // ctxt->sax to put back before freeing ctxt
+    swish_ParserData      *child;              // XInclude doc being parsed, if any
+    int                    error;              // SWISH_ERR_DOC_FAILED if parsing croaked
+    boolean                is_xinclude;        // parsed for process_xinclude()
+    swish_XIncludeDep     *xinclude_deps;      // files XIncluded so far, if is_xinclude
+    unsigned int           nxinclude_deps;
+    int                    nmetanames;         // config->metanames size when last scanned
+    boolean                attr_metanames;     // any tag.attr MetaNames at that scan
+    boolean                want_hash;          // set content_hash (swish_parse_file with a manifest)
+    uint64_t               content_hash;       // swish_hash64() of the body (manifest or dedup)
+    boolean                unchanged;          // content_hash matched the manifest; handler skipped
+    swish_Limits          *limits;             // budgets for this doc's MIME/parser, if any
+    double                 deadline;           // swish_time_monotonic() to stop at; 0 is none
 };
 
 /*
@@ -466,6 +805,7 @@ swish_3 *       swish_3_init( void (*handler) (swish_ParserData *), void *stash
 void            swish_3_free( swish_3 *s3 );
 int             swish_parse_file( swish_3 * s3, xmlChar *filename );
 unsigned int    swish_parse_fh( swish_3 * s3, FILE * fh );
+unsigned int    swish_parse_fh_framed( swish_3 * s3, FILE * fh );
 int             swish_parse_buffer( swish_3 * s3, xmlChar * buf );
 unsigned int    swish_parse_directory( swish_3 *s3, xmlChar *dir, boolean follow_symlinks );
 /*
@@ -478,9 +818,13 @@ unsigned int    swish_parse_directory( swish_3 *s3, xmlChar *dir, boolean follow
 xmlChar *   swish_io_slurp_fh( FILE * fh, unsigned long flen, boolean binmode );
 xmlChar *   swish_io_slurp_file_len( xmlChar *filename, off_t flen, boolean binmode );
 xmlChar *   swish_io_slurp_gzfile_len( xmlChar *filename, off_t *flen, boolean binmode );
+xmlChar *   swish_io_mmap_file( xmlChar *filename, off_t flen, boolean binmode );
+void        swish_io_munmap( xmlChar *buffer, off_t flen );
 xmlChar *   swish_io_slurp_file( xmlChar *filename, off_t flen, boolean is_gzipped, boolean binmode );
 long int    swish_io_count_operable_file_lines( xmlChar *filename );
 boolean     swish_io_is_skippable_line( xmlChar *str );
+void        swish_io_write_uint( FILE *fh, uint64_t n, int nbytes );
+boolean     swish_io_read_uint( FILE *fh, uint64_t *n, int nbytes );
 /*
 =cut
 */
@@ -515,6 +859,73 @@ void *      swish_hash_fetch( xmlHashTablePtr hash, xmlChar *key );
 void        swish_hash_dump( xmlHashTablePtr hash, const char *label );
 xmlHashTablePtr swish_hash_init(int size);
 void        swish_hash_free( xmlHashTablePtr hash );
+uint64_t    swish_hash64( const void *buf, size_t len, uint64_t seed );
+/*
+=cut
+*/
+
+/*
+=head2 Duplicate Detection Functions
+*/
+swish_DedupTable * swish_dedup_init( unsigned long max_entries );
+void        swish_dedup_free( swish_DedupTable *table );
+const xmlChar * swish_dedup_check( swish_DedupTable *table, uint64_t hash, size_t len, const xmlChar *uri );
+long        swish_dedup_load( swish_DedupTable *table, const char *filename );
+long        swish_dedup_save( swish_DedupTable *table, const char *filename );
+/*
+=cut
+*/
+
+/*
+=head2 Manifest Functions
+*/
+swish_Manifest * swish_manifest_init();
+void        swish_manifest_free( swish_Manifest *manifest );
+boolean     swish_manifest_unchanged( swish_Manifest *manifest, const xmlChar *path, struct stat *st );
+boolean     swish_manifest_same_content( swish_Manifest *manifest, const xmlChar *path, uint64_t hash );
+void        swish_manifest_update( swish_Manifest *manifest, const xmlChar *path, struct stat *st, uint64_t hash );
+void        swish_manifest_keep( swish_Manifest *manifest, const xmlChar *path );
+void        swish_manifest_add_root( swish_Manifest *manifest, const xmlChar *path );
+long        swish_manifest_deleted( swish_Manifest *manifest, void (*deleted)(const xmlChar *path, void *data), void *data );
+long        swish_manifest_load( swish_Manifest *manifest, const char *filename );
+long        swish_manifest_save( swish_Manifest *manifest, const char *filename );
+/*
+=cut
+*/
+
+/*
+=head2 XInclude Cache Functions
+*/
+swish_XIncludeCache *    swish_xinclude_cache_init( size_t max_bytes );
+void                     swish_xinclude_cache_free( swish_XIncludeCache *cache );
+swish_XIncludeFragment * swish_xinclude_cache_fetch( swish_XIncludeCache *cache, xmlChar *uri, time_t mtime, off_t size, boolean is_text );
+void                     swish_xinclude_cache_store( swish_XIncludeCache *cache, xmlChar *uri, time_t mtime, off_t size, boolean is_text, swish_ParserData *parser_data );
+void                     swish_xinclude_cache_merge( swish_XIncludeFragment *frag, swish_ParserData *parser_data );
+void                     swish_xinclude_deps_add( swish_ParserData *parser_data, xmlChar *uri, time_t mtime, off_t size );
+void                     swish_xinclude_deps_free( swish_XIncludeDep *deps, unsigned int ndeps );
+/*
+=cut
+*/
+
+/*
+=head2 Query Cache Functions
+*/
+swish_QueryCache *  swish_query_cache_init( unsigned long max_entries, size_t max_bytes );
+void                swish_query_cache_free( swish_QueryCache *cache );
+void                swish_query_cache_validate( swish_QueryCache *cache, const xmlChar *stamp );
+xmlChar *           swish_query_cache_key( const xmlChar *query, const xmlChar *sort, unsigned int offset, unsigned int limit, swish_StringList *facets, const xmlChar *extra );
+swish_QueryResult * swish_query_cache_fetch( swish_QueryCache *cache, const xmlChar *key );
+void                swish_query_cache_store( swish_QueryCache *cache, const xmlChar *key, const xmlChar *output, size_t len, const unsigned int *docids, unsigned int ndocids );
+/*
+=cut
+*/
+
+/*
+=head2 Trace Functions
+*/
+void        swish_trace_event( swish_TraceType type, const char *name, long value );
+void        swish_trace_reset();
+long        swish_trace_dump( FILE *fh );
 /*
 =cut
 */
@@ -523,6 +934,11 @@ void        swish_hash_free( xmlHashTablePtr hash );
 =head2 Memory Functions
 */
 void        swish_mem_init();
+void        swish_set_allocator( const swish_Allocator *allocator );
+swish_MemSubsystem swish_mem_enter( swish_MemSubsystem subsystem );
+void        swish_mem_leave( swish_MemSubsystem prev );
+void        swish_mem_stats( swish_MemStats *stats );
+const char * swish_mem_subsystem_name( swish_MemSubsystem subsystem );
 void *      swish_xrealloc(void *ptr, size_t size);
 void *      swish_xmalloc( size_t size );
 void        swish_xfree( void *ptr );
@@ -531,6 +947,14 @@ long int    swish_memcount_get();
 void        swish_memcount_dec();
 xmlChar *   swish_xstrdup( const xmlChar * ptr );
 xmlChar *   swish_xstrndup( const xmlChar * ptr, int len );
+swish_Arena * swish_arena_init( size_t block_size );
+void *      swish_arena_alloc( swish_Arena *arena, size_t size );
+xmlChar *   swish_arena_strdup( swish_Arena *arena, const xmlChar *str );
+xmlChar *   swish_arena_strndup( swish_Arena *arena, const xmlChar *str, int len );
+void        swish_arena_mark( swish_Arena *arena, swish_ArenaMark *mark );
+void        swish_arena_release( swish_Arena *arena, swish_ArenaMark *mark );
+void        swish_arena_reset( swish_Arena *arena );
+void        swish_arena_free( swish_Arena *arena );
 /*
 =cut
 */
@@ -543,6 +967,10 @@ double      swish_time_cpu(void);
 char *      swish_time_print(double time);
 char *      swish_time_print_fine(double time);
 char *      swish_time_format(time_t epoch);
+double      swish_time_monotonic(void);
+const char * swish_perf_phase_name( swish_PerfPhase phase );
+void        swish_perf_add( swish_PerfStats *total, swish_PerfStats *stats );
+void        swish_perf_reset( swish_PerfStats *stats );
 /*
 =cut
 */
@@ -555,6 +983,8 @@ void        swish_croak(const char *file, int line, const char *func, const char
 void        swish_warn(const char *file, int line, const char *func, const char *msg,...);
 void        swish_debug(const char *file, int line, const char *func, const char *msg,...);
 const char* swish_err_msg(int err_code);
+void        swish_error_push( swish_ErrorFrame *frame );
+void        swish_error_pop( swish_ErrorFrame *frame );
 /*
 =cut
 */
@@ -617,9 +1047,11 @@ swish_Config *      swish_config_add( swish_Config * config, xmlChar * conf );
 swish_Config *      swish_config_parse( swish_Config * config, xmlChar * conf );
 void                swish_config_debug( swish_Config * config );
 void                swish_config_free( swish_Config * config);
+swish_Limits *      swish_config_get_limits( swish_Config *config, xmlChar *mime, xmlChar *parser );
 xmlHashTablePtr     swish_mime_defaults();
 xmlChar *           swish_mime_get_type( swish_Config * config, xmlChar * fileext );
 xmlChar *           swish_mime_get_parser( swish_Config * config, xmlChar *mime );
+const char *        swish_mime_sniff_binary( const xmlChar *buf, int len );
 void                swish_config_test_alias_fors( swish_Config *c );
 swish_ConfigFlags * swish_config_flags_init();
 void                swish_config_flags_debug( swish_ConfigFlags *flags );
@@ -655,6 +1087,9 @@ int                 swish_token_list_set_token(
                                         swish_TokenList *tl,
                                         xmlChar *token,
                                         int len );
+int                 swish_token_list_merge(
+                                        swish_TokenList *tl,
+                                        swish_TokenList *from );
 swish_Token *       swish_token_init();
 void                swish_token_free( swish_Token *t );
 swish_TokenIterator *swish_token_iterator_init( swish_Analyzer *a );
@@ -741,6 +1176,7 @@ void                swish_property_free( swish_Property *prop );
 void                swish_property_debug( swish_Property *prop );
 int                 swish_property_get_builtin_id( xmlChar *propname );
 int                 swish_property_get_id( xmlChar *propname, xmlHashTablePtr properties );
+xmlChar *           swish_property_sort_key( swish_Property *prop, const xmlChar *value, int *len );
 /*
 =cut
 */
@@ -763,6 +1199,8 @@ boolean             swish_header_validate(char *filename);
 boolean             swish_header_merge(char *filename, swish_Config *c);
 swish_Config *      swish_header_read(char *filename);
 void                swish_header_write(char* filename, swish_Config* config);
+swish_Config *      swish_config_cache_load(const char *filename);
+void                swish_config_cache_save(swish_Config *config, const char *filename, swish_StringList *deps);
 /*
 =cut
 */
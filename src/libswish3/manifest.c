@@ -0,0 +1,411 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* manifest.c -- remember what was indexed, to re-index only what changed
+ *
+ * One entry per file: size, mtime, inode and a hash of the body. With a
+ * manifest on swish_3, swish_parse_file() skips a file whose stat() still
+ * matches, and skips the handler for one whose body hashes the same.
+ * Entries not touched during a run, under one of the roots that run
+ * crawled, are the files that have gone away; swish_manifest_deleted()
+ * reports and drops them.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "libswish3.h"
+#endif
+
+extern int SWISH_DEBUG;
+
+typedef struct
+{
+    void (*deleted)(const xmlChar *path, void *data);
+    void *data;
+    swish_StringList *roots;
+    swish_StringList *paths;
+} deleted_scan;
+
+static void
+free_entry(
+    swish_ManifestEntry *entry,
+    xmlChar *path ATTRIBUTE_UNUSED
+)
+{
+    swish_xfree(entry->path);
+    swish_xfree(entry);
+}
+
+swish_Manifest *
+swish_manifest_init(
+)
+{
+    swish_Manifest *manifest;
+
+    manifest = swish_xmalloc(sizeof(swish_Manifest));
+    manifest->entries = xmlHashCreate(1024);
+    manifest->roots = swish_stringlist_init();
+    manifest->unchanged = 0;
+    manifest->changed = 0;
+    return manifest;
+}
+
+void
+swish_manifest_free(
+    swish_Manifest *manifest
+)
+{
+    xmlHashFree(manifest->entries, (xmlHashDeallocator)free_entry);
+    swish_stringlist_free(manifest->roots);
+    swish_xfree(manifest);
+}
+
+/*
+* SWISH_TRUE if path has the same size, mtime and inode as last time.
+* the entry is then marked seen, so it is neither re-parsed nor deleted.
+*/
+boolean
+swish_manifest_unchanged(
+    swish_Manifest *manifest,
+    const xmlChar *path,
+    struct stat *st
+)
+{
+    swish_ManifestEntry *entry;
+
+    entry = xmlHashLookup(manifest->entries, path);
+    if (entry == NULL
+        || entry->size != st->st_size
+        || entry->mtime != st->st_mtime
+        || entry->inode != (uint64_t)st->st_ino) {
+        return SWISH_FALSE;
+    }
+
+    entry->seen = SWISH_TRUE;
+    manifest->unchanged++;
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+        SWISH_DEBUG_MSG("%s unchanged since last run", path);
+    return SWISH_TRUE;
+}
+
+/* SWISH_TRUE if path's body hashed to hash last time (touched, not edited) */
+boolean
+swish_manifest_same_content(
+    swish_Manifest *manifest,
+    const xmlChar *path,
+    uint64_t hash
+)
+{
+    swish_ManifestEntry *entry;
+
+    entry = xmlHashLookup(manifest->entries, path);
+    return entry != NULL && entry->hash == hash;
+}
+
+/* record path as seen this run, with its current stat() and body hash */
+void
+swish_manifest_update(
+    swish_Manifest *manifest,
+    const xmlChar *path,
+    struct stat *st,
+    uint64_t hash
+)
+{
+    swish_ManifestEntry *entry;
+
+    entry = xmlHashLookup(manifest->entries, path);
+    if (entry == NULL) {
+        entry = swish_xmalloc(sizeof(swish_ManifestEntry));
+        entry->path = swish_xstrdup(path);
+        if (xmlHashAddEntry(manifest->entries, entry->path, entry) != 0) {
+            SWISH_CROAK("failed to add %s to manifest", path);
+        }
+    }
+
+    entry->size = st->st_size;
+    entry->mtime = st->st_mtime;
+    entry->inode = (uint64_t)st->st_ino;
+    entry->hash = hash;
+    entry->seen = SWISH_TRUE;
+}
+
+/*
+* path was not parsed this run, but still exists (it failed, say), so its
+* entry is kept as it was and tried again next time.
+*/
+void
+swish_manifest_keep(
+    swish_Manifest *manifest,
+    const xmlChar *path
+)
+{
+    swish_ManifestEntry *entry;
+
+    entry = xmlHashLookup(manifest->entries, path);
+    if (entry != NULL)
+        entry->seen = SWISH_TRUE;
+}
+
+/*
+* path, a file or a directory, is crawled in full this run, so a file
+* under it that was not seen is gone. entries under no root are left alone.
+*/
+void
+swish_manifest_add_root(
+    swish_Manifest *manifest,
+    const xmlChar *path
+)
+{
+    xmlChar *root;
+    int len;
+
+/* the directory crawl joins with a separator even after a trailing one */
+    root = swish_xstrdup(path);
+    len = xmlStrlen(root);
+    while (len > 0 && root[len - 1] == SWISH_PATH_SEP)
+        root[--len] = '\0';
+    swish_stringlist_add_string(manifest->roots, root);
+}
+
+static boolean
+under_root(
+    swish_StringList *roots,
+    const xmlChar *path
+)
+{
+    unsigned int i;
+    int len;
+
+    for (i = 0; i < roots->n; i++) {
+        len = xmlStrlen(roots->word[i]);
+        if (!xmlStrncmp(path, roots->word[i], len)
+            && (path[len] == '\0' || path[len] == SWISH_PATH_SEP))
+            return SWISH_TRUE;
+    }
+    return SWISH_FALSE;
+}
+
+static void
+find_deleted(
+    swish_ManifestEntry *entry,
+    deleted_scan *scan,
+    xmlChar *path ATTRIBUTE_UNUSED
+)
+{
+    if (entry->seen || !under_root(scan->roots, entry->path))
+        return;
+
+    if (scan->deleted != NULL)
+        scan->deleted(entry->path, scan->data);
+    swish_stringlist_add_string(scan->paths, swish_xstrdup(entry->path));
+}
+
+/*
+* call deleted(path, data) for each entry under a root given to
+* swish_manifest_add_root() that was not seen since the manifest was
+* loaded, and drop those entries. returns how many there were. with no
+* roots, nothing is deleted.
+*/
+long
+swish_manifest_deleted(
+    swish_Manifest *manifest,
+    void (*deleted)(const xmlChar *path, void *data),
+    void *data
+)
+{
+    deleted_scan scan;
+    unsigned int i;
+    long n;
+
+    scan.deleted = deleted;
+    scan.data = data;
+    scan.roots = manifest->roots;
+    scan.paths = swish_stringlist_init();
+    xmlHashScan(manifest->entries, (xmlHashScanner)find_deleted, &scan);
+
+/* can't remove entries while scanning */
+    for (i = 0; i < scan.paths->n; i++) {
+        xmlHashRemoveEntry(manifest->entries, scan.paths->word[i],
+                           (xmlHashDeallocator)free_entry);
+    }
+    n = scan.paths->n;
+    swish_stringlist_free(scan.paths);
+    return n;
+}
+
+/*
+* add the entries saved in filename to manifest, none of them seen yet.
+* a missing file is not an error (the first run has nothing to load).
+* returns the number of entries read.
+*
+* file layout, integers big-endian:
+*   magic[4] count[8] then count *
+*   ( size[8] mtime[8] inode[8] hash[8] pathlen[2] path[pathlen] )
+*/
+long
+swish_manifest_load(
+    swish_Manifest *manifest,
+    const char *filename
+)
+{
+    FILE *fh;
+    char magic[4];
+    uint64_t count = 0, size = 0, mtime = 0, inode = 0, hash = 0, pathlen = 0;
+    swish_ManifestEntry *entry;
+    xmlChar *path;
+    long i;
+
+    fh = fopen(filename, "rb");
+    if (fh == NULL) {
+        if (errno == ENOENT)
+            return 0;
+        SWISH_CROAK("failed to open manifest %s: %s", filename, strerror(errno));
+    }
+
+    /* close and free before croaking: a caller may catch the croak */
+    if (fread(magic, 1, 4, fh) != 4 || memcmp(magic, SWISH_MANIFEST_MAGIC, 4)
+        || !swish_io_read_uint(fh, &count, 8)) {
+        fclose(fh);
+        SWISH_CROAK("%s is not a manifest file", filename);
+    }
+
+    for (i = 0; i < (long)count; i++) {
+        if (!swish_io_read_uint(fh, &size, 8) || !swish_io_read_uint(fh, &mtime, 8)
+            || !swish_io_read_uint(fh, &inode, 8) || !swish_io_read_uint(fh, &hash, 8)
+            || !swish_io_read_uint(fh, &pathlen, 2)) {
+            fclose(fh);
+            SWISH_CROAK("manifest %s is truncated at entry %ld", filename, i);
+        }
+        path = swish_xmalloc(pathlen + 1);
+        if (fread(path, 1, pathlen, fh) != pathlen) {
+            swish_xfree(path);
+            fclose(fh);
+            SWISH_CROAK("manifest %s is truncated at entry %ld", filename, i);
+        }
+        path[pathlen] = '\0';
+
+        if ((entry = xmlHashLookup(manifest->entries, path)) == NULL) {
+            entry = swish_xmalloc(sizeof(swish_ManifestEntry));
+            entry->path = path;
+            if (xmlHashAddEntry(manifest->entries, entry->path, entry) != 0) {
+                swish_xfree(entry);
+                swish_xfree(path);
+                fclose(fh);
+                SWISH_CROAK("failed to add entry %ld to manifest %s", i, filename);
+            }
+        }
+        else {
+            swish_xfree(path);
+        }
+        entry->size = (off_t)size;
+        entry->mtime = (time_t)mtime;
+        entry->inode = inode;
+        entry->hash = hash;
+        entry->seen = SWISH_FALSE;
+    }
+
+    if (fclose(fh)) {
+        SWISH_CROAK("error closing manifest %s", filename);
+    }
+    return i;
+}
+
+static void
+count_entry(
+    swish_ManifestEntry *entry,
+    uint64_t *n,
+    xmlChar *path ATTRIBUTE_UNUSED
+)
+{
+    if (xmlStrlen(entry->path) <= 0xffff)
+        (*n)++;
+}
+
+static void
+write_entry(
+    swish_ManifestEntry *entry,
+    FILE *fh,
+    xmlChar *path ATTRIBUTE_UNUSED
+)
+{
+    int pathlen;
+
+/* can't be loaded back under its own name, so leave it out */
+    if ((pathlen = xmlStrlen(entry->path)) > 0xffff)
+        return;
+
+    swish_io_write_uint(fh, (uint64_t)entry->size, 8);
+    swish_io_write_uint(fh, (uint64_t)entry->mtime, 8);
+    swish_io_write_uint(fh, entry->inode, 8);
+    swish_io_write_uint(fh, entry->hash, 8);
+    swish_io_write_uint(fh, (uint64_t)pathlen, 2);
+    fwrite(entry->path, 1, pathlen, fh);
+}
+
+/*
+* write every entry to filename, via a temporary file renamed into place
+* so an interrupted run leaves the previous manifest intact. returns the
+* number of entries written.
+*/
+long
+swish_manifest_save(
+    swish_Manifest *manifest,
+    const char *filename
+)
+{
+    FILE *fh;
+    char *tmp;
+    size_t tmp_len;
+    uint64_t n;
+    int err;
+
+    tmp_len = strlen(filename) + 5;
+    tmp = swish_xmalloc(tmp_len);
+    snprintf(tmp, tmp_len, "%s.tmp", filename);
+
+    fh = fopen(tmp, "wb");
+    if (fh == NULL) {
+        err = errno;
+        swish_xfree(tmp);
+        SWISH_CROAK("failed to open %s.tmp: %s", filename, strerror(err));
+    }
+
+    n = 0;
+    xmlHashScan(manifest->entries, (xmlHashScanner)count_entry, &n);
+    fwrite(SWISH_MANIFEST_MAGIC, 1, 4, fh);
+    swish_io_write_uint(fh, n, 8);
+    xmlHashScan(manifest->entries, (xmlHashScanner)write_entry, fh);
+
+    err = ferror(fh);
+    if (fclose(fh) || err) {
+        swish_xfree(tmp);
+        SWISH_CROAK("error writing %s.tmp", filename);
+    }
+    if (rename(tmp, filename)) {
+        err = errno;
+        swish_xfree(tmp);
+        SWISH_CROAK("failed to rename %s.tmp to %s: %s", filename, filename, strerror(err));
+    }
+    swish_xfree(tmp);
+    return (long)n;
+}
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <libxml/xmlstring.h>
+#include <libxml/xmlmemory.h>
 #include <err.h>
 
 #include "libswish3.h"
@@ -32,27 +33,275 @@
 
 extern int SWISH_DEBUG;
 
-static long int memcount = 0;
+static void *default_malloc(void *ctx, size_t size);
+static void *default_realloc(void *ctx, void *ptr, size_t size);
+static void  default_free(void *ctx, void *ptr);
+
+static swish_Allocator allocator = {
+    default_malloc, default_realloc, default_free, NULL
+};
+
+/* libxml2's handlers from before swish_set_allocator() replaced them */
+static int xml_hooked = 0;
+static xmlFreeFunc xml_prev_free;
+static xmlMallocFunc xml_prev_malloc;
+static xmlReallocFunc xml_prev_realloc;
+static xmlStrdupFunc xml_prev_strdup;
+
+/* 
+ * counters live in per-thread blocks so the hot path never locks.
+ * blocks are chained on a global list when a thread first allocates,
+ * and swish_mem_stats() sums them. a block outlives its thread so
+ * the totals stay correct.
+ */
+typedef struct mem_counters mem_counters;
+struct mem_counters
+{
+    swish_MemStats   stats[SWISH_MEM_NSUBSYSTEMS];
+    long int         memcount;      // swish_x* allocs minus frees
+    mem_counters    *next;
+};
+
+static mem_counters *all_counters = NULL;
+static SWISH_THREAD_LOCAL mem_counters *my_counters = NULL;
+static SWISH_THREAD_LOCAL swish_MemSubsystem my_subsystem = SWISH_MEM_OTHER;
+
+static const char *subsystem_names[SWISH_MEM_NSUBSYSTEMS] = {
+    "other", "tokenizer", "parser", "namedbuffer", "config", "io"
+};
+
+static void *
+default_malloc(
+    void *ctx ATTRIBUTE_UNUSED,
+    size_t size
+)
+{
+    return malloc(size);
+}
+
+static void *
+default_realloc(
+    void *ctx ATTRIBUTE_UNUSED,
+    void *ptr,
+    size_t size
+)
+{
+    return realloc(ptr, size);
+}
+
+static void
+default_free(
+    void *ctx ATTRIBUTE_UNUSED,
+    void *ptr
+)
+{
+    free(ptr);
+}
+
+static mem_counters *
+get_counters(
+)
+{
+    mem_counters *c;
+
+    if (my_counters != NULL)
+        return my_counters;
+
+/* bookkeeping, so use libc directly and do not count it */
+    c = calloc(1, sizeof(mem_counters));
+    if (c == NULL)
+        SWISH_CROAK("Out of memory! Can't calloc memory counters");
+
+    do {
+        c->next = all_counters;
+    } while (!__sync_bool_compare_and_swap(&all_counters, c->next, c));
+
+    my_counters = c;
+    return c;
+}
+
+static void
+count_alloc(
+    size_t size
+)
+{
+    swish_MemStats *stats = &get_counters()->stats[my_subsystem];
+    stats->calls++;
+    stats->bytes += size;
+}
+
+static void
+count_free(
+)
+{
+    get_counters()->stats[my_subsystem].frees++;
+}
+
+/* 
+ * once swish_set_allocator() is called, libxml2 allocates through these
+ * too, so xmlBuffers, xmlHash tables and parser contexts are charged to
+ * whatever subsystem is current.
+ * they do not touch memcount, which only tracks swish_x* calls.
+ */
+static void *
+xml_malloc(
+    size_t size
+)
+{
+    count_alloc(size);
+    return allocator.malloc_fn(allocator.ctx, size);
+}
+
+static void *
+xml_realloc(
+    void *ptr,
+    size_t size
+)
+{
+    count_alloc(size);
+    return allocator.realloc_fn(allocator.ctx, ptr, size);
+}
+
+static void
+xml_free(
+    void *ptr
+)
+{
+    if (ptr == NULL)
+        return;
+    count_free();
+    allocator.free_fn(allocator.ctx, ptr);
+}
+
+static char *
+xml_strdup(
+    const char *str
+)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = xml_malloc(len);
+    if (copy != NULL)
+        memcpy(copy, str, len);
+    return copy;
+}
 
 void
 swish_mem_init(
 )
 {
-    memcount = 0;
+    mem_counters *c;
+
+    for (c = all_counters; c != NULL; c = c->next) {
+        memset(c->stats, 0, sizeof(c->stats));
+        c->memcount = 0;
+    }
+}
+
+/* 
+ * PUBLIC
+ * replace the malloc/realloc/free used by libswish3 and libxml2.
+ * must be called before anything is allocated, i.e. before swish_setup()
+ * or swish_3_init(). libxml2's handlers are process-wide, so they are
+ * only replaced here, never by default. NULL restores the libc defaults
+ * and whatever handlers libxml2 had before; call it only once everything
+ * allocated meanwhile is freed.
+ */
+void
+swish_set_allocator(
+    const swish_Allocator *a
+)
+{
+    if (a == NULL) {
+        allocator.malloc_fn  = default_malloc;
+        allocator.realloc_fn = default_realloc;
+        allocator.free_fn    = default_free;
+        allocator.ctx        = NULL;
+        if (xml_hooked) {
+            xmlMemSetup(xml_prev_free, xml_prev_malloc, xml_prev_realloc, xml_prev_strdup);
+            xml_hooked = 0;
+        }
+        return;
+    }
+
+    if (a->malloc_fn == NULL || a->realloc_fn == NULL || a->free_fn == NULL)
+        SWISH_CROAK("swish_Allocator must define malloc_fn, realloc_fn and free_fn");
+    allocator = *a;
+
+    if (!xml_hooked) {
+        xmlMemGet(&xml_prev_free, &xml_prev_malloc, &xml_prev_realloc, &xml_prev_strdup);
+        xmlMemSetup(xml_free, xml_malloc, xml_realloc, xml_strdup);
+        xml_hooked = 1;
+    }
+}
+
+/* set the subsystem that allocations in this thread are charged to.
+ * returns the previous one, to be restored with swish_mem_leave(). */
+swish_MemSubsystem
+swish_mem_enter(
+    swish_MemSubsystem subsystem
+)
+{
+    swish_MemSubsystem prev = my_subsystem;
+    my_subsystem = subsystem;
+    return prev;
+}
+
+void
+swish_mem_leave(
+    swish_MemSubsystem prev
+)
+{
+    my_subsystem = prev;
+}
+
+/* sum the counters of every thread into stats[SWISH_MEM_NSUBSYSTEMS] */
+void
+swish_mem_stats(
+    swish_MemStats *stats
+)
+{
+    mem_counters *c;
+    int i;
+
+    memset(stats, 0, sizeof(swish_MemStats) * SWISH_MEM_NSUBSYSTEMS);
+    for (c = all_counters; c != NULL; c = c->next) {
+        for (i = 0; i < SWISH_MEM_NSUBSYSTEMS; i++) {
+            stats[i].calls += c->stats[i].calls;
+            stats[i].frees += c->stats[i].frees;
+            stats[i].bytes += c->stats[i].bytes;
+        }
+    }
+}
+
+const char *
+swish_mem_subsystem_name(
+    swish_MemSubsystem subsystem
+)
+{
+    if (subsystem < 0 || subsystem >= SWISH_MEM_NSUBSYSTEMS)
+        return NULL;
+
+    return subsystem_names[subsystem];
 }
 
 long int
 swish_memcount_get(
 )
 {
-    return memcount;
+    mem_counters *c;
+    long int total = 0;
+
+    for (c = all_counters; c != NULL; c = c->next) {
+        total += c->memcount;
+    }
+    return total;
 }
 
 void
 swish_memcount_dec(
 )
 {
-    memcount--;
+    get_counters()->memcount--;
 }
 
 /* PUBLIC */
@@ -63,12 +312,13 @@ swish_xrealloc(
     size_t size
 )
 {
-    void *new_ptr = realloc(ptr, size);
+    void *new_ptr = allocator.realloc_fn(allocator.ctx, ptr, size);
 
     if (new_ptr == NULL)
         SWISH_CROAK("Out of memory (could not reallocate %lu more bytes)!",
                     (unsigned long)size);
 
+    count_alloc(size);
     return new_ptr;
 }
 
@@ -84,15 +334,16 @@ swish_xmalloc(
         SWISH_DEBUG_MSG("malloc %ld bytes", (long)size);
     }
 
-    ptr = malloc(size);
+    ptr = allocator.malloc_fn(allocator.ctx, size);
 
     if (ptr == NULL)
         SWISH_CROAK("Out of memory! Can't malloc %lu bytes",
                     (unsigned long)size);
 
-    memcount++;
+    count_alloc(size);
+    get_counters()->memcount++;
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
-        SWISH_DEBUG_MSG("memcount = %ld", memcount);
+        SWISH_DEBUG_MSG("memcount = %ld", swish_memcount_get());
         SWISH_DEBUG_MSG("xmalloc address: 0x%lx", ptr);
     }
 
@@ -104,15 +355,10 @@ swish_xstrdup(
     const xmlChar *ptr
 )
 {
-    xmlChar *copy;
-    memcount++;
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY)
-        SWISH_DEBUG_MSG("memcount = %ld", memcount);
-    copy = xmlStrdup(ptr);
-    if (copy == NULL) 
-        SWISH_CROAK("strdup returned NULL for %s", ptr);
+    if (ptr == NULL) 
+        SWISH_CROAK("strdup called with NULL");
 
-    return copy;
+    return swish_xstrndup(ptr, xmlStrlen(ptr));
 }
 
 xmlChar *
@@ -121,10 +367,15 @@ swish_xstrndup(
     int len
 )
 {
-    memcount++;
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY)
-        SWISH_DEBUG_MSG("memcount = %ld", memcount);
-    return (xmlStrndup(ptr, len));
+    xmlChar *copy;
+
+    if (ptr == NULL || len < 0)
+        return NULL;
+
+    copy = swish_xmalloc(len + 1);
+    memcpy(copy, ptr, len);
+    copy[len] = '\0';
+    return copy;
 }
 
 void
@@ -141,19 +392,21 @@ swish_xfree(
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY)
         SWISH_DEBUG_MSG("freeing %s 0x%lx", (char*)ptr, ptr);
 
-    xmlFree(ptr);
+    allocator.free_fn(allocator.ctx, ptr);
 
-    memcount--;
+    count_free();
+    get_counters()->memcount--;
 
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY)
-        SWISH_DEBUG_MSG("memcount = %ld", memcount);
+        SWISH_DEBUG_MSG("memcount = %ld", swish_memcount_get());
 }
 
 void
 swish_mem_debug(
 )
 {
-/* SWISH_DEBUG_MSG("memcount = %ld", memcount); */
+    long int memcount = swish_memcount_get();
+
     if (memcount > 0)
         SWISH_WARN
             ("%ld more swish_xmalloc()s or swish_xstrdup()s than swish_xfree()s",
@@ -161,4 +414,218 @@ swish_mem_debug(
 
     if (memcount < 0)
         SWISH_WARN("too many swish_xfree()s %ld", memcount);
+
+    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+        swish_MemStats stats[SWISH_MEM_NSUBSYSTEMS];
+        int i;
+
+        swish_mem_stats(stats);
+        for (i = 0; i < SWISH_MEM_NSUBSYSTEMS; i++) {
+            SWISH_DEBUG_MSG("%12s: %10ld allocs %10ld frees %14ld bytes",
+                            subsystem_names[i], stats[i].calls, stats[i].frees,
+                            stats[i].bytes);
+        }
+    }
+}
+
+/* arena allocator. Allocations are carved out of large blocks and are only
+ * released all at once by swish_arena_free() or swish_arena_reset(), or back
+ * to a swish_arena_mark() by swish_arena_release(). Use for things that live
+ * exactly as long as one document, or one tag. */
+
+struct swish_ArenaBlock
+{
+    struct swish_ArenaBlock *next;
+    size_t                   size;
+    size_t                   used;
+};
+
+#define SWISH_ARENA_ALIGN(n)  (((n) + (2 * sizeof(void *)) - 1) & ~((2 * sizeof(void *)) - 1))
+#define SWISH_ARENA_DATA(b)   ((char *)(b) + SWISH_ARENA_ALIGN(sizeof(struct swish_ArenaBlock)))
+
+static struct swish_ArenaBlock *
+arena_new_block(
+    size_t size
+)
+{
+    struct swish_ArenaBlock *block;
+
+    block = swish_xmalloc(SWISH_ARENA_ALIGN(sizeof(struct swish_ArenaBlock)) + size);
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+swish_Arena *
+swish_arena_init(
+    size_t block_size
+)
+{
+    swish_Arena *arena;
+
+    if (!block_size)
+        block_size = SWISH_ARENA_BLOCK_SIZE;
+
+    arena = swish_xmalloc(sizeof(swish_Arena));
+    arena->ref_cnt = 0;
+    arena->block_size = block_size;
+    arena->nbytes = 0;
+    arena->nblocks = 1;
+    arena->head = arena_new_block(block_size);
+    return arena;
+}
+
+void *
+swish_arena_alloc(
+    swish_Arena *arena,
+    size_t size
+)
+{
+    struct swish_ArenaBlock *block;
+    void *ptr;
+
+    size = SWISH_ARENA_ALIGN(size);
+    block = arena->head;
+
+    if (block->used + size > block->size) {
+/* oversized requests get a block of their own, behind the current one,
+ * so the rest of the current block is not wasted */
+        if (size > arena->block_size / 4) {
+            struct swish_ArenaBlock *big = arena_new_block(size);
+            big->used = size;
+            big->next = block->next;
+            block->next = big;
+            arena->nblocks++;
+            arena->nbytes += size;
+            return SWISH_ARENA_DATA(big);
+        }
+        block = arena_new_block(arena->block_size);
+        block->next = arena->head;
+        arena->head = block;
+        arena->nblocks++;
+    }
+
+    ptr = SWISH_ARENA_DATA(block) + block->used;
+    block->used += size;
+    arena->nbytes += size;
+    return ptr;
+}
+
+xmlChar *
+swish_arena_strndup(
+    swish_Arena *arena,
+    const xmlChar *str,
+    int len
+)
+{
+    xmlChar *copy;
+
+    copy = swish_arena_alloc(arena, len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+xmlChar *
+swish_arena_strdup(
+    swish_Arena *arena,
+    const xmlChar *str
+)
+{
+    if (str == NULL)
+        SWISH_CROAK("swish_arena_strdup called with NULL");
+
+    return swish_arena_strndup(arena, str, xmlStrlen(str));
+}
+
+/* remember where arena is now, to go back there with swish_arena_release() */
+void
+swish_arena_mark(
+    swish_Arena *arena,
+    swish_ArenaMark *mark
+)
+{
+    mark->block   = arena->head;
+    mark->next    = arena->head->next;
+    mark->used    = arena->head->used;
+    mark->nbytes  = arena->nbytes;
+    mark->nblocks = arena->nblocks;
+}
+
+/* 
+ * free everything allocated since mark. marks must be released in the
+ * reverse order they were taken. blocks pushed since are in front of
+ * mark->block and oversized ones are right behind it.
+ */
+void
+swish_arena_release(
+    swish_Arena *arena,
+    swish_ArenaMark *mark
+)
+{
+    struct swish_ArenaBlock *block, *next;
+
+    for (block = arena->head; block != mark->block; block = next) {
+        next = block->next;
+        swish_xfree(block);
+    }
+    for (block = mark->block->next; block != mark->next; block = next) {
+        next = block->next;
+        swish_xfree(block);
+    }
+    mark->block->next = mark->next;
+    mark->block->used = mark->used;
+    arena->head    = mark->block;
+    arena->nbytes  = mark->nbytes;
+    arena->nblocks = mark->nblocks;
+}
+
+/* empty arena for reuse, keeping one block of the usual size */
+void
+swish_arena_reset(
+    swish_Arena *arena
+)
+{
+    struct swish_ArenaBlock *block, *next, *keep;
+
+    keep = NULL;
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        if (keep == NULL && block->size == arena->block_size)
+            keep = block;
+        else
+            swish_xfree(block);
+    }
+    if (keep == NULL)
+        keep = arena_new_block(arena->block_size);
+
+    keep->next = NULL;
+    keep->used = 0;
+    arena->head = keep;
+    arena->nbytes = 0;
+    arena->nblocks = 1;
+}
+
+void
+swish_arena_free(
+    swish_Arena *arena
+)
+{
+    struct swish_ArenaBlock *block, *next;
+
+    if (arena->ref_cnt != 0) {
+        SWISH_WARN("freeing Arena with ref_cnt != 0 (%d)", arena->ref_cnt);
+    }
+
+    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+        SWISH_DEBUG_MSG("freeing Arena: %lu bytes in %d blocks",
+                        (unsigned long)arena->nbytes, arena->nblocks);
+    }
+
+    for (block = arena->head; block != NULL; block = next) {
+        next = block->next;
+        swish_xfree(block);
+    }
+    swish_xfree(arena);
 }
@@ -272,3 +272,76 @@ swish_mime_get_parser(
 
     return swish_xstrdup(parser);       /* so we don't change orig value -- MUST free */
 }
+
+/*
+* magic numbers of formats no text parser should see. text that merely
+* starts with a few printable letters (BZh, ID3, MZ) is left to the
+* byte count in swish_mime_sniff_binary() instead.
+*/
+static const struct
+{
+    const char *magic;
+    int         len;
+    const char *reason;
+} SWISH_MAGIC_TABLE[] = {
+    { "%PDF-",                              5, "PDF document" },
+    { "PK\003\004",                         4, "zip archive" },
+    { "\037\213",                           2, "gzip data" },
+    { "\3757zXZ\000",                       6, "xz data" },
+    { "7z\274\257\047\034",                 6, "7-zip archive" },
+    { "\320\317\021\340\241\261\032\341",   8, "OLE2 (MS Office) document" },
+    { "\177ELF",                            4, "ELF executable" },
+    { "\312\376\272\276",                   4, "Mach-O or Java class file" },
+    { "\211PNG\r\n\032\n",                  8, "PNG image" },
+    { "GIF87a",                             6, "GIF image" },
+    { "GIF89a",                             6, "GIF image" },
+    { "\377\330\377",                       3, "JPEG image" },
+    { "II*\000",                            4, "TIFF image" },
+    { "MM\000*",                            4, "TIFF image" },
+    { "OggS",                               4, "Ogg media" },
+    { "\032\105\337\243",                   4, "Matroska media" },
+    { "SQLite format 3\000",               16, "SQLite database" },
+    { NULL,                                 0, NULL }
+};
+
+/*
+* a cheap look at the first SWISH_SNIFF_LEN bytes of buf. returns why
+* it is not text (a static string), or NULL if it may be. a known magic
+* number decides at once; otherwise more than 1 byte in 10 being a
+* control character does. a stray NUL, as in has_nulls.txt, is allowed.
+*/
+const char *
+swish_mime_sniff_binary(
+    const xmlChar *buf,
+    int len
+)
+{
+    int i, ctrl;
+
+    if (buf == NULL || len <= 0)
+        return NULL;
+
+    for (i = 0; SWISH_MAGIC_TABLE[i].magic != NULL; i++) {
+        if (len >= SWISH_MAGIC_TABLE[i].len
+            && !memcmp(buf, SWISH_MAGIC_TABLE[i].magic, SWISH_MAGIC_TABLE[i].len))
+            return SWISH_MAGIC_TABLE[i].reason;
+    }
+
+/* UTF-16 is half NULs but still text; libxml2 can decode it */
+    if (len >= 2 && ((buf[0] == 0xff && buf[1] == 0xfe) || (buf[0] == 0xfe && buf[1] == 0xff)))
+        return NULL;
+
+    if (len > SWISH_SNIFF_LEN)
+        len = SWISH_SNIFF_LEN;
+
+    ctrl = 0;
+    for (i = 0; i < len; i++) {
+        if (buf[i] == 0 || buf[i] == 0x7f
+            || (buf[i] < 0x20 && !strchr("\t\n\v\f\r\033", buf[i])))
+            ctrl++;
+    }
+    if (ctrl * 10 > len)
+        return "control characters";
+
+    return NULL;
+}
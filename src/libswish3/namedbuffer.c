@@ -17,7 +17,9 @@
  *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
 */
 
-/* named buffers are just a hash where each key is a text buffer
+/* named buffers are just a hash where each key is a text buffer.
+ * buffers are created on first write, so names that never see any text
+ * cost nothing.
 */
 
 #ifndef LIBSWISH3_SINGLE_FILE
@@ -48,7 +50,7 @@ static void print_buffer(
 static void
 cat_buffer(
     xmlBufferPtr buffer,
-    swish_NamedBuffer *nb2,
+    swish_NamedBuffer *nb1,
     xmlChar *name
 );
 
@@ -68,7 +70,7 @@ add_name_to_hash(
     if (SWISH_DEBUG == SWISH_DEBUG_NAMEDBUFFER)
         SWISH_DEBUG_MSG("  adding %s to NamedBuffer\n", name);
 
-    swish_hash_add(nbhash, name, xmlBufferCreateSize((size_t) SWISH_BUFFER_CHUNK_SIZE));
+    swish_hash_add(nbhash, name, xmlBufferCreateSize((size_t) SWISH_NB_BUFFER_SIZE));
 }
 
 static void
@@ -88,15 +90,17 @@ swish_nb_init(
     xmlHashTablePtr confhash
 )
 {
+    swish_MemSubsystem prev_mem = swish_mem_enter(SWISH_MEM_NAMEDBUFFER);
     swish_NamedBuffer *nb = swish_xmalloc(sizeof(swish_NamedBuffer));
     nb->stash = NULL;
     nb->ref_cnt = 0;
     nb->hash = xmlHashCreate(8);        /* will grow as needed */
+    swish_mem_leave(prev_mem);
 
-/* init a buffer for each key in confhash. Note that this inits hashes for alias_for
-   PropertyNames and MetaNames, which we will never use. But it's easier this way.
+/* buffers for names in confhash are created on first write in swish_nb_add_str().
+   confhash belongs to the config, so names added to it later are valid too.
 */
-    xmlHashScan(confhash, (xmlHashScanner)add_name_to_hash, nb->hash);
+    nb->conf = confhash;
 
     return nb;
 }
@@ -116,6 +120,8 @@ swish_nb_free(
     swish_NamedBuffer * nb
 )
 {
+    swish_MemSubsystem prev_mem = swish_mem_enter(SWISH_MEM_NAMEDBUFFER);
+
     xmlHashFree(nb->hash, (xmlHashDeallocator)free_name_from_hash);
 
     if (nb->ref_cnt != 0) {
@@ -126,6 +132,7 @@ swish_nb_free(
         SWISH_WARN("freeing NamedBuffer with non-null stash");
 
     swish_xfree(nb);
+    swish_mem_leave(prev_mem);
 }
 
 static void
@@ -153,13 +160,41 @@ print_buffer(
     }
 }
 
+typedef struct
+{
+    swish_NamedBuffer *nb;
+    xmlChar *label;
+} nb_debug_args;
+
+/* configured names that were never written to print as empty buffers */
+static void
+print_unused(
+    void *ignored,
+    nb_debug_args *args,
+    xmlChar *name
+)
+{
+    if (swish_hash_exists(args->nb->hash, name))
+        return;
+
+    SWISH_DEBUG_MSG("len=0 %s:<%s></%s>", args->label, name, name);
+    SWISH_DEBUG_MSG("  len=0 <%s></%s>", name, name);
+}
+
 void
 swish_nb_debug(
     swish_NamedBuffer * nb,
     xmlChar *label
 )
 {
+    nb_debug_args args;
+
     xmlHashScan(nb->hash, (xmlHashScanner)print_buffer, label);
+    if (nb->conf != NULL) {
+        args.nb = nb;
+        args.label = label;
+        xmlHashScan(nb->conf, (xmlHashScanner)print_unused, &args);
+    }
 }
 
 void
@@ -188,6 +223,7 @@ swish_nb_add_str(
 )
 {
     xmlChar *nowhitesp;
+    swish_MemSubsystem prev_mem;
     xmlBufferPtr buf = swish_hash_fetch(nb->hash, name);
 
 /* if the str is nothing but whitespace, skip it */
@@ -198,8 +234,10 @@ swish_nb_add_str(
         return;
     }
 
+    prev_mem = swish_mem_enter(SWISH_MEM_NAMEDBUFFER);
+
     if (!buf) {
-        if (autovivify) {
+        if (autovivify || (nb->conf != NULL && swish_hash_exists(nb->conf, name))) {
 /* spring to life */
             add_name_to_hash(NULL, nb->hash, name);
             buf = swish_hash_fetch(nb->hash, name);
@@ -237,6 +275,7 @@ swish_nb_add_str(
         swish_buffer_append(buf, str, len);
     }
 
+    swish_mem_leave(prev_mem);
 }
 
 void
@@ -267,29 +306,40 @@ swish_buffer_append(
 static void
 cat_buffer(
     xmlBufferPtr buffer,
-    swish_NamedBuffer *nb2,
+    swish_NamedBuffer *nb1,
     xmlChar *name
 )
 {
-    xmlChar *buf2;
-    buf2 = swish_nb_get_value(nb2, name);
-    if (xmlStrlen(buf2)) {
-        if (xmlBufferLength(buffer)) {
-            xmlBufferCat(buffer, (xmlChar *)SWISH_TOKENPOS_BUMPER);
-        }
-        xmlBufferCat(buffer, buf2);
+    xmlBufferPtr buf1;
+
+    if (!xmlBufferLength(buffer))
+        return;
+
+    buf1 = swish_hash_fetch(nb1->hash, name);
+    if (buf1 == NULL) {
+        add_name_to_hash(NULL, nb1->hash, name);
+        buf1 = swish_hash_fetch(nb1->hash, name);
     }
+    if (xmlBufferLength(buf1)) {
+        xmlBufferCat(buf1, (xmlChar *)SWISH_TOKENPOS_BUMPER);
+    }
+    xmlBufferCat(buf1, xmlBufferContent(buffer));
 }
 
+/* append each buffer in nb2 to the same-named buffer in nb1 */
 void
 swish_buffer_concat(
     swish_NamedBuffer *nb1,
     swish_NamedBuffer *nb2
 )
 {
-    xmlHashScan(nb1->hash, (xmlHashScanner)cat_buffer, nb2);
+    swish_MemSubsystem prev_mem = swish_mem_enter(SWISH_MEM_NAMEDBUFFER);
+    xmlHashScan(nb2->hash, (xmlHashScanner)cat_buffer, nb1);
+    swish_mem_leave(prev_mem);
 }
 
+/* returns an empty string for a configured name that has no text yet,
+ * and NULL for a name the NamedBuffer knows nothing about. */
 xmlChar *
 swish_nb_get_value(
     swish_NamedBuffer *nb,
@@ -298,5 +348,10 @@ swish_nb_get_value(
 {
     xmlBufferPtr buf;
     buf = swish_hash_fetch(nb->hash, key);
+    if (buf == NULL) {
+        if (nb->conf != NULL && swish_hash_exists(nb->conf, key))
+            return (xmlChar *)"";
+        return NULL;
+    }
     return (xmlChar *)xmlBufferContent(buf);
 }
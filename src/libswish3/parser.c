@@ -48,6 +48,8 @@
 #include <ctype.h>
 #include <wctype.h>
 #include <dirent.h>
+#include <iconv.h>
+#include <sys/stat.h>
 
 #include <libxml/parserInternals.h>
 #include <libxml/parser.h>
@@ -70,6 +72,12 @@ extern int SWISH_DEBUG;
 /* default is "on" per consistency with version 2.4.x */
 int SWISH_PARSER_WARNINGS = 1;
 
+/* files at least this many bytes are mmap'd instead of slurped. 0 disables. */
+long SWISH_MMAP_MIN = SWISH_MMAP_THRESHOLD;
+
+/* bytes of parsed XIncludes each swish_3 keeps. 0 disables the cache. */
+long SWISH_XINCLUDE_CACHE_MAX = SWISH_XINCLUDE_CACHE_SIZE;
+
 static void get_env_vars(
 );
 
@@ -149,6 +157,8 @@ static void open_tag(
     void *data,
     const xmlChar *tag,
     xmlChar **atts,
+    const xmlChar **xattrs,
+    int nxattrs,
     const xmlChar *xmlns_prefix
 );
 static void close_tag(
@@ -160,15 +170,38 @@ static xmlChar *bake_tag(
     swish_ParserData *parser_data,
     xmlChar *tag,
     xmlChar **atts,
+    const xmlChar **xattrs,
+    int nxattrs,
     xmlChar *xmlns_prefix
 );
+static boolean want_xml_attributes(
+    swish_ParserData *parser_data
+);
+static xmlChar *scratch_tolower(
+    swish_Arena *scratch,
+    const xmlChar *str,
+    int len
+);
 
+static int parse_document(
+    swish_ParserData *parser_data,
+    xmlChar *filename,
+    xmlChar *buffer,
+    int size
+);
 static int docparser(
     swish_ParserData *parser_data,
     xmlChar *filename,
     xmlChar *buffer,
     int size
 );
+static int utf8_boundary(
+    xmlChar *buffer,
+    int size
+);
+static void check_limits(
+    swish_ParserData *parser_data
+);
 static int xml_parser(
     xmlSAXHandlerPtr sax,
     void *user_data,
@@ -187,6 +220,13 @@ static int txt_parser(
     int size
 );
 
+static swish_PerfPhase perf_phase(
+    swish_ParserData *parser_data,
+    swish_PerfPhase phase
+);
+static void call_handler(
+    swish_ParserData *parser_data
+);
 static swish_ParserData *init_parser_data(
     swish_3 *s3
 );
@@ -210,9 +250,31 @@ static HEAD *buf_to_head(
 static void free_head(
     HEAD * h
 );
-static swish_DocInfo *head_to_docinfo(
+static void head_to_docinfo(
+    HEAD * h,
+    swish_DocInfo *info
+);
+static int read_docinfo(
+    swish_ParserData *parser_data,
     HEAD * h
 );
+static int is_header_line(
+    xmlChar *line
+);
+
+/*
+* parsing binary framed fh records
+*/
+static unsigned long read_frame_uint(
+    FILE * fh,
+    int nbytes
+);
+static xmlChar *read_frame_string(
+    FILE * fh
+);
+static swish_DocInfo *frame_to_docinfo(
+    FILE * fh
+);
 
 static xmlChar *document_encoding(
     xmlParserCtxtPtr ctxt
@@ -220,11 +282,34 @@ static xmlChar *document_encoding(
 
 static void set_encoding(
     swish_ParserData *parser_data,
-    xmlChar *buffer
+    xmlChar *buffer,
+    int size
+);
+static boolean prefix_is_utf8(
+    xmlChar *buffer,
+    int size
+);
+static int txt_transcode(
+    swish_ParserData *parser_data,
+    xmlChar *buffer,
+    int size,
+    const char *encoding
 );
 
 /* tag tracker */
+static int tag_context_len(
+    xmlChar *baked,
+    swish_Tag *below
+);
+static void fill_tag_context(
+    xmlChar *flat,
+    int size,
+    xmlChar *baked,
+    swish_Tag *below,
+    char flatten_join
+);
 static xmlChar *flatten_tag_stack(
+    swish_Arena *arena,
     xmlChar *baked,
     swish_TagStack *stack,
     char flatten_join
@@ -246,8 +331,10 @@ static swish_Tag *pop_tag_stack_on_match(
     swish_TagStack *stack,
     xmlChar *raw
 );
-static void free_swishTag(
-    swish_Tag * st
+static swish_TagStack *
+init_swishTagStack(
+    swish_Arena *arena,
+    char *name
 );
 static void
 free_swishTagStack(
@@ -280,6 +367,10 @@ swish_parser_init(
     p->handler = handler;
     p->verbosity = 0;
     p->ref_cnt = 0;
+    p->recover = SWISH_FALSE;
+    p->error = 0;
+    p->error_msg = NULL;
+    p->nfailed = 0;
 
 /*
 * libxml2 stuff 
@@ -292,7 +383,11 @@ swish_parser_init(
 */
     get_env_vars();
 
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (getenv("SWISH_RECOVER_ERRORS") != NULL) {
+        p->recover = swish_string_to_int(getenv("SWISH_RECOVER_ERRORS")) ? SWISH_TRUE : SWISH_FALSE;
+    }
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG("parser ptr 0x%x", (long int)p);
     }
 
@@ -304,31 +399,109 @@ swish_parser_free(
     swish_Parser *p
 )
 {
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG("freeing parser");
         swish_mem_debug();
     }
     if (p->ref_cnt != 0) {
         SWISH_WARN("parser ref_cnt != 0: %d\n", p->ref_cnt);
     }
+    if (p->error_msg != NULL) {
+        swish_xfree(p->error_msg);
+    }
     xmlCleanupParser();
     xmlMemoryDump();
     swish_xfree(p);
 }
 
+/*
+* are XML attributes worth looking at? only if something in the config
+* could match them: XMLClassAttributes, a tag.attr MetaName, or
+* UndefinedXMLAttributes other than disable. MetaNames can be added
+* mid-document, so rescan them when their number changes.
+*/
+static void
+find_dotted_metaname(
+    void *meta ATTRIBUTE_UNUSED,
+    boolean *found,
+    xmlChar *name
+)
+{
+    if (xmlStrchr(name, SWISH_DOT) != NULL)
+        *found = SWISH_TRUE;
+}
+
+static boolean
+want_xml_attributes(
+    swish_ParserData *parser_data
+)
+{
+    swish_Config *config = parser_data->s3->config;
+    int n;
+
+    if (config->flags->undef_attrs != SWISH_UNDEF_ATTRS_DISABLE)
+        return SWISH_TRUE;
+
+    if (swish_hash_exists(config->stringlists, (xmlChar *)SWISH_CLASS_ATTRIBUTES))
+        return SWISH_TRUE;
+
+    n = xmlHashSize(config->metanames);
+    if (n != parser_data->nmetanames) {
+        parser_data->nmetanames = n;
+        parser_data->attr_metanames = SWISH_FALSE;
+        xmlHashScan(config->metanames, (xmlHashScanner)find_dotted_metaname,
+                    &parser_data->attr_metanames);
+    }
+    return parser_data->attr_metanames;
+}
+
+/*
+* a lowercased, NUL-terminated copy of the first len bytes of str
+* (all of it if len < 0) in the scratch arena.
+*/
+static xmlChar *
+scratch_tolower(
+    swish_Arena *scratch,
+    const xmlChar *str,
+    int len
+)
+{
+    xmlChar *copy, *lower, *p;
+
+    if (len < 0)
+        len = xmlStrlen(str);
+    copy = swish_arena_strndup(scratch, str, len);
+    if (!swish_is_ascii(copy)) {
+        lower = swish_utf8_str_tolower(copy);
+        copy = swish_arena_strdup(scratch, lower);
+        swish_xfree(lower);
+        return copy;
+    }
+    for (p = copy; *p; p++) {
+        *p = (xmlChar)tolower(*p);
+    }
+    return copy;
+}
+
 /* 
 * turn the literal xml/html tag into a swish tag for matching against
-* metanames and properties 
+* metanames and properties. it and everything on the way to it are in
+* s3->scratch, released when the calling open_tag() or close_tag() returns.
+* atts is a SAX1 name/value array (HTML). xattrs is the SAX2 attributes
+* array from mystartElementNs(), nxattrs (localname, prefix, URI, value,
+* end) tuples, used as is.
 */
 static xmlChar *
 bake_tag(
     swish_ParserData *parser_data,
     xmlChar *tag,
     xmlChar **atts,
+    const xmlChar **xattrs,
+    int nxattrs,
     xmlChar *xmlns_prefix
 )
 {
-    int i, j, size, prev_ignore_content;
+    int i, j, size, len, prev_ignore_content;
     boolean is_html_tag, prev_bump_word; 
     xmlChar *swishtag,
             *swishdomtag,
@@ -340,9 +513,11 @@ bake_tag(
             *metaname, 
             *metacontent, 
             *metaname_from_attr;
+    const xmlChar *value;
+    swish_Arena *scratch = parser_data->s3->scratch;
     swish_StringList *strlist;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG(" tag: %s   parser->tag: %s ", tag, parser_data->tag);
         if (atts != NULL) {
             SWISH_DEBUG_MSG(" has attributes [%d]", xmlStrlen((xmlChar *)atts));
@@ -360,20 +535,18 @@ bake_tag(
 
     // normalize all tags 
 
-    swishtag = swish_str_tolower(tag);
+    swishtag = scratch_tolower(scratch, tag, -1);
     
     /* XML namespace support optional */
     if (xmlns_prefix != NULL && !parser_data->s3->config->flags->ignore_xmlns) {
-        xmlns = swish_str_tolower(xmlns_prefix);
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        xmlns = scratch_tolower(scratch, xmlns_prefix, -1);
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("xmlns_prefix: '%s' (%s)", xmlns, xmlns_prefix);
         }
         size = xmlStrlen(swishtag) + xmlStrlen(xmlns) + 2;     /*  : + NUL */
-        tmpstr = swish_xmalloc(size + 1);
+        tmpstr = swish_arena_alloc(scratch, size);
         snprintf((char *)tmpstr, size, "%s%c%s", (char *)xmlns, 
             SWISH_XMLNS_CHAR, (char *)swishtag);
-        swish_xfree(swishtag);
-        swish_xfree(xmlns);
         swishtag = tmpstr;
     }
 
@@ -390,7 +563,7 @@ bake_tag(
             xmlStrEqual(swishtag, BAD_CAST "img")
         ) {
             
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG("found html tag '%s' ... bump_word = %d", swishtag, SWISH_TRUE);
             }
             parser_data->bump_word = SWISH_TRUE;
@@ -407,7 +580,7 @@ bake_tag(
 * need to bump token position so we don't match across block *
 * elements 
 */
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("found html !inline tag '%s' ... bump_word = %d", swishtag, SWISH_TRUE);
                 }
                 parser_data->bump_word = SWISH_TRUE;
@@ -415,7 +588,7 @@ bake_tag(
             }
             else {
             
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("found html inline tag '%s' ... bump_word = %d", swishtag, SWISH_FALSE);
                 }
                 parser_data->bump_word = SWISH_FALSE;
@@ -432,7 +605,7 @@ bake_tag(
         if (xmlStrEqual(swishtag, BAD_CAST "meta") && atts != NULL) {
             for (i = 0; (atts[i] != 0); i++) {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("%d HTML attr: %s", i, atts[i]);
                 }
                 
@@ -468,7 +641,7 @@ bake_tag(
                         break;
                     
                     case SWISH_UNDEF_METAS_IGNORE:
-                        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                             SWISH_DEBUG_MSG("setting ignore_content=%d", 
                                 (parser_data->ignore_content +1));
                         }
@@ -498,29 +671,28 @@ bake_tag(
             }
         
             if (metacontent != NULL) {
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("found HTML meta: %s => %s", metaname, metacontent);
                 }
                 
                 // do not match across metas 
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("found HTML meta tag '%s' ... bump_word = %d", metaname, SWISH_TRUE);
                 }
                 
                 prev_bump_word = parser_data->bump_word;    // remember
                 parser_data->bump_word = SWISH_TRUE;
-                open_tag(parser_data, metaname, NULL, xmlns_prefix);
+                open_tag(parser_data, metaname, NULL, NULL, 0, xmlns_prefix);
                 buffer_characters(parser_data, metacontent, xmlStrlen(metacontent));
                 close_tag(parser_data, metaname, xmlns_prefix);
                 parser_data->bump_word = prev_bump_word;    // restore
                 
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                     SWISH_DEBUG_MSG("close_tag done. swishtag = '%s', parser->tag = '%s'", 
                         swishtag, parser_data->tag);
                 }
                         
-                swish_xfree(parser_data->tag);  // metaname set recursively, so must free
-                swish_xfree(swishtag);          // 'meta'
+                parser_data->tag = NULL;    // metaname set recursively, and released
                 
                 return NULL;
 
@@ -529,7 +701,7 @@ bake_tag(
                 SWISH_WARN("No content for meta tag '%s'", metaname);
             }
             
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG("setting ignore_content=%d", prev_ignore_content);
             }
             parser_data->ignore_content = prev_ignore_content;  // restore
@@ -542,7 +714,7 @@ bake_tag(
 */
     else {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("found xml tag '%s' ... bump_word = %d", swishtag, SWISH_TRUE);
         }
         
@@ -562,35 +734,37 @@ bake_tag(
 
 */
 
-        if (atts != NULL) {
-            strlist = NULL;
-            if (swish_hash_exists(parser_data->s3->config->stringlists, (xmlChar *)SWISH_CLASS_ATTRIBUTES)) {
-                strlist = swish_hash_fetch(parser_data->s3->config->stringlists, (xmlChar *)SWISH_CLASS_ATTRIBUTES);
-            }
+        if (nxattrs > 0 && want_xml_attributes(parser_data)) {
+            strlist = swish_hash_fetch(parser_data->s3->config->stringlists, (xmlChar *)SWISH_CLASS_ATTRIBUTES);
 
-            for (i = 0; (atts[i] != NULL); i += 2) {
+            for (i = 0; i < nxattrs * 5; i += 5) {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
-                    SWISH_DEBUG_MSG(" %d XML attr: %s=%s [%d]", i, atts[i], atts[i + 1],
-                                    xmlStrlen(atts[i + 1]));
+                value = xattrs[i + 3];
+                len = (int)(xattrs[i + 4] - value);
+                if (len <= 0)
+                    continue;
 
-                attr_lower = swish_str_tolower(atts[i]);
-                attr_val_lower = swish_str_tolower(atts[i + 1]);
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+                    SWISH_DEBUG_MSG(" %d XML attr: %s=%.*s [%d]", i / 5, xattrs[i], len, value, len);
+
+/* the value is only copied if something is going to use it */
+                attr_lower = scratch_tolower(scratch, xattrs[i], -1);
+                attr_val_lower = NULL;
 
 /* is this attribute a metaname? */
                 if (strlist != NULL) {
                     for (j = 0; j < strlist->n; j++) {
                         if (xmlStrEqual(strlist->word[j], attr_lower)) {
-                            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+                            if (attr_val_lower == NULL)
+                                attr_val_lower = scratch_tolower(scratch, value, len);
+                            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                                 SWISH_DEBUG_MSG("found %s: %s", attr_lower, attr_val_lower);
     
 /* eligible attribute name, attribute value part of baked tag */
                             size = xmlStrlen(swishtag) + xmlStrlen(attr_val_lower) + 2;     /*  dot + NUL */
-                            metaname = swish_xmalloc(size + 1);
+                            metaname = swish_arena_alloc(scratch, size);
                             snprintf((char *)metaname, size, "%s%c%s", (char *)swishtag, SWISH_DOT,
                                      (char *)attr_val_lower);
-    
-                            swish_xfree(swishtag);
                             swishtag = metaname;
                         }
                     }
@@ -600,10 +774,12 @@ bake_tag(
     explicit metaname with dotted notation. 
     attribute value considered document content, similar to how HTML parser works. 
 */
-                size = xmlStrlen(swishtag) + xmlStrlen(attr_lower) + 2;     /*  dot + NUL */
-                metaname_from_attr = swish_xmalloc(size + 1);
-                snprintf((char *)metaname_from_attr, size, "%s%c%s", (char *)swishtag, SWISH_DOT, 
-                    (char *)attr_lower);
+                j = xmlStrlen(swishtag);
+                size = j + xmlStrlen(attr_lower) + 2;     /*  dot + NUL */
+                metaname_from_attr = swish_arena_alloc(scratch, size);
+                memcpy(metaname_from_attr, swishtag, j);
+                metaname_from_attr[j] = SWISH_DOT;
+                memcpy(metaname_from_attr + j + 1, attr_lower, size - j - 1);   /* with NUL */
                     
                 if (!swish_hash_exists(parser_data->s3->config->metanames, metaname_from_attr)) {
                     switch(parser_data->s3->config->flags->undef_attrs) {
@@ -634,6 +810,8 @@ bake_tag(
                     
                         case SWISH_UNDEF_ATTRS_INDEX:
                             // TODO what metaname to use?
+                            if (attr_val_lower == NULL)
+                                attr_val_lower = scratch_tolower(scratch, value, len);
                             prev_bump_word = parser_data->bump_word;
                             parser_data->bump_word = SWISH_TRUE;
                             buffer_characters(parser_data, attr_val_lower, xmlStrlen(attr_val_lower));
@@ -648,26 +826,23 @@ bake_tag(
                 }
                     
                 if (swish_hash_exists(parser_data->s3->config->metanames, metaname_from_attr)) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+                    if (attr_val_lower == NULL)
+                        attr_val_lower = scratch_tolower(scratch, value, len);
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                         SWISH_DEBUG_MSG("found XML meta tag '%s' with content '%s'", 
                             metaname_from_attr, attr_val_lower);
 
                     parser_data->bump_word = SWISH_TRUE;
-                    open_tag(parser_data, metaname_from_attr, NULL, xmlns_prefix);
+                    open_tag(parser_data, metaname_from_attr, NULL, NULL, 0, xmlns_prefix);
                     buffer_characters(parser_data, attr_val_lower, xmlStrlen(attr_val_lower));
                     close_tag(parser_data, metaname_from_attr, xmlns_prefix);
-                    swish_xfree(parser_data->tag);  // metaname set recursively, so must free
+                    parser_data->tag = NULL;    // metaname set recursively, and released
                 
-                    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                         SWISH_DEBUG_MSG("close_tag done. swishtag = '%s', parser->tag = '%s'", 
                             metaname_from_attr, parser_data->tag);
                 
                 }
-
-                swish_xfree(metaname_from_attr);
-                swish_xfree(attr_lower);
-                swish_xfree(attr_val_lower);
-            
             }
         }
         
@@ -684,7 +859,7 @@ bake_tag(
                     break;
                     
                 case SWISH_UNDEF_METAS_IGNORE:
-                    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                         SWISH_DEBUG_MSG("setting ignore_content=%d", 
                             (parser_data->ignore_content +1));
                     }
@@ -708,7 +883,7 @@ bake_tag(
                 case SWISH_UNDEF_METAS_INDEX:
                 default:
                     if (parser_data->ignore_content) {
-                        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+                        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                             SWISH_DEBUG_MSG("ignore_content was %d, setting ignore_content=0", 
                                 parser_data->ignore_content);
                         }
@@ -727,26 +902,23 @@ bake_tag(
  */
     alias = swish_hash_fetch(parser_data->s3->config->tag_aliases, swishtag);
     if (alias) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("%s alias -> %s", swishtag, alias); 
         }
-        swish_xfree(swishtag);
-        swishtag = swish_xstrdup(alias);
+        swishtag = swish_arena_strdup(scratch, alias);
     }
     else {
-        swishdomtag = flatten_tag_stack(swishtag, parser_data->domstack, SWISH_DOT);
+        swishdomtag = flatten_tag_stack(scratch, swishtag, parser_data->domstack, SWISH_DOT);
         alias = swish_hash_fetch(parser_data->s3->config->tag_aliases, swishdomtag);
         if (alias) {
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG("%s alias -> %s", swishdomtag, alias); 
             }
-            swish_xfree(swishtag);
-            swishtag = swish_xstrdup(alias);
+            swishtag = swish_arena_strdup(scratch, alias);
         }
-        swish_xfree(swishdomtag);
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG(" swishtag = %s", swishtag);
     }
 
@@ -763,8 +935,9 @@ flush_buffer(
     swish_MetaName *meta;
     xmlChar *metaname_stored_as;
     swish_TagStack *s = parser_data->metastack;
+    swish_PerfPhase prev_phase;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("buffer is >>%s<< before flush",
                         xmlBufferContent(parser_data->meta_buf));
 
@@ -780,6 +953,9 @@ flush_buffer(
     else {
         metaname_stored_as = metaname;
     }
+    SWISH_TRACE_EVENT(SWISH_TRACE_FLUSH, metaname_stored_as,
+                      xmlBufferLength(parser_data->meta_buf));
+    prev_phase = perf_phase(parser_data, SWISH_PERF_NAMEDBUFFER);
     swish_nb_add_buf(parser_data->metanames, metaname_stored_as, parser_data->meta_buf,
                         (xmlChar *)SWISH_TOKENPOS_BUMPER, 0, 1);
 
@@ -797,6 +973,7 @@ flush_buffer(
                                 0, 1);
         }
     }
+    perf_phase(parser_data, prev_phase);
 
     if (parser_data->s3->analyzer->tokenize) {
         tokenize(parser_data, (xmlChar *)xmlBufferContent(parser_data->meta_buf),
@@ -804,6 +981,7 @@ flush_buffer(
     }
 
     xmlBufferEmpty(parser_data->meta_buf);
+    check_limits(parser_data);
 
 }
 
@@ -820,7 +998,7 @@ mystartDocument(
 * swish_ParserData *parser_data = (swish_ParserData *) data; 
 */
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("startDocument()");
 
 }
@@ -834,7 +1012,7 @@ myendDocument(
 )
 {
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("endDocument()");
 
 /*
@@ -855,7 +1033,7 @@ mystartElement(
     const xmlChar **atts
 )
 {
-    open_tag(data, name, (xmlChar **)atts, NULL);
+    open_tag(data, name, (xmlChar **)atts, NULL, 0, NULL);
 }
 
 /* 
@@ -886,47 +1064,23 @@ mystartElementNs(
     const xmlChar **attributes
 )
 {
-    int i, j, len;
-    xmlChar **atts;
+    int i, len;
     xmlChar *xinclude_uri;
     boolean xinclude_is_text;
     swish_ParserData *parser_data;
-    atts = NULL;
     parser_data = (swish_ParserData*)data;
 
-    if (nb_attributes > 0) {
-        atts = swish_xmalloc(((nb_attributes * 2) + 1) * sizeof(xmlChar *));
-        j = 0;
-        for (i = 0; i < nb_attributes * 5; i += 5) {
-            atts[j] = (xmlChar *)attributes[i];
-            len = (int)(attributes[i + 4] - attributes[i + 3]);
-            if (len > 0) {
-                atts[j + 1] = xmlStrsub(attributes[i + 3], 0, len);
-            }
-            else {
-                atts[j] = NULL;
-            }
-            j += 2;
-        }
-        atts[j] = NULL;
-    }
-
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
-        //SWISH_DEBUG_MSG(" tag: %s nb_attributes %d", localname, nb_attributes);
-        if (atts != NULL) {
-            for (i = 0; (atts[i] != NULL); i += 2) {
-                //SWISH_DEBUG_MSG(" att: %s=%s", atts[i], atts[i + 1]);
-/* SWISH_DEBUG_MSG(" att: %s=", atts[i++], atts[i] || ""); */
-            }
-        }
-    }
+/*
+* attributes are passed on as libxml2 gives them to us:
+* (localname, prefix, URI, value, end) with value not NUL-terminated
+*/
             
     /* check for XInclude */
-    if ((xmlStrEqual(URI, XINCLUDE_OLD_NS) || xmlStrEqual(URI, XINCLUDE_NS))
+    if (nb_attributes > 0
         &&
-        xmlStrEqual(localname, XINCLUDE_NODE)
+        (xmlStrEqual(URI, XINCLUDE_OLD_NS) || xmlStrEqual(URI, XINCLUDE_NS))
         &&
-        atts != NULL
+        xmlStrEqual(localname, XINCLUDE_NODE)
     ) {
     
         /*
@@ -935,29 +1089,28 @@ mystartElementNs(
         */
         xinclude_is_text = SWISH_FALSE;
         xinclude_uri = NULL;
-        for (i = 0; (atts[i] != NULL); i += 2) {
-            //SWISH_DEBUG_MSG(" att: %s=%s", atts[i], atts[i + 1]);
-            if (xmlStrEqual(atts[i], XINCLUDE_HREF)) {
-                //SWISH_DEBUG_MSG("XInclude: %s", atts[i + 1]);
-                xinclude_uri = atts[i+1];
+        for (i = 0; i < nb_attributes * 5; i += 5) {
+            len = (int)(attributes[i + 4] - attributes[i + 3]);
+            if (len <= 0)
+                continue;
+            if (xmlStrEqual(attributes[i], XINCLUDE_HREF)) {
+                if (xinclude_uri != NULL)
+                    swish_xfree(xinclude_uri);
+                xinclude_uri = swish_xstrndup(attributes[i + 3], len);
             }
-            if (xmlStrEqual(atts[i], XINCLUDE_PARSE)) {
-                xinclude_is_text = (boolean)xmlStrEqual(atts[i+1], XINCLUDE_PARSE_TEXT);
+            if (xmlStrEqual(attributes[i], XINCLUDE_PARSE)) {
+                xinclude_is_text = (boolean)(len == xmlStrlen(XINCLUDE_PARSE_TEXT)
+                    && !xmlStrncmp(attributes[i + 3], XINCLUDE_PARSE_TEXT, len));
             }
         }
-        if (xinclude_uri != NULL && parser_data->s3->config->flags->follow_xinclude) {
-            process_xinclude( parser_data, xinclude_uri, xinclude_is_text );
+        if (xinclude_uri != NULL) {
+            if (parser_data->s3->config->flags->follow_xinclude)
+                process_xinclude( parser_data, xinclude_uri, xinclude_is_text );
+            swish_xfree(xinclude_uri);
         }
     }
 
-    open_tag(data, localname, atts, xmlns_prefix);
-
-    if (atts != NULL) {
-        for (i = 0; (atts[i] != NULL); i += 2) {
-            xmlFree(atts[i+1]); /* do not use swish_xfree since we did not malloc it */
-        }
-        swish_xfree(atts);
-    }
+    open_tag(data, localname, NULL, attributes, nb_attributes, xmlns_prefix);
 }
 
 static void
@@ -966,22 +1119,15 @@ xinclude_handler(
 )
 {   
     swish_ParserData *parent;
-    swish_Token *t;
-    swish_TokenIterator *it;
+    unsigned int n;
     
     parent = (swish_ParserData*)parser_data->s3->stash;
-    it = parser_data->token_iterator;
-    while ((t = swish_token_iterator_next_token(it)) != NULL) {
-        //swish_token_debug(t);
-        swish_token_list_add_token(
-            parent->token_iterator->tl,
-            t->value,
-            t->len + 1, // include the NUL
-            t->meta,
-            t->context
-        );
-    }
-    parent->docinfo->nwords += parser_data->docinfo->nwords;
+    n = swish_token_list_merge(parent->token_iterator->tl, parser_data->token_iterator->tl);
+/* fewer if the parent ran out of its budget */
+    if (n < parser_data->token_iterator->tl->n)
+        parent->docinfo->nwords += n;
+    else
+        parent->docinfo->nwords += parser_data->docinfo->nwords;
     
     swish_buffer_concat(parent->properties, parser_data->properties);
     swish_buffer_concat(parent->metanames, parser_data->metanames);
@@ -1000,8 +1146,14 @@ process_xinclude(
     int res;
     swish_ParserData *child_data;
     boolean path_is_absolute, path_needs_free;
+    swish_XIncludeCache *cache;
+    swish_XIncludeFragment *frag;
+    struct stat st;
+    unsigned int i;
 
     path_needs_free = SWISH_FALSE;
+    cache = NULL;
+    frag = NULL;
     
     /* test if absolute path */
     if (uri[0] == SWISH_PATH_SEP) {
@@ -1025,7 +1177,7 @@ process_xinclude(
         path_is_absolute = SWISH_FALSE;
     }
     
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("xinclude  uri=%s  path=%s  xuri=%s", parser_data->docinfo->uri, path, xuri);
     }
         
@@ -1041,24 +1193,82 @@ process_xinclude(
                     parser_data->metastack->head->baked,
                     parser_data->metastack->head->context
                 );
-    child_data = init_parser_data(parser_data->s3);
-    child_data->docinfo = swish_docinfo_init();
-    child_data->docinfo->ref_cnt++;
 
-    if (!swish_docinfo_from_filesystem(xuri, child_data->docinfo, child_data)) {
-        SWISH_WARN("Skipping XInclude %s", xuri);
+/*
+* a file we have already parsed, unchanged since, is merged from the cache
+*/
+    if (SWISH_XINCLUDE_CACHE_MAX > 0) {
+        if (stat((char *)xuri, &st) == 0) {
+            if (parser_data->s3->xinclude_cache == NULL) {
+                parser_data->s3->xinclude_cache =
+                    swish_xinclude_cache_init((size_t)SWISH_XINCLUDE_CACHE_MAX);
+            }
+            cache = parser_data->s3->xinclude_cache;
+            frag = swish_xinclude_cache_fetch(cache, xuri, st.st_mtime, st.st_size, is_text);
+        }
+        else {
+            st.st_mtime = 0;
+            st.st_size = -1;
+        }
+
+/* if we are ourselves a fragment, it is only good while xuri is unchanged */
+        swish_xinclude_deps_add(parser_data, xuri, st.st_mtime, st.st_size);
     }
-    else {
-        if (is_text && !xmlStrEqual(child_data->docinfo->parser, BAD_CAST SWISH_PARSER_TXT)) {
-            swish_xfree(child_data->docinfo->parser);
-            child_data->docinfo->parser = swish_xstrdup( BAD_CAST SWISH_PARSER_TXT );
+
+    if (frag != NULL) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+            SWISH_DEBUG_MSG("xinclude cache hit for %s", xuri);
+
+        swish_xinclude_cache_merge(frag, parser_data);
+        for (i = 0; i < frag->ndeps; i++) {
+            swish_xinclude_deps_add(parser_data, frag->deps[i].uri,
+                                    frag->deps[i].mtime, frag->deps[i].size);
         }
-        res = docparser(child_data, xuri, NULL, 0);
-        xinclude_handler(child_data);
     }
+    else {
+        perf_phase(parser_data, parser_data->phase);    /* stop the clock */
+        child_data = init_parser_data(parser_data->s3);
+        child_data->is_xinclude = SWISH_TRUE;
+        child_data->docinfo = swish_docinfo_init();
+        child_data->docinfo->ref_cnt++;
+
+        if (!swish_docinfo_from_filesystem(xuri, child_data->docinfo, child_data)) {
+            SWISH_WARN("Skipping XInclude %s", xuri);
+        }
+        else {
+            if (is_text && !xmlStrEqual(child_data->docinfo->parser, BAD_CAST SWISH_PARSER_TXT)) {
+                swish_xfree(child_data->docinfo->parser);
+                child_data->docinfo->parser = swish_xstrdup( BAD_CAST SWISH_PARSER_TXT );
+            }
+            parser_data->child = child_data;
+            res = docparser(child_data, xuri, NULL, 0);
+            xinclude_handler(child_data);
+            parser_data->child = NULL;
+
+            for (i = 0; i < child_data->nxinclude_deps; i++) {
+                swish_xinclude_deps_add(parser_data, child_data->xinclude_deps[i].uri,
+                                        child_data->xinclude_deps[i].mtime,
+                                        child_data->xinclude_deps[i].size);
+            }
+
+            if (cache != NULL) {
+                swish_xinclude_cache_store(cache, xuri, st.st_mtime, st.st_size,
+                                           is_text, child_data);
+            }
+        }
     
+/* 
+* the child's time is the parent's, phase by phase. restart
+* the parent's clock so it is not counted twice.
+*/
+        perf_phase(child_data, SWISH_PERF_OTHER);
+        swish_perf_add(&parser_data->perf, &child_data->perf);
+        parser_data->phase_start = swish_time_monotonic();
+
+        free_parser_data(child_data);
+    }
+
     /* clean up */
-    free_parser_data(child_data);
     if (!path_is_absolute) {
         if (path_needs_free) {
             swish_xfree(path);
@@ -1076,6 +1286,9 @@ process_xinclude(
     
     /* restore stash */
     parser_data->s3->stash = cur_stash;
+
+/* the included tokens count against this document's limits */
+    check_limits(parser_data);
 }
 
 /* 
@@ -1097,33 +1310,32 @@ open_tag(
     void *data,
     const xmlChar *tag,
     xmlChar **atts,
+    const xmlChar **xattrs,
+    int nxattrs,
     const xmlChar *xmlns_prefix
 )
 {
     swish_ParserData *parser_data;
     xmlChar *baked;
+    swish_ArenaMark mark;
     
     parser_data = (swish_ParserData *)data;
     
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("<%s>", tag);
     }
     
-    if (parser_data->tag != NULL) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
-            SWISH_DEBUG_MSG("Freeing swishtag (parser_data->tag): '%s'", parser_data->tag);
-        }
-        swish_xfree(parser_data->tag);
-        parser_data->tag = NULL;
-    }
-
+/* the baked tag is only needed until we return */
+    swish_arena_mark(parser_data->s3->scratch, &mark);
     parser_data->tag = bake_tag(
                 parser_data, 
                 (xmlChar *)tag, 
                 (xmlChar **)atts, 
+                xattrs,
+                nxattrs,
                 (xmlChar *)xmlns_prefix);
         
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("checking config for '%s' in watched tags", parser_data->tag);
     }
     
@@ -1135,6 +1347,7 @@ open_tag(
     else {
         push_tag_stack(parser_data->domstack, (xmlChar *)tag, parser_data->tag, SWISH_DOT);
     }
+    SWISH_TRACE_EVENT(SWISH_TRACE_TAG_OPEN, tag, 0);
     
 /*
 * set property if this tag is configured for it 
@@ -1143,7 +1356,7 @@ open_tag(
         ||
         swish_hash_exists(parser_data->s3->config->properties, parser_data->domstack->head->context)
     ) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG(" %s = new property", parser_data->tag);
         }
         
@@ -1159,7 +1372,7 @@ open_tag(
         
         push_tag_stack(parser_data->propstack, (xmlChar *)tag, baked, SWISH_DOM_CHAR);
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("%s pushed ok unto propstack", baked);
         }
     }
@@ -1172,7 +1385,7 @@ open_tag(
         ||
         swish_hash_exists(parser_data->s3->config->metanames, parser_data->domstack->head->context)
     ) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG(" %s = new metaname", parser_data->tag);
         }
         flush_buffer(parser_data, parser_data->metastack->head->baked,
@@ -1187,9 +1400,12 @@ open_tag(
         push_tag_stack(parser_data->metastack, (xmlChar *)tag, baked, SWISH_DOM_CHAR);
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("config check for '%s' done", parser_data->tag);
     }
+
+    parser_data->tag = NULL;
+    swish_arena_release(parser_data->s3->scratch, &mark);
 }
 
 static void
@@ -1201,52 +1417,48 @@ close_tag(
 {
     swish_ParserData *parser_data;
     swish_Tag *st;
+    swish_ArenaMark mark;
 
     parser_data = (swish_ParserData *)data;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("</%s>", tag);
         
 /*
 * lowercase all names for comparison against metanames (which are
-* also * lowercased) 
+* also * lowercased). the baked tag is only needed until we return.
 */
-    if (parser_data->tag != NULL) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
-            SWISH_DEBUG_MSG("freeing parser_data->tag '%s'", parser_data->tag);
-        }
-        swish_xfree(parser_data->tag);
-        parser_data->tag = NULL;
-    }
-    
-    parser_data->tag = bake_tag(parser_data, (xmlChar *)tag, NULL, (xmlChar *)xmlns_prefix);
+    swish_arena_mark(parser_data->s3->scratch, &mark);
+    parser_data->tag = bake_tag(parser_data, (xmlChar *)tag, NULL, NULL, 0, (xmlChar *)xmlns_prefix);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG(" endElement(%s) (%s)", (xmlChar *)tag, parser_data->tag);
         
-    if (parser_data->tag == NULL)
+    if (parser_data->tag == NULL) {
+        swish_arena_release(parser_data->s3->scratch, &mark);
         return;
+    }
 
     if ((st = pop_tag_stack_on_match(parser_data->propstack, (xmlChar *)tag)) != NULL) {
 
         add_stack_to_prop_buf(st->baked, parser_data);
         xmlBufferEmpty(parser_data->prop_buf);
-        free_swishTag(st);
     }
 
     if ((st = pop_tag_stack_on_match(parser_data->metastack, (xmlChar *)tag)) != NULL) {
 
-        //SWISH_DEBUG_MSG("flush_buffer before free_swishTag");
         flush_buffer(parser_data, st->baked, st->context);
-        //SWISH_DEBUG_MSG("metastack pop_tag_stack_on_match free_swishTag");
-        free_swishTag(st);
     }
     
-    // always pop the raw domstack
-    st = pop_tag_stack(parser_data->domstack);
-    free_swishTag(st);
-    //SWISH_DEBUG_MSG("free_swishTag raw DOMstack done");
+/* 
+* always pop the raw domstack. a popped tag is reused by the
+* next push, so st is only good until then.
+*/
+    pop_tag_stack(parser_data->domstack);
+    SWISH_TRACE_EVENT(SWISH_TRACE_TAG_CLOSE, tag, 0);
 
+    parser_data->tag = NULL;
+    swish_arena_release(parser_data->s3->scratch, &mark);
 }
 
 /* 
@@ -1261,20 +1473,20 @@ buffer_characters(
 {
 
     if (parser_data->ignore_content) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("skipping %d bytes because ignore_content > 0", len);
         }
         return;
     }
 
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("appending %d bytes to buffer (bump_word=%d)", 
             len, parser_data->bump_word);
     }
 
     if (parser_data->bump_word && xmlBufferLength(parser_data->meta_buf)) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {    
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {    
             SWISH_DEBUG_MSG("bump_word is true; appending TOKENPOS_BUMPER to meta_buf");
         }
         swish_buffer_append(parser_data->meta_buf, (xmlChar *)SWISH_TOKENPOS_BUMPER, 1);
@@ -1282,14 +1494,20 @@ buffer_characters(
     
     swish_buffer_append(parser_data->meta_buf, BAD_CAST ch, len);
 
-    if (parser_data->bump_word && xmlBufferLength(parser_data->prop_buf)) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
-            SWISH_DEBUG_MSG("bump_word is true; appending TOKENPOS_BUMPER to prop_buf");
+/* 
+* only the root sentinel on the propstack means nobody will ever read
+* prop_buf, so don't bother filling it.
+*/
+    if (parser_data->propstack->count > 1) {
+        if (parser_data->bump_word && xmlBufferLength(parser_data->prop_buf)) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
+                SWISH_DEBUG_MSG("bump_word is true; appending TOKENPOS_BUMPER to prop_buf");
+            }
+            swish_buffer_append(parser_data->prop_buf, (xmlChar *)SWISH_TOKENPOS_BUMPER, 1);
         }
-        swish_buffer_append(parser_data->prop_buf, (xmlChar *)SWISH_TOKENPOS_BUMPER, 1);
-    }
 
-    swish_buffer_append(parser_data->prop_buf, BAD_CAST ch, len);
+        swish_buffer_append(parser_data->prop_buf, BAD_CAST ch, len);
+    }
     
     // reset
     parser_data->bump_word = SWISH_FALSE;
@@ -1305,7 +1523,7 @@ mycharacters(
     int len
 )
 {
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         int i;
         for (i=0; i<len; i++) {
             SWISH_DEBUG_MSG("%c [%d]", ch[i], i);
@@ -1354,7 +1572,7 @@ mycomments(
     }
 
     if ( !xmlStrcasecmp( comment_text, (xmlChar*)"noindex" ) ) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("found noindex comment, setting ignore_content=%d", 
                 (parser_data->ignore_content +1));
         }
@@ -1363,7 +1581,7 @@ mycomments(
     }
     else if ( !xmlStrcasecmp( comment_text, (xmlChar*)"index" ) ) {
         if ( parser_data->ignore_content > 0 ) {
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG("found index comment, setting ignore_content=%d", 
                     (parser_data->ignore_content -1));
             }
@@ -1487,6 +1705,126 @@ xmlSAXHandler my_parser = {
 
 xmlSAXHandlerPtr my_parser_ptr = &my_parser;
 
+static void
+free_body(
+    swish_ParserData *parser_data
+)
+{
+    if (parser_data->body == NULL)
+        return;
+
+    if (parser_data->body_mapped) {
+        swish_io_munmap(parser_data->body, parser_data->body_len);
+    }
+    else {
+        swish_xfree(parser_data->body);
+    }
+    parser_data->body = NULL;
+}
+
+/*
+* docparser() under a swish_ErrorFrame when the parser is in recover mode.
+* a croak anywhere in the parse lands here: the doc is marked failed
+* (parser_data->error) and the caller skips the handler and frees
+* parser_data as usual. croaks in the handler itself still exit.
+*/
+static int
+parse_document(
+    swish_ParserData *parser_data,
+    xmlChar *filename,
+    xmlChar *buffer,
+    int size
+)
+{
+    swish_Parser *parser = parser_data->s3->parser;
+    swish_ErrorFrame frame;
+    swish_MemSubsystem prev_mem;
+    void *stash;
+    int ret;
+
+    if (!parser->recover)
+        return docparser(parser_data, filename, buffer, size);
+
+    prev_mem = swish_mem_enter(SWISH_MEM_OTHER);
+    stash = parser_data->s3->stash;
+    swish_error_push(&frame);
+
+    if (setjmp(frame.env)) {
+        swish_mem_leave(prev_mem);
+        parser_data->s3->stash = stash;
+        perf_phase(parser_data, SWISH_PERF_OTHER);
+        SWISH_TRACE_EVENT(SWISH_TRACE_DOC_END, parser_data->docinfo->uri, -1);
+
+        parser_data->error = SWISH_ERR_DOC_FAILED;
+        parser->error = SWISH_ERR_DOC_FAILED;
+        if (parser->error_msg != NULL)
+            swish_xfree(parser->error_msg);
+        parser->error_msg = swish_xstrdup((xmlChar *)frame.msg);
+        parser->nfailed++;
+
+        SWISH_WARN("Skipping %s: %s", parser_data->docinfo->uri, frame.msg);
+        return SWISH_ERR_DOC_FAILED;
+    }
+
+    ret = docparser(parser_data, filename, buffer, size);
+
+    swish_error_pop(&frame);
+    swish_mem_leave(prev_mem);
+    return ret;
+}
+
+/* size, or less if the last UTF-8 character in buffer[0..size) is cut off */
+static int
+utf8_boundary(
+    xmlChar *buffer,
+    int size
+)
+{
+    int i, need;
+
+    if (size <= 0 || buffer[size - 1] < 0x80)
+        return size;
+
+    i = size - 1;
+    while (i > 0 && size - i < 4 && (buffer[i] & 0xC0) == 0x80)
+        i--;
+
+    if (buffer[i] >= 0xF0)
+        need = 4;
+    else if (buffer[i] >= 0xE0)
+        need = 3;
+    else if (buffer[i] >= 0xC0)
+        need = 2;
+    else
+        need = 1;
+
+    return i + need > size ? i : size;
+}
+
+/*
+* out of tokens or time? mark the doc truncated and stop the SAX parser.
+* called after each flush, so the time check runs once per tag at most.
+*/
+static void
+check_limits(
+    swish_ParserData *parser_data
+)
+{
+    if (parser_data->limits == NULL)
+        return;
+
+    if (parser_data->token_iterator->tl->truncated
+        || (parser_data->deadline > 0 && swish_time_monotonic() > parser_data->deadline)) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+            SWISH_DEBUG_MSG("%s over its %s budget, stopping", parser_data->docinfo->uri,
+                            parser_data->deadline > 0
+                            && swish_time_monotonic() > parser_data->deadline ? "time" : "token");
+        parser_data->docinfo->truncated = SWISH_TRUE;
+        if (parser_data->ctxt != NULL)
+            xmlStopParser(parser_data->ctxt);
+    }
+}
+
 static int
 docparser(
     swish_ParserData *parser_data,
@@ -1497,7 +1835,13 @@ docparser(
 {
 
     int ret;
+    boolean mapped, dedup;
+    off_t read_len;
+    swish_Limits *limits;
+    swish_MemSubsystem prev_mem;
+    swish_PerfPhase prev_phase;
     ret = 0;
+    mapped = SWISH_FALSE;
     xmlChar *mime = (xmlChar *)parser_data->docinfo->mime;
     xmlChar *parser = (xmlChar *)parser_data->docinfo->parser;
 
@@ -1507,14 +1851,37 @@ docparser(
         return 1;
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    prev_mem = swish_mem_enter(SWISH_MEM_PARSER);
+    prev_phase = perf_phase(parser_data, SWISH_PERF_READ);
+    SWISH_TRACE_EVENT(SWISH_TRACE_DOC_START, parser_data->docinfo->uri, 0);
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s -- using %s parser [%c]", parser_data->docinfo->uri, parser, parser[0]);
     }
+
+/*
+* budgets for this kind of document. the clock starts now.
+*/
+    limits = swish_config_get_limits(parser_data->s3->config, mime, parser);
+    parser_data->limits = limits;
+    if (limits != NULL) {
+        parser_data->token_iterator->tl->max_tokens = limits->max_tokens;
+        if (limits->max_seconds > 0) {
+            parser_data->deadline = swish_time_monotonic() + limits->max_seconds;
+            parser_data->token_iterator->tl->deadline = parser_data->deadline;
+        }
+    }
     
 /*
 * slurp file if not already in memory 
 */
     if (filename && !buffer) {
+        read_len = parser_data->docinfo->size;
+        if (read_len > SWISH_MAX_FILE_LEN)
+            read_len = SWISH_MAX_FILE_LEN;   /* swish_io_slurp_file_len() warns */
+        if (limits != NULL && limits->max_bytes && read_len > limits->max_bytes)
+            read_len = limits->max_bytes;
+
         if (parser_data->docinfo->is_gzipped) {
             buffer = swish_io_slurp_gzfile_len(
                 filename, 
@@ -1522,17 +1889,116 @@ docparser(
                 SWISH_FALSE
             );
             parser_data->docinfo->size = xmlStrlen(buffer);
+            read_len = parser_data->docinfo->size;
         }
         else {
-            buffer = swish_io_slurp_file_len(
-                filename, 
-                (off_t)parser_data->docinfo->size,
-                SWISH_FALSE
-            );
+/* a partial mapping would not be NUL-terminated */
+            if (SWISH_MMAP_MIN && parser_data->docinfo->size >= SWISH_MMAP_MIN
+                && read_len == parser_data->docinfo->size) {
+                buffer = swish_io_mmap_file(
+                    filename,
+                    (off_t)parser_data->docinfo->size,
+                    SWISH_FALSE
+                );
+                mapped = buffer ? SWISH_TRUE : SWISH_FALSE;
+            }
+            if (!buffer) {
+                buffer = swish_io_slurp_file_len(
+                    filename, 
+                    read_len,
+                    SWISH_FALSE
+                );
+            }
+        }
+        size = (int)read_len;
+
+/*
+* the body is ours to free. hang it on parser_data so that
+* free_parser_data() can still release it if a croak unwinds past us.
+*/
+        parser_data->body = buffer;
+        parser_data->body_len = mapped ? parser_data->docinfo->size : (off_t)size;
+        parser_data->body_mapped = mapped;
+    }
+
+/*
+* over the byte budget? parse only the first max_bytes, backed off
+* to the start of a UTF-8 character.
+*/
+    if (limits != NULL && limits->max_bytes
+        && (size > limits->max_bytes || size < parser_data->docinfo->size)) {
+        if (size > limits->max_bytes)
+            size = (int)limits->max_bytes;
+        size = utf8_boundary(buffer, size);
+        if (parser_data->body == buffer && !mapped)
+            buffer[size] = '\0';
+        parser_data->docinfo->truncated = SWISH_TRUE;
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+            SWISH_DEBUG_MSG("%s truncated to %d bytes", parser_data->docinfo->uri, size);
+    }
+
+/*
+* the manifest and dedup share one hash of the body.
+* a file that was only touched since the manifest was written hashes
+* the same. it stays in the index as it is, so don't parse it.
+*/
+    dedup = parser_data->s3->dedup != NULL && !parser_data->is_xinclude;
+    if (parser_data->want_hash || dedup)
+        parser_data->content_hash = swish_hash64(buffer, (size_t)size, 0);
+
+    if (parser_data->want_hash) {
+        if (swish_manifest_same_content(parser_data->s3->manifest,
+                                        parser_data->docinfo->uri,
+                                        parser_data->content_hash)) {
+            parser_data->unchanged = SWISH_TRUE;
+            free_body(parser_data);
+            SWISH_TRACE_EVENT(SWISH_TRACE_DOC_END, parser_data->docinfo->uri, 0);
+            perf_phase(parser_data, prev_phase);
+            swish_mem_leave(prev_mem);
+            return 0;
+        }
+    }
+
+/*
+* whatever its name says, a body that sniffs as binary would only feed
+* the parser noise. the handler gets an empty doc with docinfo->binary
+* set, and can hand the file to a filter instead.
+*/
+    if (parser_data->s3->config->flags->skip_binary) {
+        parser_data->docinfo->binary = swish_mime_sniff_binary(buffer, size);
+        if (parser_data->docinfo->binary != NULL) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+                SWISH_DEBUG_MSG("%s skipped: %s", parser_data->docinfo->uri,
+                                parser_data->docinfo->binary);
+            free_body(parser_data);
+            SWISH_TRACE_EVENT(SWISH_TRACE_DOC_END, parser_data->docinfo->uri, 0);
+            perf_phase(parser_data, prev_phase);
+            swish_mem_leave(prev_mem);
+            return 0;
+        }
+    }
+
+/*
+* seen these exact bytes before? then the handler gets an empty doc
+* with docinfo->duplicate_of set, and we skip parsing it again.
+*/
+    if (dedup) {
+        const xmlChar *dup;
+
+        dup = swish_dedup_check(parser_data->s3->dedup, parser_data->content_hash,
+                                (size_t)size, parser_data->docinfo->uri);
+        if (dup != NULL) {
+            parser_data->docinfo->duplicate_of = swish_xstrdup(dup);
+            free_body(parser_data);
+            SWISH_TRACE_EVENT(SWISH_TRACE_DOC_END, parser_data->docinfo->uri, 0);
+            perf_phase(parser_data, prev_phase);
+            swish_mem_leave(prev_mem);
+            return 0;
         }
-        size = parser_data->docinfo->size;
     }
 
+    perf_phase(parser_data, SWISH_PERF_PARSE);
+
     if (parser[0] == 'H' || parser[0] == 'h') {
         parser_data->is_html = SWISH_TRUE;
         ret = html_parser(my_parser_ptr, parser_data, buffer, size);
@@ -1547,33 +2013,108 @@ docparser(
         SWISH_CROAK("no parser known for MIME '%s' parser '%s'", mime, parser);
     }
     
-    if (filename) {
-        //SWISH_DEBUG_MSG("freeing buffer for %s", filename);
-        swish_xfree(buffer);
-    }
+    free_body(parser_data);
 
+    SWISH_TRACE_EVENT(SWISH_TRACE_DOC_END, parser_data->docinfo->uri, ret);
+    perf_phase(parser_data, prev_phase);
+    swish_mem_leave(prev_mem);
     return ret;
 
 }
 
-static swish_ParserData *
-init_parser_data(
-    swish_3 *s3
+/*
+* charge the time since the last switch to the current phase
+* and start timing phase. returns the phase we left, so callers
+* can nest: prev = perf_phase(pd, X); ...; perf_phase(pd, prev);
+*/
+static swish_PerfPhase
+perf_phase(
+    swish_ParserData *parser_data,
+    swish_PerfPhase phase
 )
 {
+    swish_PerfPhase prev;
+    double now;
+
+    now = swish_time_monotonic();
+    prev = parser_data->phase;
+    parser_data->perf.time[prev] += now - parser_data->phase_start;
+    parser_data->phase_start = now;
+    parser_data->phase = phase;
+    return prev;
+}
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
-        SWISH_DEBUG_MSG("init parser_data");
-
-    swish_ParserData *ptr = (swish_ParserData *)swish_xmalloc(sizeof(swish_ParserData));
+static int
+log2_bucket(
+    double n
+)
+{
+    int i = 0;
 
-    ptr->s3 = s3;
-    ptr->s3->ref_cnt++;
+    while (n >= 2 && i < SWISH_PERF_HIST_SIZE - 1) {
+        n /= 2;
+        i++;
+    }
+    return i;
+}
 
-    ptr->meta_buf = xmlBufferCreateSize(SWISH_BUFFER_CHUNK_SIZE);
-    ptr->prop_buf = xmlBufferCreateSize(SWISH_BUFFER_CHUNK_SIZE);
+/*
+* pass the document to the handler, then add its counters
+* to the swish_3 totals
+*/
+static void
+call_handler(
+    swish_ParserData *parser_data
+)
+{
+    swish_PerfStats *perf = &parser_data->perf;
+    double total;
+    int i;
+
+    perf->bytes_in = parser_data->docinfo->size;
+    perf->tokens_out = parser_data->docinfo->nwords;
+
+    perf_phase(parser_data, SWISH_PERF_HANDLER);
+    (*parser_data->s3->parser->handler) (parser_data);
+    perf_phase(parser_data, SWISH_PERF_OTHER);
+
+    total = 0;
+    for (i = 0; i < SWISH_PERF_NPHASES; i++) {
+        total += perf->time[i];
+    }
+    perf->ndocs = 1;
+    perf->time_hist[log2_bucket(total * 1000000)]++;
+    perf->size_hist[log2_bucket((double)perf->bytes_in)]++;
+
+    swish_perf_add(&parser_data->s3->perf, perf);
+}
+
+static swish_ParserData *
+init_parser_data(
+    swish_3 *s3
+)
+{
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+        SWISH_DEBUG_MSG("init parser_data");
+
+    swish_ParserData *ptr = (swish_ParserData *)swish_xmalloc(sizeof(swish_ParserData));
+
+    ptr->s3 = s3;
+    ptr->s3->ref_cnt++;
+
+/*
+* start the clock. time before the first phase is 'other'.
+*/
+    swish_perf_reset(&ptr->perf);
+    ptr->phase = SWISH_PERF_OTHER;
+    ptr->phase_start = swish_time_monotonic();
+
+    ptr->meta_buf = xmlBufferCreateSize(SWISH_BUFFER_CHUNK_SIZE);
+    ptr->prop_buf = xmlBufferCreateSize(SWISH_BUFFER_CHUNK_SIZE);
 
     ptr->tag = NULL;
+    ptr->docinfo = NULL;
     ptr->token_iterator = swish_token_iterator_init(s3->analyzer);
     ptr->token_iterator->ref_cnt++;
     ptr->properties = swish_nb_init(s3->config->properties);
@@ -1588,29 +2129,42 @@ init_parser_data(
         s3->analyzer->tokenizer = (&swish_tokenize);
     }
 
+/*
+* everything with document lifetime comes from the arena.
+* a handler that wants to keep any of it past the handler
+* call should ref_cnt++ the arena and swish_arena_free() it later.
+* the arena emptied after the last document is used again, so
+* parsing does not cost an arena block per document.
+*/
+    if (s3->arena != NULL) {
+        ptr->arena = s3->arena;
+        s3->arena = NULL;
+    }
+    else {
+        ptr->arena = swish_arena_init(SWISH_ARENA_BLOCK_SIZE);
+    }
+    ptr->arena->ref_cnt++;
+
+/*
+* the strings a tag is baked from only live until open_tag() or
+* close_tag() returns. they share one arena per s3, marked and
+* released around each tag, XInclude children included.
+*/
+    if (s3->scratch == NULL) {
+        s3->scratch = swish_arena_init(SWISH_ARENA_BLOCK_SIZE);
+    }
+
 /*
 * prime the stacks 
 */
-    ptr->metastack = (swish_TagStack *)swish_xmalloc(sizeof(swish_TagStack));
-    ptr->metastack->name = "MetaStack";
-    ptr->metastack->head = NULL;
-    ptr->metastack->temp = NULL;
-    ptr->metastack->count = 0;
+    ptr->metastack = init_swishTagStack(ptr->arena, "MetaStack");
     push_tag_stack(ptr->metastack, (xmlChar *)SWISH_DEFAULT_METANAME,
                    (xmlChar *)SWISH_DEFAULT_METANAME, SWISH_DOM_CHAR);
 
-    ptr->propstack = (swish_TagStack *)swish_xmalloc(sizeof(swish_TagStack));
-    ptr->propstack->name = "PropStack";
-    ptr->propstack->head = NULL;
-    ptr->propstack->temp = NULL;
-    ptr->propstack->count = 0;
+    ptr->propstack = init_swishTagStack(ptr->arena, "PropStack");
     push_tag_stack(ptr->propstack, (xmlChar *)SWISH_DOM_STR, (xmlChar *)SWISH_DOM_STR, SWISH_DOM_CHAR);
     
-    ptr->domstack  = (swish_TagStack *)swish_xmalloc(sizeof(swish_TagStack));
-    ptr->domstack->name  = "DOMStack";
-    ptr->domstack->head  = NULL;
-    ptr->domstack->temp  = NULL;
-    ptr->domstack->count = 0;
+    ptr->domstack  = init_swishTagStack(ptr->arena, "DOMStack");
 
 /*
 * gets toggled per-tag 
@@ -1638,8 +2192,33 @@ init_parser_data(
 * vers > 2.6.16 
 */
     ptr->ctxt = NULL;
+    ptr->oldsax = NULL;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+/*
+* set by docparser()/xinclude_handler() while they own something
+* a croak would otherwise leak (see parse_document)
+*/
+    ptr->body = NULL;
+    ptr->body_len = 0;
+    ptr->body_mapped = SWISH_FALSE;
+    ptr->child = NULL;
+    ptr->error = 0;
+    ptr->is_xinclude = SWISH_FALSE;
+    ptr->xinclude_deps = NULL;
+    ptr->nxinclude_deps = 0;
+    ptr->want_hash = SWISH_FALSE;
+    ptr->content_hash = 0;
+    ptr->unchanged = SWISH_FALSE;
+    ptr->limits = NULL;
+    ptr->deadline = 0;
+
+/*
+* unknown until the first tag with attributes (see want_xml_attributes)
+*/
+    ptr->nmetanames = -1;
+    ptr->attr_metanames = SWISH_FALSE;
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("init done for parser_data");
     }
     
@@ -1647,6 +2226,28 @@ init_parser_data(
 
 }
 
+static swish_TagStack *
+init_swishTagStack(
+    swish_Arena *arena,
+    char *name
+)
+{
+    swish_TagStack *stack;
+
+    stack = swish_arena_alloc(arena, sizeof(swish_TagStack));
+    stack->name  = name;
+    stack->head  = NULL;
+    stack->temp  = NULL;
+    stack->free  = NULL;
+    stack->count = 0;
+    stack->arena = arena;
+    return stack;
+}
+
+/*
+* the stack, its tags and their string buffers all belong to the
+* arena, so there is nothing to free.
+*/
 static void
 free_swishTagStack(
     swish_TagStack *stack
@@ -1655,17 +2256,13 @@ free_swishTagStack(
     swish_Tag *st;
     
     while ((st = pop_tag_stack(stack)) != NULL) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("%s %d POP %s [%s] [%s]", stack->name,
                             stack->count, st->raw, st->baked, st->context);
-
-        free_swishTag(st);
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing stack %s", stack->name);
-
-    swish_xfree(stack);
 }
 
 static void
@@ -1674,9 +2271,21 @@ free_parser_data(
 )
 {
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData");
 
+/*
+* only set if a croak unwound out of an XInclude
+*/
+    swish_xinclude_deps_free(ptr->xinclude_deps, ptr->nxinclude_deps);
+
+    if (ptr->child != NULL) {
+        free_parser_data(ptr->child);
+        ptr->child = NULL;
+    }
+
+    free_body(ptr);
+
 /*
 * dec ref count for shared ptr 
 */
@@ -1691,54 +2300,77 @@ free_parser_data(
     
 /* free named buffers */
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData properties");
 
     ptr->properties->ref_cnt--;
     swish_nb_free(ptr->properties);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData metanames");
 
     ptr->metanames->ref_cnt--;
     swish_nb_free(ptr->metanames);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData xmlBuffer");
 
     xmlBufferFree(ptr->meta_buf);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+/*
+* release the arena in one go, unless the handler
+* claimed it (see init_parser_data). keep one for the next document.
+*/
+    ptr->arena->ref_cnt--;
+    if (ptr->arena->ref_cnt == 0 && ptr->s3->arena == NULL) {
+        swish_arena_reset(ptr->arena);
+        ptr->s3->arena = ptr->arena;
+    }
+    else if (ptr->arena->ref_cnt == 0) {
+        swish_arena_free(ptr->arena);
+    }
+    else if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
+        SWISH_DEBUG_MSG("arena kept by handler (ref_cnt %d)", ptr->arena->ref_cnt);
+    }
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData prop xmlBuffer");
 
     xmlBufferFree(ptr->prop_buf);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
-        SWISH_DEBUG_MSG("freeing swish_ParserData tag");
-
-    if (ptr->tag != NULL)
-        swish_xfree(ptr->tag);
+/*
+* ptr->tag is in the scratch arena. a croak can leave tags
+* marked, so empty it once the outermost document is done.
+*/
+    if (!ptr->is_xinclude)
+        swish_arena_reset(ptr->s3->scratch);
 
     if (ptr->ctxt != NULL) {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("freeing swish_ParserData libxml2 parser ctxt");
 
-        if (xmlStrEqual(ptr->docinfo->parser, (xmlChar *)SWISH_PARSER_XML))
-            xmlFreeParserCtxt(ptr->ctxt);
+/*
+* a croak mid-parse leaves our static SAX handler in place,
+* which libxml2 would try to free
+*/
+        if (ptr->oldsax != NULL)
+            ptr->ctxt->sax = ptr->oldsax;
 
-        if (xmlStrEqual(ptr->docinfo->parser, (xmlChar *)SWISH_PARSER_HTML))
+        if (ptr->is_html)
             htmlFreeParserCtxt(ptr->ctxt);
+        else
+            xmlFreeParserCtxt(ptr->ctxt);
     }
     else {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("swish_ParserData libxml2 parser ctxt already freed");
 
     }
 
     if (ptr->token_iterator != NULL) {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("free swish_ParserData TokenIterator");
 
         ptr->token_iterator->ref_cnt--;
@@ -1747,7 +2379,7 @@ free_parser_data(
 
     if (ptr->docinfo != NULL) {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("free swish_ParserData docinfo");
 
         ptr->docinfo->ref_cnt--;
@@ -1755,12 +2387,12 @@ free_parser_data(
 
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("freeing swish_ParserData ptr");
 
     swish_xfree(ptr);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("swish_ParserData all freed");
 }
 
@@ -1774,7 +2406,7 @@ buf_to_head(
     const xmlChar *newlines;
     HEAD *h;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("parsing head from buffer: %s", buf);
 
     h = swish_xmalloc(sizeof(HEAD));
@@ -1816,7 +2448,7 @@ buf_to_head(
 
             if (buf[k] == '\n' || buf[k] == '\0') {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO) {
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
                     SWISH_DEBUG_MSG("found blank header line at byte %d\n", k);
                 }
                 
@@ -1832,7 +2464,7 @@ buf_to_head(
     swish_xfree(line);
 
     /* sanity check */
-    if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
         SWISH_DEBUG_MSG("finished parsing head from buffer");
         newlines = xmlStrstr((const xmlChar*)buf, (const xmlChar*)"\n\n");
         if (newlines != NULL) {
@@ -1845,26 +2477,27 @@ buf_to_head(
     return h;
 }
 
-static swish_DocInfo *
+/*
+* fills in info as it goes, so whatever was parsed before a croak
+* (e.g. Content-Length) is still there for the caller to use.
+*/
+static void
 head_to_docinfo(
-    HEAD * h
+    HEAD * h,
+    swish_DocInfo *info
 )
 {
     int i;
     xmlChar *val, *line;
 
-    swish_DocInfo *info = swish_docinfo_init();
-
-    info->ref_cnt++;
-
-    if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO))
         SWISH_DEBUG_MSG("preparing to parse %d header lines", h->nlines);
 
     for (i = 0; i < h->nlines; i++) {
 
         line = h->lines[i];
 
-        if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO))
             SWISH_DEBUG_MSG("parsing header line: >%s<", line);
 
         val = (xmlChar *)xmlStrchr(line, ':');
@@ -1873,7 +2506,7 @@ head_to_docinfo(
         }
         val = swish_str_skip_ws(++val);
 
-        if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
             SWISH_DEBUG_MSG("%d parsing header line: %s", i, line);
 
         }
@@ -2021,10 +2654,200 @@ head_to_docinfo(
 
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
         SWISH_DEBUG_MSG("returning %d header lines", h->nlines);
         swish_docinfo_debug(info);
     }
+}
+
+/*
+* headers for the doc in parser_data. h may be NULL when the docinfo
+* came from a binary frame and only needs checking. in recover mode a
+* croak (bad header line, missing or zero Content-Length) fails the doc
+* like parse_document() does, instead of exiting.
+*/
+static int
+read_docinfo(
+    swish_ParserData *parser_data,
+    HEAD * h
+)
+{
+    swish_Parser *parser = parser_data->s3->parser;
+    swish_ErrorFrame frame;
+    swish_MemSubsystem prev_mem;
+    xmlChar *uri;
+
+    if (parser_data->docinfo == NULL) {
+        parser_data->docinfo = swish_docinfo_init();
+        parser_data->docinfo->ref_cnt++;
+    }
+
+    if (!parser->recover) {
+        if (h != NULL)
+            head_to_docinfo(h, parser_data->docinfo);
+        swish_docinfo_check(parser_data->docinfo, parser_data->s3->config);
+        return 0;
+    }
+
+    prev_mem = swish_mem_enter(SWISH_MEM_OTHER);
+    swish_error_push(&frame);
+
+    if (setjmp(frame.env)) {
+        swish_mem_leave(prev_mem);
+
+        parser_data->error = SWISH_ERR_DOC_FAILED;
+        parser->error = SWISH_ERR_DOC_FAILED;
+        if (parser->error_msg != NULL)
+            swish_xfree(parser->error_msg);
+        parser->error_msg = swish_xstrdup((xmlChar *)frame.msg);
+        parser->nfailed++;
+
+        uri = parser_data->docinfo->uri;
+        SWISH_WARN("Skipping %s: %s", uri ? (char *)uri : "document", frame.msg);
+        return SWISH_ERR_DOC_FAILED;
+    }
+
+    if (h != NULL)
+        head_to_docinfo(h, parser_data->docinfo);
+    swish_docinfo_check(parser_data->docinfo, parser_data->s3->config);
+
+    swish_error_pop(&frame);
+    swish_mem_leave(prev_mem);
+    return 0;
+}
+
+/*
+* true if line starts with one of the headers head_to_docinfo() knows.
+* used to find the next doc after one whose body length is unknown.
+*/
+static int
+is_header_line(
+    xmlChar *line
+)
+{
+    static const char *names[] = {
+        "Content-Length:", "Content-Location:", "Content-Type:",
+        "Last-Modified:", "Last-Mtime:", "Path-Name:", "Document-Type:",
+        "Parser-Type:", "Encoding:", "Charset:", "Action:", NULL
+    };
+    int i;
+
+    for (i = 0; names[i] != NULL; i++) {
+        if (!xmlStrncasecmp(line, (const xmlChar *)names[i], strlen(names[i])))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+* read a big-endian unsigned int of nbytes from fh
+*/
+static unsigned long
+read_frame_uint(
+    FILE * fh,
+    int nbytes
+)
+{
+    unsigned char bytes[8];
+    unsigned long val;
+    int i;
+
+    if (fread(bytes, 1, nbytes, fh) != (size_t)nbytes)
+        SWISH_CROAK("short read in frame header from filehandle");
+
+    val = 0;
+    for (i = 0; i < nbytes; i++) {
+        val = (val << 8) | bytes[i];
+    }
+    return val;
+}
+
+/*
+* read a length-prefixed string. zero length means "not set"
+* and returns NULL.
+*/
+static xmlChar *
+read_frame_string(
+    FILE * fh
+)
+{
+    unsigned long len;
+    xmlChar *str;
+
+    len = read_frame_uint(fh, SWISH_FRAME_STRLEN_BYTES);
+    if (!len)
+        return NULL;
+
+    str = swish_xmalloc(len + 1);
+    if (fread(str, 1, len, fh) != len) {
+        swish_xfree(str);
+        SWISH_CROAK("short read in frame header string from filehandle");
+    }
+
+    str[len] = '\0';
+    return str;
+}
+
+/*
+* returns NULL on clean EOF at a record boundary
+*/
+static swish_DocInfo *
+frame_to_docinfo(
+    FILE * fh
+)
+{
+    char magic[SWISH_FRAME_MAGIC_LEN];
+    size_t nread;
+    int parser_type;
+    swish_DocInfo *info;
+    xmlChar *str;
+
+    nread = fread(magic, 1, SWISH_FRAME_MAGIC_LEN, fh);
+    if (nread == 0 && feof(fh))
+        return NULL;
+
+    if (nread != SWISH_FRAME_MAGIC_LEN
+        || memcmp(magic, SWISH_FRAME_MAGIC, SWISH_FRAME_MAGIC_LEN))
+        SWISH_CROAK("bad frame magic reading from filehandle");
+
+    info = swish_docinfo_init();
+    info->ref_cnt++;
+
+    info->size = (off_t) read_frame_uint(fh, 8);
+    info->mtime = (time_t) read_frame_uint(fh, 8);
+
+    parser_type = fgetc(fh);
+    switch (parser_type) {
+    case 0:
+        break;                  /* let swish_docinfo_check() decide */
+    case 'H':
+        info->parser = swish_xstrdup((xmlChar *)SWISH_PARSER_HTML);
+        break;
+    case 'X':
+        info->parser = swish_xstrdup((xmlChar *)SWISH_PARSER_XML);
+        break;
+    case 'T':
+        info->parser = swish_xstrdup((xmlChar *)SWISH_PARSER_TXT);
+        break;
+    case EOF:
+        SWISH_CROAK("short read in frame header from filehandle");
+        break;
+    default:
+        SWISH_CROAK("unknown parser type 0x%02x in frame header", parser_type);
+    }
+
+    info->uri = read_frame_string(fh);
+    info->mime = read_frame_string(fh);
+    str = read_frame_string(fh);
+    if (str != NULL) {
+        swish_xfree(info->encoding);
+        info->encoding = str;
+    }
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
+        SWISH_DEBUG_MSG("parsed frame header");
+        swish_docinfo_debug(info);
+    }
 
     return info;
 }
@@ -2044,6 +2867,14 @@ get_env_vars(
     if (SWISH_DEBUG) {
         SWISH_PARSER_WARNINGS = SWISH_DEBUG;
     }
+
+    if (getenv("SWISH_MMAP_THRESHOLD") != NULL) {
+        SWISH_MMAP_MIN = swish_string_to_int(getenv("SWISH_MMAP_THRESHOLD"));
+    }
+
+    if (getenv("SWISH_XINCLUDE_CACHE_SIZE") != NULL) {
+        SWISH_XINCLUDE_CACHE_MAX = swish_string_to_int(getenv("SWISH_XINCLUDE_CACHE_SIZE"));
+    }
     
 }
 
@@ -2061,6 +2892,7 @@ swish_parse_fh(
     swish_ParserData *parser_data;
     int xmlErr;
     int min_headers, nheaders;
+    int resync;
     double curTime;
     char *etime;
     unsigned int file_cnt;
@@ -2068,6 +2900,7 @@ swish_parse_fh(
     i = 0;
     file_cnt = 0;
     nheaders = 0;
+    resync = 0;
     min_headers = 2;
 
     if (fh == NULL)
@@ -2103,6 +2936,12 @@ swish_parse_fh(
             *end = '\0';
         }
 
+        if (resync) {
+            if (!is_header_line(line))
+                continue;
+            resync = 0;
+        }
+
         if (nheaders >= min_headers && xmlStrlen(line) == 0) {
 
 /*
@@ -2111,25 +2950,58 @@ swish_parse_fh(
             curTime = swish_time_elapsed();
             parser_data = init_parser_data(s3);
             head = buf_to_head((xmlChar *)xmlBufferContent(head_buf));
-            parser_data->docinfo = head_to_docinfo(head);
-            swish_docinfo_check(parser_data->docinfo, s3->config);
 
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+/*
+* bad headers: skip the body if we know how long it is,
+* else drop lines until the next header block.
+*/
+            if (read_docinfo(parser_data, head)) {
+                if (parser_data->docinfo->size > 0) {
+                    read_buffer =
+                        swish_io_slurp_fh(fh, parser_data->docinfo->size, SWISH_FALSE);
+                    swish_xfree(read_buffer);
+                }
+                else {
+                    resync = 1;
+                }
+                free_parser_data(parser_data);
+                free_head(head);
+                xmlBufferEmpty(head_buf);
+                nheaders = 0;
+                continue;
+            }
+
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                 SWISH_DEBUG_MSG("reading %ld bytes from filehandle",
                                 (long int)parser_data->docinfo->size);
 
+            perf_phase(parser_data, SWISH_PERF_READ);
             read_buffer = swish_io_slurp_fh(fh, parser_data->docinfo->size, SWISH_FALSE);
+            perf_phase(parser_data, SWISH_PERF_OTHER);
 
 /*
 * parse 
 */
             xmlErr =
-                docparser(parser_data, NULL, read_buffer, parser_data->docinfo->size);
+                parse_document(parser_data, NULL, read_buffer, parser_data->docinfo->size);
+
+/*
+* the body has already been read, so the stream is still
+* in step. drop this doc and go on to the next one.
+*/
+            if (parser_data->error) {
+                swish_xfree(read_buffer);
+                free_parser_data(parser_data);
+                free_head(head);
+                xmlBufferEmpty(head_buf);
+                nheaders = 0;
+                continue;
+            }
 
             if (xmlErr)
                 SWISH_WARN("parser returned error %d", xmlErr);
 
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG
                     ("\n===============================================================\n");
                 swish_docinfo_debug(parser_data->docinfo);
@@ -2137,15 +3009,15 @@ swish_parse_fh(
                                 xmlBufferLength(parser_data->meta_buf));
                 SWISH_DEBUG_MSG(" (%d words)", parser_data->docinfo->nwords);
             }
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                 SWISH_DEBUG_MSG("passing to handler");
 
 /*
 * pass to callback function 
 */
-            (*s3->parser->handler) (parser_data);
+            call_handler(parser_data);
 
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                 SWISH_DEBUG_MSG("handler done");
 
 /*
@@ -2174,14 +3046,21 @@ swish_parse_fh(
 */
             curTime = swish_time_elapsed();
 
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                 SWISH_DEBUG_MSG
                     ("\n================ filehandle - done with file ===================\n");
 
         }
         else if (xmlStrlen(line) == 0) {
 
-            SWISH_CROAK("Not enough header lines reading from filehandle");
+            if (!s3->parser->recover)
+                SWISH_CROAK("Not enough header lines reading from filehandle");
+
+            SWISH_WARN("Not enough header lines reading from filehandle");
+            s3->parser->nfailed++;
+            xmlBufferEmpty(head_buf);
+            nheaders = 0;
+            resync = 1;
 
         }
         else {
@@ -2197,7 +3076,7 @@ swish_parse_fh(
 
             nheaders++;
             
-            if (SWISH_DEBUG & SWISH_DEBUG_DOCINFO) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_DOCINFO)) {
                 SWISH_DEBUG_MSG("nheaders = %d for buffer >%s<", 
                     nheaders, xmlBufferContent(head_buf));
             }
@@ -2215,6 +3094,93 @@ swish_parse_fh(
     return file_cnt;
 }
 
+/*
+* like swish_parse_fh() but each doc is preceded by a binary
+* frame header instead of HTTP-style text headers. See libswish3.h.
+*/
+unsigned int
+swish_parse_fh_framed(
+    swish_3 *s3,
+    FILE * fh
+)
+{
+    xmlChar *read_buffer;
+    swish_ParserData *parser_data;
+    swish_DocInfo *docinfo;
+    int xmlErr;
+    double curTime;
+    char *etime;
+    unsigned int file_cnt;
+
+    file_cnt = 0;
+
+    if (fh == NULL)
+        fh = stdin;
+
+    curTime = swish_time_elapsed();
+
+    while ((docinfo = frame_to_docinfo(fh)) != NULL) {
+
+        parser_data = init_parser_data(s3);
+        parser_data->docinfo = docinfo;
+
+/* the frame always carries the body length, so skipping is easy */
+        if (read_docinfo(parser_data, NULL)) {
+            if (parser_data->docinfo->size > 0) {
+                read_buffer =
+                    swish_io_slurp_fh(fh, parser_data->docinfo->size, SWISH_FALSE);
+                swish_xfree(read_buffer);
+            }
+            free_parser_data(parser_data);
+            curTime = swish_time_elapsed();
+            continue;
+        }
+
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+            SWISH_DEBUG_MSG("reading %ld bytes from filehandle",
+                            (long int)parser_data->docinfo->size);
+
+        perf_phase(parser_data, SWISH_PERF_READ);
+        read_buffer = swish_io_slurp_fh(fh, parser_data->docinfo->size, SWISH_FALSE);
+        perf_phase(parser_data, SWISH_PERF_OTHER);
+
+        xmlErr = parse_document(parser_data, NULL, read_buffer, parser_data->docinfo->size);
+
+        if (parser_data->error) {
+            swish_xfree(read_buffer);
+            free_parser_data(parser_data);
+            curTime = swish_time_elapsed();
+            continue;
+        }
+
+        if (xmlErr)
+            SWISH_WARN("parser returned error %d", xmlErr);
+
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
+            swish_docinfo_debug(parser_data->docinfo);
+            SWISH_DEBUG_MSG("  word buffer length: %d bytes",
+                            xmlBufferLength(parser_data->meta_buf));
+            SWISH_DEBUG_MSG(" (%d words)", parser_data->docinfo->nwords);
+        }
+
+        call_handler(parser_data);
+
+        swish_xfree(read_buffer);
+        free_parser_data(parser_data);
+
+        file_cnt++;
+
+        if (SWISH_DEBUG) {
+            etime = swish_time_print_fine(swish_time_elapsed() - curTime);
+            SWISH_DEBUG_MSG("%s elapsed time", etime);
+            swish_xfree(etime);
+        }
+        curTime = swish_time_elapsed();
+    }
+
+    return file_cnt;
+}
+
 static void
 free_head(
     HEAD * h
@@ -2251,13 +3217,16 @@ swish_parse_buffer(
 
     head = buf_to_head(buf);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("number of headlines: %d", head->nlines);
 
     swish_ParserData *parser_data = init_parser_data(s3);
 
-    parser_data->docinfo = head_to_docinfo(head);
-    swish_docinfo_check(parser_data->docinfo, s3->config);
+    if (read_docinfo(parser_data, head)) {
+        free_head(head);
+        free_parser_data(parser_data);
+        return SWISH_ERR_DOC_FAILED;
+    }
 
 /*
 * reposition buf pointer at start of body (just past head) 
@@ -2265,14 +3234,20 @@ swish_parse_buffer(
 
     buf += head->body_start;
 
-    res = docparser(parser_data, 0, buf, xmlStrlen(buf));
+    res = parse_document(parser_data, 0, buf, xmlStrlen(buf));
+
+    if (parser_data->error) {
+        free_head(head);
+        free_parser_data(parser_data);
+        return SWISH_ERR_DOC_FAILED;
+    }
 
 /*
 * pass to callback function 
 */
-    (*s3->parser->handler) (parser_data);
+    call_handler(parser_data);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         swish_docinfo_debug(parser_data->docinfo);
         SWISH_DEBUG_MSG("  word buffer length: %d bytes",
                         xmlBufferLength(parser_data->meta_buf));
@@ -2308,26 +3283,70 @@ swish_parse_file(
     int res;
     double curTime = swish_time_elapsed();
     char *etime;
+    struct stat st;
+    swish_ParserData *parser_data;
 
-    swish_ParserData *parser_data = init_parser_data(s3);
+/*
+* a shard takes its files by path, so the split is even
+* however the paths were given (one directory or many files)
+*/
+    if (s3->nshards > 1
+        && swish_hash64(filename, xmlStrlen(filename), 0) % s3->nshards != (uint64_t)s3->shard)
+        return SWISH_ERR_DOC_OTHER_SHARD;
+
+/*
+* with a manifest, a file that stat()s the same as last run is not
+* even opened
+*/
+    if (s3->manifest != NULL) {
+        if (stat((char *)filename, &st)) {
+            SWISH_WARN("Can't stat '%s': %s", filename, strerror(errno));
+            return SWISH_ERR_NO_SUCH_FILE;
+        }
+        if (swish_manifest_unchanged(s3->manifest, filename, &st))
+            return SWISH_ERR_DOC_UNCHANGED;
+    }
+
+    parser_data = init_parser_data(s3);
 
     parser_data->docinfo = swish_docinfo_init();
     parser_data->docinfo->ref_cnt++;
 
     if (!swish_docinfo_from_filesystem(filename, parser_data->docinfo, parser_data)) {
         SWISH_WARN("Skipping %s", filename);
+        if (s3->manifest != NULL)
+            swish_manifest_keep(s3->manifest, filename);
         free_parser_data(parser_data);
         return SWISH_ERR_NO_SUCH_FILE;
     }
 
-    res = docparser(parser_data, filename, 0, 0);
+    parser_data->want_hash = s3->manifest != NULL;
+    res = parse_document(parser_data, filename, 0, 0);
+
+/* a file that is there but failed is not a deleted one */
+    if (parser_data->error) {
+        if (s3->manifest != NULL)
+            swish_manifest_keep(s3->manifest, filename);
+        free_parser_data(parser_data);
+        return SWISH_ERR_DOC_FAILED;
+    }
+
+    if (s3->manifest != NULL) {
+        swish_manifest_update(s3->manifest, filename, &st, parser_data->content_hash);
+        if (parser_data->unchanged) {
+            s3->manifest->unchanged++;
+            free_parser_data(parser_data);
+            return SWISH_ERR_DOC_UNCHANGED;
+        }
+        s3->manifest->changed++;
+    }
 
 /*
 * pass to callback function 
 */
-    (*s3->parser->handler) (parser_data);
+    call_handler(parser_data);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         swish_docinfo_debug(parser_data->docinfo);
         SWISH_DEBUG_MSG("  word buffer length: %d bytes",
                         xmlBufferLength(parser_data->meta_buf));
@@ -2339,7 +3358,7 @@ swish_parse_file(
 */
     free_parser_data(parser_data);
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         etime = swish_time_print_fine(swish_time_elapsed() - curTime);
         SWISH_DEBUG_MSG("%s elapsed time", etime);
         swish_xfree(etime);
@@ -2472,6 +3491,7 @@ xml_parser(
     oldsax = ctxt->sax;
     ctxt->sax = sax;
     ctxt->sax2 = 1;
+    parser_data->oldsax = oldsax;
 
 /*
 * always use sax2 -- this pulled from xmlDetextSAX2() 
@@ -2502,12 +3522,13 @@ xml_parser(
    gets freed.
 */
     parser_data->ctxt = ctxt;
-    if (xmlParseDocument(ctxt) < 0) {
+    if (xmlParseDocument(ctxt) < 0 && !parser_data->docinfo->truncated) {
         SWISH_WARN("recovering from libxml2 error for %s", parser_data->docinfo->uri);
     }
     parser_data->ctxt = NULL;
+    parser_data->oldsax = NULL;
 
-    if (ctxt->wellFormed) {
+    if (ctxt->wellFormed || parser_data->docinfo->truncated) {
         ret = 0;
     }
     else {
@@ -2551,7 +3572,7 @@ html_parser(
 
     xmlInitParser();
 
-    ctxt = htmlCreateMemoryParserCtxt((const char *)buffer, xmlStrlen(buffer));
+    ctxt = htmlCreateMemoryParserCtxt((const char *)buffer, size);
 
     if (ctxt == 0) {
         return (0);
@@ -2566,7 +3587,7 @@ html_parser(
     parser_data->docinfo->encoding = document_encoding(ctxt);
         
     if (parser_data->docinfo->encoding == NULL) {
-        set_encoding(parser_data, (xmlChar *)buffer);
+        set_encoding(parser_data, (xmlChar *)buffer, size);
     }
     
     /*
@@ -2584,9 +3605,12 @@ html_parser(
         oldsax = ctxt->sax;
         ctxt->sax = (htmlSAXHandlerPtr) sax;
         ctxt->userData = parser_data;
+        parser_data->oldsax = oldsax;
     }
     
     ret = htmlParseDocument(ctxt);
+    if (parser_data->docinfo->truncated)
+        ret = 0;
 
     if (sax != 0) {
         ctxt->sax = oldsax;
@@ -2604,73 +3628,23 @@ txt_parser(
 )
 {
     int err = 0;
-    xmlChar *out, *enc;
-    int outlen;
+    xmlChar *enc;
+    swish_PerfPhase prev_phase;
 
-    out = NULL;
     enc = (xmlChar *)getenv("SWISH_ENCODING");
-    outlen = 0;
 
 /*
-* TODO better encoding detection. for now we assume unknown text
-* files are latin1 
+* an explicit non-UTF-8 Encoding/Charset header wins. Otherwise sniff
+* the start of the buffer and fall back to SWISH_ENCODING.
 */
-    set_encoding(parser_data, buffer);
+    if (parser_data->docinfo->encoding == NULL
+        || !xmlStrcasecmp(parser_data->docinfo->encoding, (xmlChar *)SWISH_DEFAULT_ENCODING)) {
+        set_encoding(parser_data, buffer, size);
+    }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("txt parser encoding: %s", parser_data->docinfo->encoding);
 
-    if (!xmlStrEqual(parser_data->docinfo->encoding, (xmlChar *)SWISH_DEFAULT_ENCODING)) {
-        SWISH_WARN("%s docinfo->encoding %s != %s", 
-            parser_data->docinfo->uri, parser_data->docinfo->encoding, SWISH_DEFAULT_ENCODING);
-
-        if (!xmlStrncasecmp(parser_data->docinfo->encoding, (xmlChar *)SWISH_LATIN1_ENCODING, 9)) {
-            outlen = size * 2;
-            out = swish_xmalloc(outlen);
-
-            if (!isolat1ToUTF8(out, &outlen, buffer, &size)) {
-                SWISH_WARN("could not convert buf from %s (outlen: %d)", SWISH_LATIN1_ENCODING, outlen);
-            }
-            else {
-                SWISH_WARN("converted %s from %s to %s", 
-                    parser_data->docinfo->uri, SWISH_LATIN1_ENCODING, SWISH_DEFAULT_ENCODING);
-            }
-            
-            size = outlen;
-            buffer = out;
-        }
-
-        else if (xmlStrEqual(parser_data->docinfo->encoding, enc)) {
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
-                SWISH_DEBUG_MSG("default env encoding -> %s", enc);
-
-            if (xmlStrncasecmp(enc, (xmlChar *)SWISH_LATIN1_ENCODING, 9)) {
-                SWISH_WARN
-                    ("%s encoding is unknown (not %s) but LC_CTYPE is %s -- assuming file is %s",
-                     parser_data->docinfo->uri, SWISH_DEFAULT_ENCODING, enc, SWISH_LATIN1_ENCODING);
-
-            }
-
-            outlen = size * 2;
-            out = swish_xmalloc(outlen);
-
-            if (!isolat1ToUTF8(out, &outlen, buffer, &size)) {
-                SWISH_WARN("could not convert buf from %s (outlen: %d): %s", 
-                    SWISH_LATIN1_ENCODING, outlen, buffer);
-                swish_xfree(out);
-                return SWISH_ENCODING_ERROR;
-            }
-            else {
-                SWISH_WARN("converted %s from %s to %s", 
-                    parser_data->docinfo->uri, SWISH_LATIN1_ENCODING, SWISH_DEFAULT_ENCODING);
-            }
-
-            size = outlen;
-            buffer = out;
-
-        }
-    }
-
 /*
 * we obviously haven't any tags on which to trigger our metanames,
 * so set default
@@ -2680,10 +3654,42 @@ txt_parser(
     push_tag_stack(parser_data->metastack, (xmlChar *)SWISH_DEFAULT_METANAME,
                    (xmlChar *)SWISH_DEFAULT_METANAME, SWISH_DOM_CHAR);
                    
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("%s stack PUSH %s", parser_data->metastack->head->context);
 
-    buffer_characters(parser_data, buffer, size);
+    if (!xmlStrcasecmp(parser_data->docinfo->encoding, (xmlChar *)SWISH_DEFAULT_ENCODING)) {
+        buffer_characters(parser_data, buffer, size);
+    }
+    else {
+        SWISH_WARN("%s docinfo->encoding %s != %s", 
+            parser_data->docinfo->uri, parser_data->docinfo->encoding, SWISH_DEFAULT_ENCODING);
+
+        prev_phase = perf_phase(parser_data, SWISH_PERF_ENCODING);
+        err = txt_transcode(parser_data, buffer, size,
+                            (const char *)parser_data->docinfo->encoding);
+
+/*
+* iconv does not know the encoding. Assume Latin-1, like Swish-e 2.x.
+*/
+        if (err == -1) {
+            SWISH_WARN
+                ("%s encoding %s is unknown -- assuming file is %s",
+                 parser_data->docinfo->uri, parser_data->docinfo->encoding, 
+                 SWISH_LATIN1_ENCODING);
+            err = txt_transcode(parser_data, buffer, size, SWISH_LATIN1_ENCODING);
+        }
+        perf_phase(parser_data, prev_phase);
+        if (err) {
+            SWISH_WARN("could not convert %s from %s", 
+                parser_data->docinfo->uri, parser_data->docinfo->encoding);
+            return SWISH_ENCODING_ERROR;
+        }
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
+            SWISH_DEBUG_MSG("converted %s from %s to %s (env %s)",
+                parser_data->docinfo->uri, parser_data->docinfo->encoding,
+                SWISH_DEFAULT_ENCODING, enc);
+        }
+    }
     flush_buffer(parser_data, (xmlChar *)SWISH_DEFAULT_METANAME,
                  (xmlChar *)SWISH_DEFAULT_METANAME);
 
@@ -2691,43 +3697,125 @@ txt_parser(
     push_tag_stack(parser_data->metastack, (xmlChar *)SWISH_TITLE_METANAME,
                    (xmlChar *)SWISH_TITLE_METANAME, SWISH_DOM_CHAR);
                    
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
         SWISH_DEBUG_MSG("%s stack PUSH %s", parser_data->metastack->head->context);
 
     buffer_characters(parser_data, parser_data->docinfo->uri, xmlStrlen(parser_data->docinfo->uri));
     flush_buffer(parser_data, (xmlChar *)SWISH_TITLE_METANAME,
                  (xmlChar *)SWISH_TITLE_METANAME);
 
-/* clean up */
-    if (out != NULL) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
-            SWISH_DEBUG_MSG("tmp text buffer being freed");
+    return err;
+}
 
-        swish_xfree(out);
+/*
+* convert buffer from encoding to UTF-8 a chunk at a time, handing each
+* chunk to buffer_characters(). Returns -1 if encoding is unknown.
+* Bytes that are illegal in encoding are skipped.
+*/
+static int
+txt_transcode(
+    swish_ParserData *parser_data,
+    xmlChar *buffer,
+    int size,
+    const char *encoding
+)
+{
+    iconv_t cd;
+    char out[SWISH_BUFFER_CHUNK_SIZE];
+    char *inbuf, *outbuf;
+    size_t inleft, outleft;
+    int nbad;
+
+    cd = iconv_open(SWISH_DEFAULT_ENCODING, encoding);
+    if (cd == (iconv_t)-1) {
+        return -1;
     }
 
-    return err;
+    inbuf = (char *)buffer;
+    inleft = (size_t)size;
+    nbad = 0;
+
+    while (inleft > 0) {
+        outbuf = out;
+        outleft = sizeof(out);
+
+        if (iconv(cd, &inbuf, &inleft, &outbuf, &outleft) == (size_t)-1) {
+            if (errno == EILSEQ) {
+                inbuf++;
+                inleft--;
+                nbad++;
+            }
+            else if (errno == EINVAL) {
+                inleft = 0;     /* truncated sequence at end of buffer */
+                nbad++;
+            }
+            else if (errno != E2BIG) {
+                iconv_close(cd);
+                return 1;
+            }
+        }
+
+        if (outbuf > out)
+            buffer_characters(parser_data, (xmlChar *)out, (int)(outbuf - out));
+    }
+
+    iconv_close(cd);
+
+    if (nbad) {
+        SWISH_WARN("skipped %d bytes in %s not valid in %s", 
+            nbad, parser_data->docinfo->uri, encoding);
+    }
+
+    return 0;
+}
+
+/*
+* is the first SWISH_ENCODING_SNIFF_LEN bytes of buffer valid UTF-8?
+* a multibyte char cut off by the end of the window is allowed.
+*/
+static boolean
+prefix_is_utf8(
+    xmlChar *buffer,
+    int size
+)
+{
+    int i, n, len;
+
+    n = size < SWISH_ENCODING_SNIFF_LEN ? size : SWISH_ENCODING_SNIFF_LEN;
+    i = 0;
+    while (i < n) {
+        if (buffer[i] < 0x80) {
+            i++;
+            continue;
+        }
+        len = n - i;
+        if (xmlGetUTF8Char(buffer + i, &len) < 0) {
+            return (n < size && n - i < 4) ? SWISH_TRUE : SWISH_FALSE;
+        }
+        i += len;
+    }
+    return SWISH_TRUE;
 }
 
 static void
 set_encoding(
     swish_ParserData *parser_data,
-    xmlChar *buffer
+    xmlChar *buffer,
+    int size
 )
 {
+    swish_PerfPhase prev_phase;
 
-/*
-* this feels like it doesn't work ... would iconv() be better ? 
-*/
-
+    prev_phase = perf_phase(parser_data, SWISH_PERF_ENCODING);
     swish_xfree(parser_data->docinfo->encoding);
 
-    if (xmlCheckUTF8((const xmlChar *)buffer) != 0) {
+    if (prefix_is_utf8(buffer, size)) {
         parser_data->docinfo->encoding = swish_xstrdup((xmlChar *)SWISH_DEFAULT_ENCODING);
     }
     else {
         parser_data->docinfo->encoding = swish_xstrdup((xmlChar *)getenv("SWISH_ENCODING"));
     }
+    perf_phase(parser_data, prev_phase);
 }
 
 static xmlChar *
@@ -2768,6 +3856,10 @@ tokenize(
 )
 {
     swish_MetaName *meta;
+    swish_MemSubsystem prev_mem;
+    swish_PerfPhase prev_phase;
+    int ntokens;
+    unsigned int before;
 
     meta = swish_hash_fetch(parser_data->s3->config->metanames, metaname);
 
@@ -2780,9 +3872,18 @@ tokenize(
     if (context == NULL)
         context = parser_data->metastack->head->context;
 
-    parser_data->docinfo->nwords +=
-            (*parser_data->s3->analyzer->tokenizer) (parser_data->token_iterator, 
-                                                    string, meta, context);
+    prev_mem = swish_mem_enter(SWISH_MEM_TOKENIZER);
+    prev_phase = perf_phase(parser_data, SWISH_PERF_TOKENIZE);
+    before = parser_data->token_iterator->tl->n;
+    ntokens = (*parser_data->s3->analyzer->tokenizer) (parser_data->token_iterator, 
+                                                      string, meta, context);
+/* the tokenizer counts tokens add_token() dropped for max_tokens */
+    if (parser_data->token_iterator->tl->truncated)
+        ntokens = parser_data->token_iterator->tl->n - before;
+    parser_data->docinfo->nwords += ntokens;
+    SWISH_TRACE_EVENT(SWISH_TRACE_TOKENS, metaname, ntokens);
+    perf_phase(parser_data, prev_phase);
+    swish_mem_leave(prev_mem);
     return;
 
 }
@@ -2811,59 +3912,72 @@ _debug_stack(
     }
 }
 
+/* length of the context of baked with the tags below it on a stack */
+static int
+tag_context_len(
+    xmlChar *baked,
+    swish_Tag *below
+)
+{
+    int size;
+
+    size = xmlStrlen(baked);
+    for (; below != NULL; below = below->next) {
+        size += xmlStrlen(below->baked) + 1;
+    }
+    return size;
+}
+
 /* 
-* return stack as single string of joiner-separated names 
+* write that context to flat, size bytes plus a NUL, filling from the
+* right since the innermost tag is last.
+*/
+static void
+fill_tag_context(
+    xmlChar *flat,
+    int size,
+    xmlChar *baked,
+    swish_Tag *below,
+    char flatten_join
+)
+{
+    xmlChar *end;
+    int len;
+
+    end = flat + size;
+    *end = '\0';
+
+    len = xmlStrlen(baked);
+    end -= len;
+    memcpy(end, baked, len);
+
+    for (; below != NULL; below = below->next) {
+        *(--end) = flatten_join;
+        len = xmlStrlen(below->baked);
+        end -= len;
+        memcpy(end, below->baked, len);
+    }
+}
+
+/* 
+* return baked on top of stack as single string of joiner-separated names,
+* allocated from arena.
 */
 static xmlChar *
 flatten_tag_stack(
+    swish_Arena *arena,
     xmlChar *baked,
     swish_TagStack *stack,
     char flatten_join
 )
 {
-    xmlChar *tmp;
     xmlChar *flat;
     int size;
-    int i;
-
-    i = 0;
-    stack->temp = stack->head;
-
-    if (baked != NULL) {
-        flat = swish_xstrdup(baked);
-    }
-    else {
-        flat = swish_xstrdup(stack->head->baked);
-        stack->temp = stack->temp->next;
-    }
-
-    for (; stack->temp != NULL; stack->temp = stack->temp->next) {
-        size =
-            (
-            (xmlStrlen(flat)*sizeof(xmlChar)) + 
-            (xmlStrlen(stack->temp->baked)*sizeof(xmlChar)) +
-            3   // flatten_join + nulls
-            );
-            
-        tmp = swish_xmalloc(size);
-                
-        if (snprintf((char *)tmp, size, "%s%c%s",
-             (char *)stack->temp->baked, flatten_join, (char *)flat)
-            > 0
-        ) {
-            if (flat != NULL)
-                swish_xfree(flat);
-
-            flat = tmp;
-        }
-        else {
-            SWISH_CROAK("sprintf failed to concat %s -> %s", stack->temp->baked, flat);
-        }
-
-    }
 
+    size = tag_context_len(baked, stack->head);
+    flat = swish_arena_alloc(arena, size + 1);
+    fill_tag_context(flat, size, baked, stack->head, flatten_join);
     return flat;
-
 }
 static void
 add_stack_to_prop_buf(
@@ -2875,9 +3989,16 @@ add_stack_to_prop_buf(
     boolean cleanwsp;
     swish_Property *prop;
     xmlChar *prop_to_store;
+    xmlChar *str;
+    int len;
+    swish_PerfPhase prev_phase;
 
     stack = parser_data->propstack;
     cleanwsp = 1;
+    prop_to_store = NULL;
+
+    if (!xmlBufferLength(parser_data->prop_buf))
+        return;
     
     if (baked != NULL) {
         /* If the propertyname is an alias_for, use the target of the alias. */
@@ -2893,13 +4014,35 @@ add_stack_to_prop_buf(
         if (prop->verbatim) {
             cleanwsp = 0;
         }
-    
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    }
+
+/*
+* the same text goes to every property in the stack, so normalize
+* whitespace once here rather than once per swish_nb_add_str() call.
+*/
+    str = (xmlChar *)xmlBufferContent(parser_data->prop_buf);
+    if (swish_str_all_ws(str))
+        return;
+
+    if (cleanwsp) {
+        swish_str_ctrl_to_ws(str);
+        str = swish_str_skip_ws(str);
+        swish_str_trim_ws(str);
+        len = xmlStrlen(str);
+    }
+    else {
+        len = xmlBufferLength(parser_data->prop_buf);
+    }
+
+    prev_phase = perf_phase(parser_data, SWISH_PERF_NAMEDBUFFER);
+
+    if (prop_to_store != NULL) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("adding property %s to buffer", prop_to_store);
         }
 
-        swish_nb_add_buf(parser_data->properties, prop_to_store, parser_data->prop_buf,
-                            (xmlChar *)SWISH_TOKENPOS_BUMPER, cleanwsp, 0);
+        swish_nb_add_str(parser_data->properties, prop_to_store, str, len,
+                            (xmlChar *)SWISH_TOKENPOS_BUMPER, 0, 0);
     }
 
     /* Swish-e 2.x behavior is to add for each member in the stack */
@@ -2907,35 +4050,14 @@ add_stack_to_prop_buf(
         if (xmlStrEqual(stack->temp->baked, (xmlChar *)SWISH_DOM_STR))
             continue;
 
-        swish_nb_add_buf(parser_data->properties, stack->temp->baked,
-                         parser_data->prop_buf, (xmlChar *)SWISH_TOKENPOS_BUMPER,
-                         cleanwsp, 0);
+        swish_nb_add_str(parser_data->properties, stack->temp->baked,
+                         str, len, (xmlChar *)SWISH_TOKENPOS_BUMPER, 0, 0);
     }
     
+    perf_phase(parser_data, prev_phase);
 
 }
 
-static void
-free_swishTag(
-    swish_Tag * st
-)
-{
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
-        SWISH_DEBUG_MSG(" freeing swishTag: (raw)%s (baked)%s (context)%s", 
-            st->raw, st->baked, st->context);
-    }
-
-    //SWISH_DEBUG_MSG("free raw: %s", st->raw);
-    swish_xfree(st->raw);
-    //SWISH_DEBUG_MSG("free baked: %s", st->baked);
-    swish_xfree(st->baked);
-    //SWISH_DEBUG_MSG("free context: %s", st->context);
-    swish_xfree(st->context);
-    //SWISH_DEBUG_MSG("free swishTag");
-    swish_xfree(st);
-    //SWISH_DEBUG_MSG("free swishTag done");
-}
-
 static void
 push_tag_stack(
     swish_TagStack *stack,
@@ -2944,19 +4066,51 @@ push_tag_stack(
     char flatten_join
 )
 {
+    swish_Tag *thistag;
+    int raw_len, baked_len, context_len, size;
 
-    swish_Tag *thistag = swish_xmalloc(sizeof(swish_Tag));
-
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s PUSH: tag = '%s'", stack->name, raw);
         _debug_stack(stack);
     }
 
+/*
+* reuse a popped tag and its buffer if there is one, so that
+* memory follows the depth of the document and not its length.
+*/
+    if (stack->free != NULL) {
+        thistag = stack->free;
+        stack->free = thistag->next;
+    }
+    else {
+        thistag = swish_arena_alloc(stack->arena, sizeof(swish_Tag));
+        thistag->buf = NULL;
+        thistag->buf_size = 0;
+    }
+
+    raw_len = xmlStrlen(raw);
+    baked_len = xmlStrlen(baked);
+    context_len = tag_context_len(baked, stack->head);
+    size = raw_len + baked_len + context_len + 3;
+    if (size > thistag->buf_size) {
+/* the old buffer stays in the arena, so at least double */
+        if (size < thistag->buf_size * 2)
+            size = thistag->buf_size * 2;
+        thistag->buf = swish_arena_alloc(stack->arena, size);
+        thistag->buf_size = size;
+    }
+
 /* assign this tag to the struct  */
-    thistag->raw = swish_xstrdup(raw);
+    thistag->raw = thistag->buf;
+    memcpy(thistag->raw, raw, raw_len + 1);
 
 /*  the normalized tag */
-    thistag->baked = swish_xstrdup(baked);
+    thistag->baked = thistag->raw + raw_len + 1;
+    memcpy(thistag->baked, baked, baked_len + 1);
+
+/*  create context */
+    thistag->context = thistag->baked + baked_len + 1;
+    fill_tag_context(thistag->context, context_len, baked, stack->head, flatten_join);
 
 /* increment counter  */
     thistag->n = stack->count++;
@@ -2965,10 +4119,7 @@ push_tag_stack(
     thistag->next = stack->head;
     stack->head = thistag;
 
-/*  create context */
-    thistag->context = flatten_tag_stack(NULL, stack, flatten_join);
-
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s size: %d  thistag count: %d  current head tag = '%s'",
                         stack->name, stack->count, thistag->n, stack->head->context);
 
@@ -2987,14 +4138,14 @@ pop_tag_stack(
     if (stack->head == NULL)
         return NULL;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s POP: %s", stack->name, stack->head->raw);
         _debug_stack(stack);
 
     }
 
     if (stack->count > 1) {
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("%s %d: popping '%s'", stack->name, stack->head->n,
                             stack->head->raw);
 
@@ -3009,7 +4160,7 @@ pop_tag_stack(
 
 /*  the stack has only one member */
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("%s %d: popping '%s' will leave stack empty [%s]",
                             stack->name, stack->head->n, stack->head->raw,
                             stack->head->context);
@@ -3022,10 +4173,14 @@ pop_tag_stack(
 
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s stack count = %d", stack->name, stack->count);
     }
 
+/* still readable until the next push reuses it */
+    stack->temp->next = stack->free;
+    stack->free = stack->temp;
+
     return stack->temp;
 
 }
@@ -3044,14 +4199,14 @@ pop_tag_stack_on_match(
 
     st = NULL;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         SWISH_DEBUG_MSG("%s: POP if %s matches %s", stack->name, tag, stack->head->raw);
         _debug_stack(stack);
     }
 
     if (xmlStrEqual(stack->head->raw, tag)) {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
             SWISH_DEBUG_MSG("%s POP '%s' == head", stack->name, tag);
 
         }
@@ -3061,7 +4216,7 @@ pop_tag_stack_on_match(
 */
         if ((st = pop_tag_stack(stack)) != NULL) {
 
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
                 SWISH_DEBUG_MSG("%s POPPED.  tag = %s  st->raw = %s", stack->name, tag,
                                 st->raw);
 
@@ -3074,7 +4229,7 @@ pop_tag_stack_on_match(
 * only tag on stack. TODO do we ever get here? 
 */
         else if (stack->count) {
-            if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
                 SWISH_DEBUG_MSG("%s head %s", stack->name, stack->head->raw);
 
         }
@@ -3085,12 +4240,12 @@ pop_tag_stack_on_match(
     }
     else {
 
-        if (SWISH_DEBUG & SWISH_DEBUG_PARSER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
             SWISH_DEBUG_MSG("%s: no match for '%s'", stack->name, tag);
 
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_PARSER) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER)) {
         if (st != NULL)
             SWISH_DEBUG_MSG("POP on match returning: %s", st->raw);
         else
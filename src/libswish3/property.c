@@ -18,6 +18,10 @@
 */
 
 #ifndef LIBSWISH3_SINGLE_FILE
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
 #include "libswish3.h"
 #endif
 
@@ -158,3 +162,73 @@ swish_property_get_id(
 
     return prop_id;
 }
+
+static boolean
+parse_sort_number(
+    const xmlChar *value,
+    long long *n
+)
+{
+    char *end;
+
+    value = swish_str_skip_ws((xmlChar *)value);
+    if (!*value)
+        return SWISH_FALSE;
+
+    *n = strtoll((const char *)value, &end, 10);
+    while (isspace((unsigned char)*end))
+        end++;
+    return *end == '\0';
+}
+
+/*
+* the presort key for value, made once at index time so that sorting on
+* prop needs only memcmp(). INT values, and DATE values given as epoch
+* seconds, become 8 big-endian bytes with the sign bit flipped (an INT
+* that is not a number sorts by its leading digits, as strtoll() reads them).
+* anything else is case-folded if prop->ignore_case, cut to
+* prop->sort_length characters (0 means no limit) and run through
+* strxfrm() for the LC_COLLATE locale. the key may contain NUL bytes, so
+* its length is returned in len. returns a new string; free it.
+*/
+xmlChar *
+swish_property_sort_key(
+    swish_Property *prop,
+    const xmlChar *value,
+    int *len
+)
+{
+    xmlChar *key;
+    xmlChar *str;
+    long long num;
+    uint64_t bits;
+    boolean numeric;
+    size_t n;
+    int i;
+
+    num = 0;
+    numeric = parse_sort_number(value, &num);
+    if (prop->type == SWISH_PROP_INT || (prop->type == SWISH_PROP_DATE && numeric)) {
+        bits = (uint64_t)num ^ ((uint64_t)1 << 63);
+        key = swish_xmalloc(9);
+        for (i = 7; i >= 0; i--) {
+            key[i] = (xmlChar)(bits & 0xff);
+            bits >>= 8;
+        }
+        key[8] = '\0';
+        *len = 8;
+        return key;
+    }
+
+    str = prop->ignore_case ? swish_str_tolower((xmlChar *)value) : swish_xstrdup(value);
+    if (prop->sort_length && xmlUTF8Strlen(str) > (int)prop->sort_length) {
+        str[xmlUTF8Strsize(str, prop->sort_length)] = '\0';
+    }
+
+    n = strxfrm(NULL, (const char *)str, 0);
+    key = swish_xmalloc(n + 1);
+    strxfrm((char *)key, (const char *)str, n + 1);
+    swish_xfree(str);
+    *len = (int)n;
+    return key;
+}
@@ -0,0 +1,311 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* querycache.c -- LRU cache of search results
+ *
+ * A search backend keys each result by swish_query_cache_key(): the query
+ * with its whitespace normalized, plus the sort, offset, limit and facets
+ * that shaped the answer. It keeps the matching docids and the rendered
+ * output. The cache is bounded in entries and in bytes; the least recently
+ * used results go first. Every entry belongs to one revision of the index,
+ * named by a stamp string, and swish_query_cache_validate() drops them all
+ * when the stamp changes.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "libswish3.h"
+#endif
+
+extern int SWISH_DEBUG;
+
+#define QUERY_KEY_SEP   '\x1f'  /* ASCII unit separator, between key fields */
+
+static void
+unlink_result(
+    swish_QueryCache *cache,
+    swish_QueryResult *res
+)
+{
+    if (res->prev != NULL)
+        res->prev->next = res->next;
+    else
+        cache->head = res->next;
+
+    if (res->next != NULL)
+        res->next->prev = res->prev;
+    else
+        cache->tail = res->prev;
+
+    res->prev = NULL;
+    res->next = NULL;
+}
+
+static void
+push_result(
+    swish_QueryCache *cache,
+    swish_QueryResult *res
+)
+{
+    res->prev = NULL;
+    res->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = res;
+    cache->head = res;
+    if (cache->tail == NULL)
+        cache->tail = res;
+}
+
+static void
+free_result(
+    swish_QueryResult *res
+)
+{
+    swish_xfree(res->key);
+    swish_xfree(res->output);
+    if (res->docids != NULL)
+        swish_xfree(res->docids);
+    swish_xfree(res);
+}
+
+static void
+evict_result(
+    swish_QueryCache *cache,
+    swish_QueryResult *res
+)
+{
+    unlink_result(cache, res);
+    cache->n--;
+    cache->bytes -= res->bytes;
+    xmlHashRemoveEntry(cache->hash, res->key, NULL);
+    free_result(res);
+}
+
+static void
+clear_results(
+    swish_QueryCache *cache
+)
+{
+    while (cache->tail != NULL)
+        evict_result(cache, cache->tail);
+}
+
+swish_QueryCache *
+swish_query_cache_init(
+    unsigned long max_entries,
+    size_t max_bytes
+)
+{
+    swish_QueryCache *cache;
+
+    cache = swish_xmalloc(sizeof(swish_QueryCache));
+    cache->hash = xmlHashCreate(max_entries < 1024 ? (int)max_entries + 1 : 1024);
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->stamp = NULL;
+    cache->n = 0;
+    cache->max_entries = max_entries;
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+void
+swish_query_cache_free(
+    swish_QueryCache *cache
+)
+{
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY))
+        SWISH_DEBUG_MSG("freeing query cache: %lu hits %lu misses %lu bytes",
+                        cache->hits, cache->misses, (unsigned long)cache->bytes);
+
+    clear_results(cache);
+    xmlHashFree(cache->hash, NULL);
+    if (cache->stamp != NULL)
+        swish_xfree(cache->stamp);
+    swish_xfree(cache);
+}
+
+/*
+* stamp names the revision of the index that searches now run against.
+* if it differs from the last one, every cached result is dropped.
+*/
+void
+swish_query_cache_validate(
+    swish_QueryCache *cache,
+    const xmlChar *stamp
+)
+{
+    if (cache->stamp != NULL && xmlStrEqual(cache->stamp, stamp))
+        return;
+
+    if (cache->n && SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+        SWISH_DEBUG_MSG("query cache: index is now '%s', dropping %lu results",
+                        stamp, cache->n);
+
+    clear_results(cache);
+    if (cache->stamp != NULL)
+        swish_xfree(cache->stamp);
+    cache->stamp = swish_xstrdup(stamp);
+}
+
+/*
+* the cache key for one search. runs of whitespace in query become one
+* space and leading and trailing whitespace is dropped, so trivially
+* different spellings of a query share a result. extra is anything else
+* the caller's output depends on (a format string, say), or NULL.
+*/
+xmlChar *
+swish_query_cache_key(
+    const xmlChar *query,
+    const xmlChar *sort,
+    unsigned int offset,
+    unsigned int limit,
+    swish_StringList *facets,
+    const xmlChar *extra
+)
+{
+    xmlBufferPtr buf;
+    xmlChar *key;
+    char sep[2] = { QUERY_KEY_SEP, '\0' };
+    char nums[32];
+    const xmlChar *p;
+    unsigned int i;
+    boolean space;
+
+    buf = xmlBufferCreateSize(xmlStrlen(query) + 64);
+
+    space = SWISH_FALSE;
+    for (p = query; *p; p++) {
+        if (isspace(*p)) {
+            space = xmlBufferLength(buf) > 0;
+            continue;
+        }
+        if (space)
+            xmlBufferAdd(buf, BAD_CAST " ", 1);
+        space = SWISH_FALSE;
+        xmlBufferAdd(buf, p, 1);
+    }
+
+    snprintf(nums, sizeof(nums), "%c%u%c%u", QUERY_KEY_SEP, offset, QUERY_KEY_SEP, limit);
+    xmlBufferCCat(buf, nums);
+    xmlBufferCCat(buf, sep);
+    if (sort != NULL)
+        xmlBufferCat(buf, sort);
+    xmlBufferCCat(buf, sep);
+    for (i = 0; facets != NULL && i < facets->n; i++) {
+        if (i)
+            xmlBufferCCat(buf, " ");
+        xmlBufferCat(buf, facets->word[i]);
+    }
+    xmlBufferCCat(buf, sep);
+    if (extra != NULL)
+        xmlBufferCat(buf, extra);
+
+    key = swish_xstrdup(xmlBufferContent(buf));
+    xmlBufferFree(buf);
+    return key;
+}
+
+/*
+* the result cached under key, or NULL. the result belongs to the cache
+* and is valid until the next store or validate.
+*/
+swish_QueryResult *
+swish_query_cache_fetch(
+    swish_QueryCache *cache,
+    const xmlChar *key
+)
+{
+    swish_QueryResult *res;
+
+    res = xmlHashLookup(cache->hash, key);
+    if (res == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    if (cache->head != res) {
+        unlink_result(cache, res);
+        push_result(cache, res);
+    }
+    return res;
+}
+
+/*
+* keep a copy of output (len bytes) and of ndocids docids under key,
+* dropping the least recently used results to make room. a result
+* bigger than the whole cache is not kept.
+*/
+void
+swish_query_cache_store(
+    swish_QueryCache *cache,
+    const xmlChar *key,
+    const xmlChar *output,
+    size_t len,
+    const unsigned int *docids,
+    unsigned int ndocids
+)
+{
+    swish_QueryResult *res;
+    size_t bytes;
+
+    bytes = sizeof(swish_QueryResult)
+        + xmlStrlen(key) + 1
+        + len + 1
+        + ndocids * sizeof(unsigned int);
+
+    if (!cache->max_entries || bytes > cache->max_bytes)
+        return;
+
+    if ((res = xmlHashLookup(cache->hash, key)) != NULL)
+        evict_result(cache, res);
+
+    while (cache->tail != NULL
+           && (cache->n >= cache->max_entries || cache->bytes + bytes > cache->max_bytes))
+        evict_result(cache, cache->tail);
+
+    res = swish_xmalloc(sizeof(swish_QueryResult));
+    res->key = swish_xstrdup(key);
+    res->output = swish_xmalloc(len + 1);
+    memcpy(res->output, output, len);
+    res->output[len] = '\0';
+    res->len = len;
+    res->docids = NULL;
+    if (ndocids) {
+        res->docids = swish_xmalloc(ndocids * sizeof(unsigned int));
+        memcpy(res->docids, docids, ndocids * sizeof(unsigned int));
+    }
+    res->ndocids = ndocids;
+    res->bytes = bytes;
+
+    if (xmlHashAddEntry(cache->hash, res->key, res) != 0) {
+        SWISH_CROAK("failed to add query to query cache");
+    }
+    push_result(cache, res);
+    cache->n++;
+    cache->bytes += bytes;
+}
@@ -61,6 +61,14 @@ swish_3_init(
     s3->parser = swish_parser_init(handler);
     s3->parser->ref_cnt++;
     s3->stash = stash;
+    swish_perf_reset(&s3->perf);
+    s3->xinclude_cache = NULL;
+    s3->dedup = NULL;
+    s3->manifest = NULL;
+    s3->shard = 0;
+    s3->nshards = 0;
+    s3->arena = NULL;
+    s3->scratch = NULL;
     
     if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
         SWISH_DEBUG_MSG("s3 ptr 0x%lx", s3);
@@ -74,6 +82,26 @@ swish_3_free(
     swish_3 *s3
 )
 {    
+    if (s3->xinclude_cache != NULL) {
+        swish_xinclude_cache_free(s3->xinclude_cache);
+    }
+
+    if (s3->dedup != NULL) {
+        swish_dedup_free(s3->dedup);
+    }
+
+    if (s3->manifest != NULL) {
+        swish_manifest_free(s3->manifest);
+    }
+
+    if (s3->arena != NULL) {
+        swish_arena_free(s3->arena);
+    }
+
+    if (s3->scratch != NULL) {
+        swish_arena_free(s3->scratch);
+    }
+
     s3->parser->ref_cnt--;
     if (s3->parser->ref_cnt < 1) {
         swish_parser_free(s3->parser);
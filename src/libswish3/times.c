@@ -20,6 +20,7 @@
 
 #ifndef LIBSWISH3_SINGLE_FILE
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include "getruntime.c"
 #include "libswish3.h"
@@ -145,3 +146,63 @@ swish_time_format(
              (struct tm *)localtime((time_t *) & (epoch)));
     return h_mtime;
 }
+
+/* seconds from an arbitrary fixed point, for measuring intervals.
+ * not affected by changes to the system clock. */
+double
+swish_time_monotonic(
+    void
+)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec t;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &t) == 0)
+        return (double)t.tv_sec + t.tv_nsec / 1000000000.0;
+#endif
+    return swish_time_elapsed();
+}
+
+static const char *perf_phase_names[SWISH_PERF_NPHASES] = {
+    "other", "read", "encoding", "parse", "tokenize", "namedbuffer", "handler"
+};
+
+const char *
+swish_perf_phase_name(
+    swish_PerfPhase phase
+)
+{
+    if (phase < 0 || phase >= SWISH_PERF_NPHASES)
+        return NULL;
+
+    return perf_phase_names[phase];
+}
+
+void
+swish_perf_reset(
+    swish_PerfStats *stats
+)
+{
+    memset(stats, 0, sizeof(swish_PerfStats));
+}
+
+/* add stats to total, histograms included */
+void
+swish_perf_add(
+    swish_PerfStats *total,
+    swish_PerfStats *stats
+)
+{
+    int i;
+
+    for (i = 0; i < SWISH_PERF_NPHASES; i++) {
+        total->time[i] += stats->time[i];
+    }
+    total->bytes_in += stats->bytes_in;
+    total->tokens_out += stats->tokens_out;
+    total->ndocs += stats->ndocs;
+    for (i = 0; i < SWISH_PERF_HIST_SIZE; i++) {
+        total->time_hist[i] += stats->time_hist[i];
+        total->size_hist[i] += stats->size_hist[i];
+    }
+}
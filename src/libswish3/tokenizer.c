@@ -51,6 +51,10 @@ static int is_ignore_word_ascii(
 );
 static void make_ascii_tables(
 );
+static boolean over_budget(
+    swish_TokenList *tl,
+    int nchr
+);
 static int strip_utf8_chrs(
     xmlChar *token,
     int len
@@ -190,7 +194,7 @@ strip_utf8_chrs(
     start = 0;
     end = 0;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("Before: %s", token);
 
 // end chrs -- must do before start chars
@@ -230,14 +234,14 @@ strip_utf8_chrs(
         chr[k] = '\0';
         cp = swish_utf8_codepoint(chr);
 
-        if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
             SWISH_DEBUG_MSG("start chr_len %d chr: %s  [%d]", chr_len, chr, cp);
 
         if (!is_ignore_start_utf8(cp)) {
             break;
         }
         else {
-            if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                 SWISH_DEBUG_MSG("ignore_start %s", chr);
 
             token += i;
@@ -247,7 +251,7 @@ strip_utf8_chrs(
 
     token_len = xmlStrlen(token) + 1;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("After: %s (stripped %d start chars, %d end chars, len=%d)",
                         token, start, end, token_len);
 
@@ -264,7 +268,7 @@ strip_ascii_chrs(
     start = 0;
     end = 0;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("Before: %s", word);
 
 /* end chars -- must do before start chars */
@@ -309,7 +313,7 @@ strip_ascii_chrs(
 
     wlen = xmlStrlen(word) + 1;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("After: %s (stripped %d start chars, %d end chars, wlen=%d)",
                         word, start, end, wlen);
 
@@ -325,6 +329,9 @@ swish_token_list_init(
     tl->buf = xmlBufferCreateSize((size_t) SWISH_BUFFER_CHUNK_SIZE);
     tl->n = 0;
     tl->pos = 0;
+    tl->max_tokens = 0;
+    tl->deadline = 0;
+    tl->truncated = SWISH_FALSE;
     tl->ref_cnt = 0;
     tl->tokens = swish_xmalloc(sizeof(swish_Token *) * SWISH_TOKEN_LIST_SIZE);
     tl->contexts = swish_hash_init(8);
@@ -332,7 +339,7 @@ swish_token_list_init(
     if (!ascii_init)
         make_ascii_tables();
 
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG("TokenList ptr 0x%x", (long int)tl);
         SWISH_DEBUG_MSG("TokenList->tokens ptr 0x%x", (long int)tl->tokens);
     }
@@ -378,7 +385,12 @@ swish_token_list_add_token(
         SWISH_CROAK("can't add empty token to token list");
     }
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (tl->max_tokens && tl->n >= tl->max_tokens) {
+        tl->truncated = SWISH_TRUE;
+        return tl->n;
+    }
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("adding token: %s  meta=%s", token, meta->name);
 
     stoken = swish_token_init();
@@ -399,14 +411,14 @@ swish_token_list_add_token(
 
     num_of_allocs = tl->n / SWISH_TOKEN_LIST_SIZE;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENLIST) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENLIST)) {
         SWISH_DEBUG_MSG("TokenList size: %d  num_allocs = %d  modulus %d", tl->n,
                         num_of_allocs, tl->n % SWISH_TOKEN_LIST_SIZE);
         swish_token_debug(stoken);
     }
 
     if (num_of_allocs && !(tl->n % SWISH_TOKEN_LIST_SIZE)) {
-        if (SWISH_DEBUG & SWISH_DEBUG_TOKENLIST) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENLIST)) {
             SWISH_DEBUG_MSG("realloc for tokens: 0x%x", (long int)tl->tokens);
         }
 
@@ -436,6 +448,92 @@ swish_token_list_set_token(
     return ret;
 }
 
+/*
+* append every token in from to tl, as if each had been
+* swish_token_list_add_token()ed in order. the token text is copied
+* in one go and the tokens array grown once. like add_token(), stops
+* at tl's max_tokens, and takes nothing once tl is past its deadline;
+* either marks tl truncated. returns tokens added.
+*/
+int
+swish_token_list_merge(
+    swish_TokenList *tl,
+    swish_TokenList *from
+)
+{
+    unsigned int i, base, n, new_n;
+    int ret, len;
+    swish_Token *src, *stoken;
+    xmlChar *src_context, *context;
+
+    if (!from->n || tl->truncated)
+        return 0;
+
+    if (tl->deadline > 0 && swish_time_monotonic() > tl->deadline) {
+        tl->truncated = SWISH_TRUE;
+        return 0;
+    }
+
+    n = from->n;
+    len = xmlBufferLength(from->buf);
+    if (tl->max_tokens && tl->n + n > tl->max_tokens) {
+        tl->truncated = SWISH_TRUE;
+        n = tl->n < tl->max_tokens ? tl->max_tokens - tl->n : 0;
+        if (!n)
+            return 0;
+/* only the text of the tokens kept, with the NUL after the last */
+        len = from->tokens[n - 1]->offset + from->tokens[n - 1]->len + 1;
+    }
+
+    base = xmlBufferLength(tl->buf);
+    ret = xmlBufferAdd(tl->buf, xmlBufferContent(from->buf), len);
+    if (ret != 0) {
+        SWISH_CROAK("error appending tokens to buffer: %d", ret);
+    }
+
+/*
+* same size add_token() would have grown to
+*/
+    new_n = tl->n + n;
+    tl->tokens =
+        (swish_Token **)swish_xrealloc(tl->tokens,
+                                       sizeof(swish_Token*) * SWISH_TOKEN_LIST_SIZE *
+                                       (new_n / SWISH_TOKEN_LIST_SIZE + 1));
+
+    src_context = NULL;
+    context = NULL;
+    for (i = 0; i < n; i++) {
+        src = from->tokens[i];
+        stoken = swish_token_init();
+        stoken->offset  = base + src->offset;
+        stoken->len     = src->len;
+        stoken->pos     = ++tl->pos;
+        stoken->meta    = src->meta;
+        stoken->meta->ref_cnt++;
+
+/* runs of tokens share a context, so only look up when it changes */
+        if (src->context != src_context) {
+            src_context = src->context;
+            swish_hash_exists_or_add(tl->contexts, src_context, src_context);
+            context = swish_hash_fetch(tl->contexts, src_context);
+        }
+        stoken->context = context;
+        stoken->ref_cnt++;
+        tl->tokens[tl->n++] = stoken;
+    }
+
+/* buf may have moved */
+    for (i = tl->n - n; i < tl->n; i++) {
+        tl->tokens[i]->value = swish_token_list_get_token_value(tl, tl->tokens[i]);
+    }
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENLIST)) {
+        SWISH_DEBUG_MSG("merged %d of %d tokens, TokenList size: %d", n, from->n, tl->n);
+    }
+
+    return n;
+}
+
 swish_Token *
 swish_token_init(
 )
@@ -461,14 +559,14 @@ swish_token_free(
         SWISH_WARN("freeing Token with ref_cnt != 0 (%d)", t->ref_cnt);
     }
     
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG("freeing Token 0x%x with MetaName ref_cnt %d", 
             (long int)t, t->meta->ref_cnt);
     }
     
     t->meta->ref_cnt--;
     if (t->meta->ref_cnt == 0) {
-        if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
             SWISH_DEBUG_MSG("Token's MetaName ref_cnt == 0 ... freeing MetaName");
         }
         swish_metaname_free(t->meta);
@@ -535,14 +633,14 @@ swish_token_iterator_free(
         SWISH_WARN("freeing TokenIterator with ref_cnt != 0 (%d)", it->ref_cnt);
     }
     
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG(
         "freeing TokenIterator %d with TokenList ref_cnt %d and Analyzer ref_cnt %d", 
         it, it->tl->ref_cnt, it->a->ref_cnt);
     }
     
     it->a->ref_cnt--;
-    if (SWISH_DEBUG & SWISH_DEBUG_MEMORY) {
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY)) {
         SWISH_DEBUG_MSG("freeing TokenIterator with Analyzer ref_cnt = %d",
             it->a->ref_cnt);
     }
@@ -586,6 +684,28 @@ swish_token_iterator_next_token(
     return t;
 }
 
+/*
+* true once tl can take no more tokens: max_tokens was hit, or the
+* deadline has passed. the clock is only read every
+* SWISH_DEADLINE_STRIDE chars, nchr being the tokenizer's count.
+*/
+static boolean
+over_budget(
+    swish_TokenList *tl,
+    int nchr
+)
+{
+    if (tl->truncated)
+        return SWISH_TRUE;
+
+    if (tl->deadline > 0 && !(nchr % SWISH_DEADLINE_STRIDE)
+        && swish_time_monotonic() > tl->deadline) {
+        tl->truncated = SWISH_TRUE;
+        return SWISH_TRUE;
+    }
+    return SWISH_FALSE;
+}
+
 /* returns number of tokens added to TokenList */
 int
 swish_tokenize(
@@ -595,12 +715,18 @@ swish_tokenize(
     xmlChar *context
 )
 {
+    swish_MemSubsystem prev_mem;
+    int ntokens;
+
+    prev_mem = swish_mem_enter(SWISH_MEM_TOKENIZER);
     if (swish_is_ascii(buf)) {
-        return swish_tokenize_ascii(ti, buf, meta, context);
+        ntokens = swish_tokenize_ascii(ti, buf, meta, context);
     }
     else {
-        return swish_tokenize_utf8(ti, buf, meta, context);
+        ntokens = swish_tokenize_utf8(ti, buf, meta, context);
     }
+    swish_mem_leave(prev_mem);
+    return ntokens;
 }
 
 int
@@ -612,7 +738,7 @@ swish_tokenize_utf8(
 )
 {
     uint32_t cp;
-    int nstart, byte_pos, prev_pos, i, chr_len, token_len, maxwordlen, minwordlen;
+    int nstart, byte_pos, prev_pos, i, nchr, chr_len, token_len, maxwordlen, minwordlen;
     swish_TokenList *tl;
     boolean inside_token;
     xmlChar chr[5];             /*  max len of UCS32 plus NUL */
@@ -624,12 +750,13 @@ swish_tokenize_utf8(
     token       = swish_xmalloc(sizeof(xmlChar) * maxwordlen);
     buf_lower   = swish_utf8_str_tolower(buf);
     nstart      = tl->n;
+    nchr        = 0;
     inside_token = 0;
     byte_pos    = 0;
     prev_pos    = 0;
     token_len   = 0;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("starting tokenize3 for meta=%s", meta->name);
 
 /*
@@ -641,6 +768,9 @@ swish_tokenize_utf8(
             buf_lower[prev_pos] != '\0';
             swish_utf8_next_chr(buf_lower, &byte_pos)
     ) {
+        if (over_budget(tl, nchr++))
+            break;
+
         chr_len = byte_pos - prev_pos;
         if (!chr_len) {
             prev_pos = byte_pos;
@@ -654,7 +784,7 @@ swish_tokenize_utf8(
 
         cp = swish_utf8_codepoint(chr);
 
-        if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER) {
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER)) {
             SWISH_DEBUG_MSG("%d %d: ut8 chr '%s' unicode %d  len %d next byte: %d",
                             byte_pos, prev_pos, chr, cp, chr_len, buf_lower[prev_pos + 1]);
 
@@ -664,11 +794,11 @@ swish_tokenize_utf8(
 
         if (is_ignore_word_utf8(cp)) {
 
-            if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                 SWISH_DEBUG_MSG("%s is ignore_word", chr);
 
             if (inside_token) {
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("found end of token: '%s'", chr);
 
                 inside_token = 0;       /*  turn off flag */
@@ -683,7 +813,7 @@ swish_tokenize_utf8(
 
                 }
                 else {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("skipping token '%s' -- too short: %d", token,
                                         token_len);
                 }
@@ -691,7 +821,7 @@ swish_tokenize_utf8(
                 token = copy;   /*  restore to top of array so we do not leak */
 
                 if (cp == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -700,11 +830,11 @@ swish_tokenize_utf8(
 
             }
             else {
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("ignoring chr '%s'", chr);
 
                 if (cp == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -715,20 +845,20 @@ swish_tokenize_utf8(
         }
         else {
 
-            if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+            if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                 SWISH_DEBUG_MSG("%s is NOT ignore_word", chr);
 
             if (inside_token) {
 
                 /* edge case */
                 if ((chr_len + token_len) > maxwordlen) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("token_len = %d  forcing end of token: '%s'",
                                         token_len, chr);
                     continue;
                 }
 
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("adding to token: '%s'", chr);
 
                 memcpy(&token[token_len], chr, chr_len * sizeof(xmlChar));
@@ -737,7 +867,7 @@ swish_tokenize_utf8(
 
                 if (token_len >= maxwordlen || buf_lower[byte_pos] == '\0') {
 
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("token_len = %d  forcing end of token: '%s'",
                                         token_len, chr);
 
@@ -753,7 +883,7 @@ swish_tokenize_utf8(
 
                     }
                     else {
-                        if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                             SWISH_DEBUG_MSG("skipping token '%s' -- too short: %d", token,
                                             token_len);
                     }
@@ -763,7 +893,7 @@ swish_tokenize_utf8(
                 }
 
                 if (cp == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -773,7 +903,7 @@ swish_tokenize_utf8(
             }
             else {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("start a token with '%s'", chr);
 
                 token[0] = '\0';
@@ -795,7 +925,7 @@ swish_tokenize_utf8(
                 }
 
                 if (cp == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -836,21 +966,24 @@ swish_tokenize_ascii(
     token[0]        = '\0';
     inside_token    = 0;
 
-    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
         SWISH_DEBUG_MSG("tokenizing string: '%s'", buf);
 
     for (i = 0; buf[i] != '\0'; i++) {
+        if (over_budget(tl, i))
+            break;
+
         c = (char)tolower(buf[i]);
         nextc = (char)tolower(buf[i + 1]);
 
-        if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
             SWISH_DEBUG_MSG(" char: %c lower: %c  int: %d %#x (next is %c)", buf[i], c,
                             (int)c, (unsigned int)c, nextc);
                             
         if (!ascii_word_table[(int)c]) {
 
             if (inside_token) {
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("found end of token: '%c' at %d", c, i);
 
                 inside_token = 0;
@@ -862,7 +995,7 @@ swish_tokenize_ascii(
                     swish_token_list_add_token(tl, token, token_len, meta, context);
                 }
                 else {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("skipping token '%s' -- too short: %d", token,
                                         token_len);
                 }
@@ -870,7 +1003,7 @@ swish_tokenize_ascii(
                 token = copy;
                 
                 if (c == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -880,11 +1013,11 @@ swish_tokenize_ascii(
 
             }
             else {
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("ignoring char '%c'", c);
 
                 if (c == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -897,14 +1030,14 @@ swish_tokenize_ascii(
 
             if (inside_token) {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("adding to token: '%c' %d", c, i);
 
                 token[token_len++] = c;
 
                 if (token_len >= maxwordlen || nextc == '\0') {
 
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("forcing end of token: '%c' %d", c, i);
 
                     inside_token = 0;
@@ -917,7 +1050,7 @@ swish_tokenize_ascii(
                         swish_token_list_add_token(tl, token, token_len, meta, context);
                     }
                     else {
-                        if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                        if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                             SWISH_DEBUG_MSG("skipping token '%s' -- too short: %d", token,
                                             token_len);
                     }
@@ -927,7 +1060,7 @@ swish_tokenize_ascii(
                 }
 
                 if (c == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -937,7 +1070,7 @@ swish_tokenize_ascii(
             }
             else {
 
-                if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                     SWISH_DEBUG_MSG("start a token with '%c' %d", c, i);
 
                 token_len = 0;
@@ -952,7 +1085,7 @@ swish_tokenize_ascii(
                 }
                 
                 if (c == SWISH_TOKENPOS_BUMPER[0]) {
-                    if (SWISH_DEBUG & SWISH_DEBUG_TOKENIZER)
+                    if (SWISH_DEBUG_ON(SWISH_DEBUG_TOKENIZER))
                         SWISH_DEBUG_MSG("found tokenpos bumper byte at pos %d", tl->pos);
                     tl->pos++;
                 }
@@ -0,0 +1,200 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* trace.c -- structured trace events in a per-thread ring buffer
+ *
+ * The library only calls swish_trace_event() through the SWISH_TRACE_EVENT()
+ * macro, which is empty unless built with -DSWISH_TRACE (configure --enable-trace).
+ * swish_trace_dump() writes whatever is in the rings as Chrome trace JSON,
+ * which chrome://tracing and ui.perfetto.dev both read.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libswish3.h"
+#endif
+
+typedef struct
+{
+    double              ts;         // microseconds, monotonic
+    long                value;
+    swish_TraceType     type;
+    char                name[SWISH_TRACE_NAME_LEN];
+} trace_event;
+
+typedef struct trace_ring trace_ring;
+struct trace_ring
+{
+    trace_event         events[SWISH_TRACE_RING_SIZE];
+    unsigned long       n;          // total ever recorded; slot is n % size
+    int                 tid;
+    trace_ring         *next;
+};
+
+static trace_ring *all_rings = NULL;
+static int         next_tid = 0;
+static SWISH_THREAD_LOCAL trace_ring *my_ring = NULL;
+
+static trace_ring *
+get_ring(
+)
+{
+    trace_ring *r;
+
+    if (my_ring != NULL)
+        return my_ring;
+
+/* rings are never freed, so a dump can still read a finished thread's events */
+    r = calloc(1, sizeof(trace_ring));
+    if (r == NULL)
+        SWISH_CROAK("Out of memory! Can't calloc trace ring");
+
+    r->tid = __sync_add_and_fetch(&next_tid, 1);
+    do {
+        r->next = all_rings;
+    } while (!__sync_bool_compare_and_swap(&all_rings, r->next, r));
+
+    my_ring = r;
+    return r;
+}
+
+void
+swish_trace_event(
+    swish_TraceType type,
+    const char *name,
+    long value
+)
+{
+    trace_ring *r = get_ring();
+    trace_event *e = &r->events[r->n % SWISH_TRACE_RING_SIZE];
+
+    e->ts = swish_time_monotonic() * 1000000;
+    e->type = type;
+    e->value = value;
+    if (name != NULL) {
+        strncpy(e->name, name, SWISH_TRACE_NAME_LEN - 1);
+        e->name[SWISH_TRACE_NAME_LEN - 1] = '\0';
+    }
+    else {
+        e->name[0] = '\0';
+    }
+    r->n++;
+}
+
+/* forget everything recorded so far, in every thread */
+void
+swish_trace_reset(
+)
+{
+    trace_ring *r;
+
+    for (r = all_rings; r != NULL; r = r->next) {
+        r->n = 0;
+    }
+}
+
+static void
+print_json_string(
+    FILE *fh,
+    const char *str
+)
+{
+    const unsigned char *p;
+
+    fputc('"', fh);
+    for (p = (const unsigned char *)str; *p; p++) {
+        if (*p == '"' || *p == '\\')
+            fprintf(fh, "\\%c", *p);
+        else if (*p < 0x20)
+            fprintf(fh, "\\u%04x", *p);
+        else
+            fputc(*p, fh);
+    }
+    fputc('"', fh);
+}
+
+/*
+ * write the rings to fh as Chrome trace JSON. returns the number of events.
+ * events are read without locking, so dump while no thread is parsing.
+ */
+long
+swish_trace_dump(
+    FILE *fh
+)
+{
+    trace_ring *r;
+    trace_event *e;
+    unsigned long i, first;
+    long count;
+    int pid;
+    const char *ph;
+    const char *arg;
+
+    pid = (int)getpid();
+    count = 0;
+    fprintf(fh, "{\"traceEvents\":[");
+
+    for (r = all_rings; r != NULL; r = r->next) {
+        first = r->n > SWISH_TRACE_RING_SIZE ? r->n - SWISH_TRACE_RING_SIZE : 0;
+        for (i = first; i < r->n; i++) {
+            e = &r->events[i % SWISH_TRACE_RING_SIZE];
+            switch (e->type) {
+                case SWISH_TRACE_DOC_START:
+                case SWISH_TRACE_TAG_OPEN:
+                    ph = "B";
+                    arg = NULL;
+                    break;
+                case SWISH_TRACE_DOC_END:
+                case SWISH_TRACE_TAG_CLOSE:
+                    ph = "E";
+                    arg = NULL;
+                    break;
+                case SWISH_TRACE_FLUSH:
+                    ph = "i";
+                    arg = "bytes";
+                    break;
+                case SWISH_TRACE_TOKENS:
+                    ph = "i";
+                    arg = "tokens";
+                    break;
+                default:
+                    continue;
+            }
+
+            fprintf(fh, "%s\n{\"name\":", count ? "," : "");
+            print_json_string(fh, e->name);
+            fprintf(fh, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                    e->type == SWISH_TRACE_DOC_START || e->type == SWISH_TRACE_DOC_END
+                    ? "doc" : "parser", ph, e->ts, pid, r->tid);
+            if (ph[0] == 'i')
+                fprintf(fh, ",\"s\":\"t\"");
+            if (arg != NULL)
+                fprintf(fh, ",\"args\":{\"%s\":%ld}", arg, e->value);
+            fputc('}', fh);
+            count++;
+        }
+    }
+
+    fprintf(fh, "\n]}\n");
+    return count;
+}
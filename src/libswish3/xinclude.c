@@ -0,0 +1,365 @@
+/*
+ * This file is part of libswish3
+ * Copyright (C) 2007 Peter Karman
+ *
+ *  libswish3 is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  libswish3 is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with libswish3; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/* xinclude.c -- cache of parsed XInclude targets
+ *
+ * A document that is XIncluded by many others is parsed once. Its tokens,
+ * metanames and properties are kept, keyed by resolved path, and merged
+ * straight into each later includer while the file's mtime and size are
+ * unchanged, and those of every file it XIncludes in turn. The cache
+ * belongs to a swish_3 and is bounded by max_bytes; the least recently
+ * used fragments go first.
+ */
+
+#ifndef LIBSWISH3_SINGLE_FILE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "libswish3.h"
+#endif
+
+extern int SWISH_DEBUG;
+
+static void
+add_buffer_size(
+    xmlBufferPtr buffer,
+    size_t *bytes,
+    xmlChar *name
+)
+{
+    *bytes += xmlBufferLength(buffer) + xmlStrlen(name) + 1 + sizeof(xmlBuffer);
+}
+
+static size_t
+nb_size(
+    swish_NamedBuffer *nb
+)
+{
+    size_t bytes = sizeof(swish_NamedBuffer);
+    xmlHashScan(nb->hash, (xmlHashScanner)add_buffer_size, &bytes);
+    return bytes;
+}
+
+static void
+unlink_fragment(
+    swish_XIncludeCache *cache,
+    swish_XIncludeFragment *frag
+)
+{
+    if (frag->prev != NULL)
+        frag->prev->next = frag->next;
+    else
+        cache->head = frag->next;
+
+    if (frag->next != NULL)
+        frag->next->prev = frag->prev;
+    else
+        cache->tail = frag->prev;
+
+    frag->prev = NULL;
+    frag->next = NULL;
+}
+
+static void
+push_fragment(
+    swish_XIncludeCache *cache,
+    swish_XIncludeFragment *frag
+)
+{
+    frag->prev = NULL;
+    frag->next = cache->head;
+    if (cache->head != NULL)
+        cache->head->prev = frag;
+    cache->head = frag;
+    if (cache->tail == NULL)
+        cache->tail = frag;
+}
+
+static void
+free_fragment(
+    swish_XIncludeFragment *frag
+)
+{
+    frag->tl->ref_cnt--;
+    if (frag->tl->ref_cnt == 0)
+        swish_token_list_free(frag->tl);
+
+    frag->properties->ref_cnt--;
+    swish_nb_free(frag->properties);
+    frag->metanames->ref_cnt--;
+    swish_nb_free(frag->metanames);
+
+    swish_xinclude_deps_free(frag->deps, frag->ndeps);
+    swish_xfree(frag->uri);
+    swish_xfree(frag);
+}
+
+/* drop frag from the hash and the list, and free it */
+static void
+evict_fragment(
+    swish_XIncludeCache *cache,
+    swish_XIncludeFragment *frag
+)
+{
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+        SWISH_DEBUG_MSG("xinclude cache evict %s (%lu bytes)", frag->uri,
+                        (unsigned long)frag->bytes);
+
+    unlink_fragment(cache, frag);
+    cache->bytes -= frag->bytes;
+    xmlHashRemoveEntry(cache->hash, frag->uri, NULL);
+    free_fragment(frag);
+}
+
+swish_XIncludeCache *
+swish_xinclude_cache_init(
+    size_t max_bytes
+)
+{
+    swish_XIncludeCache *cache;
+
+    cache = swish_xmalloc(sizeof(swish_XIncludeCache));
+    cache->hash = xmlHashCreate(64);
+    cache->head = NULL;
+    cache->tail = NULL;
+    cache->bytes = 0;
+    cache->max_bytes = max_bytes;
+    cache->hits = 0;
+    cache->misses = 0;
+    return cache;
+}
+
+void
+swish_xinclude_cache_free(
+    swish_XIncludeCache *cache
+)
+{
+    swish_XIncludeFragment *frag, *next;
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_MEMORY))
+        SWISH_DEBUG_MSG("freeing xinclude cache: %lu hits %lu misses %lu bytes",
+                        cache->hits, cache->misses, (unsigned long)cache->bytes);
+
+    for (frag = cache->head; frag != NULL; frag = next) {
+        next = frag->next;
+        free_fragment(frag);
+    }
+    xmlHashFree(cache->hash, NULL);
+    swish_xfree(cache);
+}
+
+/* has any file nested in frag changed (or come or gone) since it was parsed? */
+static boolean
+deps_changed(
+    swish_XIncludeFragment *frag
+)
+{
+    unsigned int i;
+    struct stat st;
+
+    for (i = 0; i < frag->ndeps; i++) {
+        if (stat((char *)frag->deps[i].uri, &st) != 0) {
+            if (frag->deps[i].size != -1)
+                return SWISH_TRUE;
+        }
+        else if (frag->deps[i].mtime != st.st_mtime || frag->deps[i].size != st.st_size) {
+            return SWISH_TRUE;
+        }
+    }
+    return SWISH_FALSE;
+}
+
+/*
+* returns the cached fragment for uri, or NULL if there is none or
+* it or any file it XIncludes has changed since it was cached
+*/
+swish_XIncludeFragment *
+swish_xinclude_cache_fetch(
+    swish_XIncludeCache *cache,
+    xmlChar *uri,
+    time_t mtime,
+    off_t size,
+    boolean is_text
+)
+{
+    swish_XIncludeFragment *frag;
+
+    frag = xmlHashLookup(cache->hash, uri);
+    if (frag != NULL
+        && (frag->mtime != mtime || frag->size != size || frag->is_text != is_text
+            || deps_changed(frag))) {
+        evict_fragment(cache, frag);
+        frag = NULL;
+    }
+
+    if (frag == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+
+    cache->hits++;
+    if (cache->head != frag) {
+        unlink_fragment(cache, frag);
+        push_fragment(cache, frag);
+    }
+    return frag;
+}
+
+/*
+* keep what parser_data parsed from uri. its TokenList is shared;
+* its NamedBuffers and XInclude deps are taken, and replaced with empty ones.
+*/
+void
+swish_xinclude_cache_store(
+    swish_XIncludeCache *cache,
+    xmlChar *uri,
+    time_t mtime,
+    off_t size,
+    boolean is_text,
+    swish_ParserData *parser_data
+)
+{
+    swish_XIncludeFragment *frag;
+    swish_TokenList *tl;
+    size_t bytes;
+    unsigned int i;
+
+    tl = parser_data->token_iterator->tl;
+    bytes = sizeof(swish_XIncludeFragment)
+        + xmlStrlen(uri) + 1
+        + parser_data->nxinclude_deps * sizeof(swish_XIncludeDep)
+        + xmlBufferLength(tl->buf)
+        + tl->n * (sizeof(swish_Token) + sizeof(swish_Token *))
+        + nb_size(parser_data->properties)
+        + nb_size(parser_data->metanames);
+
+    for (i = 0; i < parser_data->nxinclude_deps; i++)
+        bytes += xmlStrlen(parser_data->xinclude_deps[i].uri) + 1;
+
+    if (bytes > cache->max_bytes)
+        return;
+
+    if ((frag = xmlHashLookup(cache->hash, uri)) != NULL)
+        evict_fragment(cache, frag);
+
+    while (cache->tail != NULL && cache->bytes + bytes > cache->max_bytes)
+        evict_fragment(cache, cache->tail);
+
+    frag = swish_xmalloc(sizeof(swish_XIncludeFragment));
+    frag->uri = swish_xstrdup(uri);
+    frag->mtime = mtime;
+    frag->size = size;
+    frag->is_text = is_text;
+    frag->deps = parser_data->xinclude_deps;
+    frag->ndeps = parser_data->nxinclude_deps;
+    parser_data->xinclude_deps = NULL;
+    parser_data->nxinclude_deps = 0;
+    frag->nwords = parser_data->docinfo->nwords;
+    frag->bytes = bytes;
+
+    frag->tl = tl;
+    frag->tl->ref_cnt++;
+
+/* free_parser_data() frees its NamedBuffers regardless, so swap ours out */
+    frag->properties = parser_data->properties;
+    parser_data->properties = swish_nb_init(frag->properties->conf);
+    parser_data->properties->ref_cnt++;
+    frag->metanames = parser_data->metanames;
+    parser_data->metanames = swish_nb_init(frag->metanames->conf);
+    parser_data->metanames->ref_cnt++;
+
+    if (xmlHashAddEntry(cache->hash, frag->uri, frag) != 0) {
+        SWISH_CROAK("failed to add %s to xinclude cache", uri);
+    }
+    push_fragment(cache, frag);
+    cache->bytes += bytes;
+
+    if (SWISH_DEBUG_ON(SWISH_DEBUG_PARSER))
+        SWISH_DEBUG_MSG("xinclude cache store %s (%lu bytes, %lu total)", uri,
+                        (unsigned long)bytes, (unsigned long)cache->bytes);
+}
+
+/*
+* add a fragment's tokens, words and buffers to the document parser_data,
+* exactly as if it had just been parsed as an XInclude of it
+*/
+void
+swish_xinclude_cache_merge(
+    swish_XIncludeFragment *frag,
+    swish_ParserData *parser_data
+)
+{
+    unsigned int n;
+
+    n = swish_token_list_merge(parser_data->token_iterator->tl, frag->tl);
+/* fewer if the includer ran out of its budget */
+    if (n < frag->tl->n)
+        parser_data->docinfo->nwords += n;
+    else
+        parser_data->docinfo->nwords += frag->nwords;
+    swish_buffer_concat(parser_data->properties, frag->properties);
+    swish_buffer_concat(parser_data->metanames, frag->metanames);
+}
+
+/*
+* note that uri went into the XInclude fragment being parsed as
+* parser_data. a no-op for top-level docs, which are never cached.
+*/
+void
+swish_xinclude_deps_add(
+    swish_ParserData *parser_data,
+    xmlChar *uri,
+    time_t mtime,
+    off_t size
+)
+{
+    swish_XIncludeDep *dep;
+
+    if (!parser_data->is_xinclude)
+        return;
+
+/* the first block is swish_xmalloc()ed so that memcount matches the free */
+    if (parser_data->xinclude_deps == NULL)
+        parser_data->xinclude_deps = swish_xmalloc(sizeof(swish_XIncludeDep));
+    else
+        parser_data->xinclude_deps =
+            swish_xrealloc(parser_data->xinclude_deps,
+                           (parser_data->nxinclude_deps + 1) * sizeof(swish_XIncludeDep));
+    dep = &parser_data->xinclude_deps[parser_data->nxinclude_deps++];
+    dep->uri = swish_xstrdup(uri);
+    dep->mtime = mtime;
+    dep->size = size;
+}
+
+void
+swish_xinclude_deps_free(
+    swish_XIncludeDep *deps,
+    unsigned int ndeps
+)
+{
+    unsigned int i;
+
+    if (deps == NULL)
+        return;
+    for (i = 0; i < ndeps; i++)
+        swish_xfree(deps[i].uri);
+    swish_xfree(deps);
+}
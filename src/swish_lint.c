@@ -32,6 +32,11 @@
 
 int debug = 0;
 int verbose = 0;
+int framed = 0;
+int stats = 0;
+char *trace_file = NULL;
+char *dedup_file = NULL;
+char *manifest_file = NULL;
 
 int main(
     int argc,
@@ -46,8 +51,16 @@ void libxml2_version(
 );
 void swish_version(
 );
+void print_stats(
+    swish_PerfStats *perf
+);
+void print_deleted(
+    const xmlChar *path,
+    void *data
+);
 
 int twords = 0;
+long int nbinary = 0;
 
 extern int SWISH_DEBUG;
 
@@ -55,9 +68,16 @@ static struct option longopts[] = {
     {"config", required_argument, 0, 'c'},
     {"CascadeMetaContext", required_argument, 0, 'C'},
     {"debug", required_argument, 0, 'd'},
+    {"dedup", required_argument, 0, 'D'},
+    {"dedup-file", required_argument, 0, 'P'},
     {"help", no_argument, 0, 'h'},
+    {"manifest", required_argument, 0, 'M'},
     {"verbose", no_argument, 0, 'v'},
     {"filelist", required_argument, 0, 'f'},
+    {"framed", no_argument, 0, 'F'},
+    {"recover", no_argument, 0, 'r'},
+    {"stats", no_argument, 0, 's'},
+    {"trace", required_argument, 0, 'T'},
     {"tokenize", required_argument, 0, 't'},
     {"xinclude", required_argument, 0, 'X'},
     {"xmlns", required_argument, 0, 'x'},
@@ -87,7 +107,14 @@ usage(
     char *descr = "swish_lint is an example program for using libswish3\n";
     printf("swish_lint [opts] [- | file(s)]\n");
     printf("opts:\n --config conf_file.xml\n --debug [lvl]\n --help\n --verbose\n");
+    printf(" --dedup N (skip byte-identical documents, remembering up to N)\n");
+    printf(" --dedup-file file (load and save --dedup state, to catch duplicates across runs)\n");
     printf(" --filelist filename\n");
+    printf(" --framed (stdin uses binary frame headers)\n");
+    printf(" --manifest file (skip files unchanged since the run that wrote file)\n");
+    printf(" --recover (skip documents that fail to parse instead of exiting)\n");
+    printf(" --stats (print per-phase timing and histograms)\n");
+    printf(" --trace file.json (Chrome trace; needs a build with --enable-trace)\n");
     printf(" --tokenize 0|1\n");
     printf(" --xinclude 0|1\n");
     printf(" --xmlns 0|1\n");
@@ -105,6 +132,9 @@ usage(
     printf("\tSWISH_DEBUG_IO         128\n");
     printf("Set SWISH_PARSER_WARNINGS=0 to turn off libxml2 errors and warnings\n");
     printf("Set SWISH_WARNINGS=0 to turn off libswish3 warnings\n");
+    printf("Set SWISH_MMAP_THRESHOLD=bytes to mmap files at least that big (0 to disable)\n");
+    printf("Set SWISH_RECOVER_ERRORS=1 to do the same as --recover\n");
+    printf("Set SWISH_XINCLUDE_CACHE_SIZE=bytes to size the parsed XInclude cache (0 to disable)\n");
     printf("stdin headers:\n");
     printf("\tContent-Length\n");
     printf("\tLast-Modified\n");
@@ -132,6 +162,89 @@ usage(
 
 }
 
+/* one line per non-empty bucket, bar scaled to the fullest one */
+static void
+print_histogram(
+    const char *label,
+    const char *unit,
+    unsigned long *hist
+)
+{
+    int i, j, first, last, width;
+    unsigned long max;
+
+    first = -1;
+    last = -1;
+    max = 0;
+    for (i = 0; i < SWISH_PERF_HIST_SIZE; i++) {
+        if (!hist[i])
+            continue;
+        if (first < 0)
+            first = i;
+        last = i;
+        if (hist[i] > max)
+            max = hist[i];
+    }
+    if (first < 0)
+        return;
+
+    printf("\n%s\n", label);
+    for (i = first; i <= last; i++) {
+        printf("  %10lu - %-10lu %s %8lu ", i ? 1UL << i : 0UL, (1UL << (i + 1)) - 1, unit, hist[i]);
+        width = (int)((hist[i] * 40 + max - 1) / max);
+        for (j = 0; j < width; j++)
+            putchar('#');
+        putchar('\n');
+    }
+}
+
+void
+print_stats(
+    swish_PerfStats *perf
+)
+{
+    int i;
+    double total;
+
+    if (!perf->ndocs) {
+        printf("no documents parsed\n");
+        return;
+    }
+
+    total = 0;
+    for (i = 0; i < SWISH_PERF_NPHASES; i++) {
+        total += perf->time[i];
+    }
+
+    printf("%-12s %12s %8s %12s\n", "phase", "seconds", "%", "ms/doc");
+    for (i = 0; i < SWISH_PERF_NPHASES; i++) {
+        printf("%-12s %12.6f %7.1f%% %12.4f\n", swish_perf_phase_name(i), perf->time[i],
+               total > 0 ? perf->time[i] * 100 / total : 0.0,
+               perf->time[i] * 1000 / perf->ndocs);
+    }
+    printf("%-12s %12.6f\n", "total", total);
+    printf("\n%lu docs  %lu bytes in  %lu tokens out", perf->ndocs, perf->bytes_in,
+           perf->tokens_out);
+    if (total > 0) {
+        printf("  (%.2f MB/s, %.0f tokens/s)", perf->bytes_in / total / 1048576,
+               perf->tokens_out / total);
+    }
+    printf("\n");
+
+    print_histogram("time per doc", "usec ", perf->time_hist);
+    print_histogram("size per doc", "bytes", perf->size_hist);
+    printf("\n");
+}
+
+void
+print_deleted(
+    const xmlChar *path,
+    void *data ATTRIBUTE_UNUSED
+)
+{
+    printf("deleted: %s\n", path);
+}
+
 void
 handler(
     swish_ParserData *parser_data
@@ -143,6 +256,14 @@ handler(
 */
 
     if (verbose) {
+        if (parser_data->docinfo->duplicate_of != NULL)
+            printf("%s is a duplicate of %s\n", parser_data->docinfo->uri,
+                   parser_data->docinfo->duplicate_of);
+        if (parser_data->docinfo->truncated)
+            printf("%s was truncated\n", parser_data->docinfo->uri);
+        if (parser_data->docinfo->binary != NULL)
+            printf("%s skipped as binary: %s\n", parser_data->docinfo->uri,
+                   parser_data->docinfo->binary);
         printf("nwords: %d\n", parser_data->docinfo->nwords);
     }
 
@@ -150,6 +271,8 @@ handler(
         swish_mem_debug();
 
     twords += parser_data->docinfo->nwords;
+    if (parser_data->docinfo->binary != NULL)
+        nbinary++;
 
     if ((debug & SWISH_DEBUG_DOCINFO) || (SWISH_DEBUG & SWISH_DEBUG_DOCINFO))
         swish_docinfo_debug(parser_data->docinfo);
@@ -190,7 +313,7 @@ main(
     start_time = swish_time_elapsed();
     s3 = swish_3_init(&handler, NULL);
 
-    while ((ch = getopt_long(argc, argv, "c:d:f:ht:vx:X:C:", longopts, &option_index)) != -1) {
+    while ((ch = getopt_long(argc, argv, "c:d:D:f:FhM:P:rsT:t:vx:X:C:", longopts, &option_index)) != -1) {
 
         switch (ch) {
             case 0:                /* If this option set a flag, do nothing else now. */
@@ -220,6 +343,23 @@ main(
                 debug = 1;
                 break;
 
+            case 'D':
+                if (!isdigit(optarg[0]))
+                    err(1, "-D option requires a positive integer as argument\n");
+
+                if (s3->dedup != NULL)
+                    swish_dedup_free(s3->dedup);
+                s3->dedup = swish_dedup_init(strtoul(optarg, NULL, 10));
+                break;
+
+            case 'M':
+                manifest_file = optarg;
+                break;
+
+            case 'P':
+                dedup_file = optarg;
+                break;
+
             case 'v':
                 verbose = 1;
                 s3->parser->verbosity = 1;
@@ -229,6 +369,22 @@ main(
                 filelist = swish_xstrdup((xmlChar *)optarg);
                 break;
 
+            case 'F':
+                framed = 1;
+                break;
+
+            case 'r':
+                s3->parser->recover = SWISH_TRUE;
+                break;
+
+            case 's':
+                stats = 1;
+                break;
+
+            case 'T':
+                trace_file = optarg;
+                break;
+
             case 't':
                 s3->analyzer->tokenize = swish_string_to_boolean(optarg);
                 break;
@@ -265,11 +421,26 @@ main(
             swish_config_debug(s3->config);
         }
 
+        if (manifest_file != NULL) {
+            s3->manifest = swish_manifest_init();
+            printf("%ld files loaded from %s\n", swish_manifest_load(s3->manifest, manifest_file),
+                   manifest_file);
+        }
+
+        if (dedup_file != NULL) {
+            if (s3->dedup == NULL)
+                s3->dedup = swish_dedup_init(SWISH_DEDUP_ENTRIES);
+            printf("%ld documents loaded from %s\n", swish_dedup_load(s3->dedup, dedup_file),
+                   dedup_file);
+        }
+
         for (; i < argc; i++) {
 
             if (argv[i][0] != '-') {
 
 /* printf("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n"); */
+                if (s3->manifest != NULL)
+                    swish_manifest_add_root(s3->manifest, BAD_CAST argv[i]);
                 if (swish_fs_is_file(BAD_CAST argv[i])) {
                     printf("parse_file for %s\n", argv[i]);
                     if (swish_parse_file(s3, BAD_CAST argv[i]) == 0)
@@ -286,7 +457,10 @@ main(
             else if (argv[i][0] == '-' && !argv[i][1]) {
 
                 printf("reading from stdin\n");
-                files = swish_parse_fh(s3, NULL);
+                if (framed)
+                    files = swish_parse_fh_framed(s3, NULL);
+                else
+                    files = swish_parse_fh(s3, NULL);
 
             }
 
@@ -325,6 +499,8 @@ main(
                     printf("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
                     printf("parse_file for %s\n", line);
                 }
+                if (s3->manifest != NULL)
+                    swish_manifest_add_root(s3->manifest, line);
                 if (!swish_parse_file(s3, (unsigned char *)line)) {
                     files++;
                     if (!verbose) {
@@ -343,12 +519,49 @@ main(
         }
 
         printf("\n\n%ld files parsed\n", files);
+        if (s3->parser->nfailed)
+            printf("%lu files failed\n", s3->parser->nfailed);
+        if (s3->dedup != NULL)
+            printf("%lu duplicates\n", s3->dedup->hits);
+        if (nbinary)
+            printf("%ld binary files skipped\n", nbinary);
+        if (s3->manifest != NULL) {
+            long deleted = swish_manifest_deleted(s3->manifest, print_deleted, NULL);
+            printf("%lu files unchanged\n%ld files deleted\n", s3->manifest->unchanged, deleted);
+            printf("%ld files saved to %s\n", swish_manifest_save(s3->manifest, manifest_file),
+                   manifest_file);
+        }
         printf("total words: %d\n", twords);
 
         etime = swish_time_print(swish_time_elapsed() - start_time);
         printf("%s total time\n\n", etime);
         swish_xfree(etime);
 
+        if (stats) {
+            print_stats(&s3->perf);
+            if (s3->xinclude_cache != NULL) {
+                printf("\nxinclude cache: %lu hits %lu misses %lu bytes\n",
+                       s3->xinclude_cache->hits, s3->xinclude_cache->misses,
+                       (unsigned long)s3->xinclude_cache->bytes);
+            }
+        }
+
+        if (dedup_file != NULL) {
+            printf("%ld documents saved to %s\n", swish_dedup_save(s3->dedup, dedup_file),
+                   dedup_file);
+        }
+
+        if (trace_file != NULL) {
+            FILE *trace_fh = fopen(trace_file, "w");
+            if (trace_fh == NULL) {
+                SWISH_CROAK("failed to open trace file %s", trace_file);
+            }
+            printf("%ld trace events written to %s\n", swish_trace_dump(trace_fh), trace_file);
+            if (fclose(trace_fh)) {
+                SWISH_CROAK("error closing trace file %s", trace_file);
+            }
+        }
+
     }
 
     if (config_file != NULL)
@@ -2,7 +2,7 @@
 
 use strict;
 use warnings;
-use Test::More tests => 36;
+use Test::More tests => 75;
 use SwishTestUtils;
 
 my $topdir     = $ENV{SVNDIR} || '..';
@@ -29,12 +29,14 @@ while ($test_docs =~ m/^\//
 
 my %docs = (
     'badxml.xml'             => '10',
+    'binary.txt'             => '0',                    # skipped, not parsed
     'contractions.xml'       => '17',
     'dom.xml'                => 5,
     'empty_doc.html'         => '0',
     'foo.txt'                => 18 + $txt_file_words,
     'has_nulls.txt'          => 15 + $txt_file_words,
     'html_broken.html'       => '2',
+    'image.html'             => '0',                    # a PNG, whatever its name
     'inline.html'            => 9,
     'inline.xml'             => 14,
     'latin1.html'            => 10,
@@ -43,6 +45,7 @@ my %docs = (
     'latin1.xml'             => '5',
     'meta.html'              => '23',
     'min.txt'                => 3 + $txt_file_words,
+    'multi-member.txt.gz'    => 5059 + $txt_file_words,    # 2 gzip members
     'multi_props.xml'        => '27',
     'nested_meta.xml'        => '20',
     'no_such_file.txt'       => '0',
@@ -85,6 +88,9 @@ my %stdindocs = (
     # isn't really .txt, parsed as XML per header
     'test.txt' => 1,
 
+    # Latin-1 body, converted per Encoding header regardless of locale
+    'latin1.txt' => 6,
+
 );
 
 for my $file ( sort keys %docs ) {
@@ -107,11 +113,232 @@ is( words_latin1('greek_and_ojibwe.txt'),
     "libxml2 detects encoding, overrides SWISH_ENCODING"
 );
 
+for my $file (qw( testutf.xml has_nulls.txt )) {
+    local $ENV{SWISH_MMAP_THRESHOLD} = 1;
+    cmp_ok( words($file), '==', $docs{$file}, "mmap $file == $docs{$file} words" );
+}
+
 for my $file ( sort keys %stdindocs ) {
     cmp_ok( fromstdin($file), '==', $stdindocs{$file},
         "stdin $file -> $stdindocs{$file} words" );
 }
 
+is( fromstdin_framed( 'words.xml', 't.html' ),
+    $docs{'words.xml'} + $docs{'t.html'},
+    "binary framed stdin"
+);
+
+{
+    my $o = join( ' ', `./swish_lint --stats $test_docs/words.xml $test_docs/t.html 2>/dev/null` );
+    my ( $docs, $tokens ) = ( $o =~ m/(\d+) docs\s+\d+ bytes in\s+(\d+) tokens out/ );
+    is( $docs, 2, "--stats doc count" );
+    is( $tokens, $docs{'words.xml'} + $docs{'t.html'}, "--stats tokens out" );
+}
+
+{
+    local $ENV{SWISH_RECOVER_ERRORS} = 1;
+    my $o = join( ' ', `./swish_lint - < $test_stdin/recover.txt 2>/dev/null` );
+    like( $o, qr/1 files failed/, "recover mode skips the bad doc" );
+    like( $o, qr/total words: 2\b/, "and parses the one after it" );
+    $o = join( ' ', `./swish_lint - < $test_stdin/recover_headers.txt 2>/dev/null` );
+    like( $o, qr/3 files failed/, "recover mode skips docs with bad headers" );
+    like( $o, qr/total words: 2\b/, "and finds the next header block" );
+}
+
+{
+    my $cmd = "./swish_lint --stats $test_docs/xinclude.xml $test_docs/xinclude.xml 2>/dev/null";
+    my $o = join( ' ', `$cmd` );
+    my ($hits) = ( $o =~ m/xinclude cache: (\d+) hits/ );
+    ok( $hits, "xinclude cache hits on repeated includes" );
+    local $ENV{SWISH_XINCLUDE_CACHE_SIZE} = 0;
+    my $uncached = join( ' ', `$cmd` );
+    my ($words)    = ( $o        =~ m/total words: (\d+)/ );
+    my ($expected) = ( $uncached =~ m/total words: (\d+)/ );
+    is( $words, $expected, "cached xincludes give the same words" );
+}
+
+{
+    my $dir = "xinclude-$$";
+    mkdir $dir or die "$dir: $!";
+    my $xi = 'xmlns:xi="http://www.w3.org/2001/XInclude"';
+    my %files = (
+        'outer.xml' => qq{<doc $xi><xi:include href="mid.xml"/></doc>\n},
+        'mid.xml'   => qq{<mid $xi><xi:include href="inner.xml"/></mid>\n},
+        'inner.xml' => qq{<inner>one</inner>\n},
+    );
+    for my $file ( keys %files ) {
+        open( my $out, '>', "$dir/$file" ) or die "$dir/$file: $!";
+        print $out $files{$file};
+    }
+    my $doc = sprintf( "Content-Length: %d\nContent-Location: %s\n\n%s",
+        length( $files{'outer.xml'} ), "$dir/outer.xml", $files{'outer.xml'} );
+    my $count = sub {
+        my ($words) = ( join( ' ', `./swish_lint $dir/outer.xml 2>/dev/null` ) =~ m/total words: (\d+)/ );
+        return $words;
+    };
+    my $before = $count->();
+
+    # one process, so mid.xml is cached when inner.xml changes under it
+    open( my $lint, "| ./swish_lint - > $dir/out 2>/dev/null" ) or die "swish_lint: $!";
+    select( ( select($lint), $| = 1 )[0] );
+    print $lint $doc;
+    sleep 1;
+    open( my $out, '>', "$dir/inner.xml" ) or die "$dir/inner.xml: $!";
+    print $out qq{<inner>one two three</inner>\n};
+    close $out;
+    print $lint $doc;
+    close $lint;
+    my $after = $count->();
+
+    open( my $in, '<', "$dir/out" ) or die "$dir/out: $!";
+    my ($words) = ( do { local $/; <$in> } =~ m/total words: (\d+)/ );
+    close $in;
+    unlink "$dir/out", map {"$dir/$_"} keys %files;
+    rmdir $dir;
+    is( $words, $before + $after, "a cached xinclude is dropped when a file nested in it changes" );
+}
+
+{
+    my $dir = "xinclude-limit-$$";
+    mkdir $dir or die "$dir: $!";
+    my $xi = 'xmlns:xi="http://www.w3.org/2001/XInclude"';
+    my %files = (
+        'outer.xml' => qq{<doc $xi><p>one two</p><xi:include href="inner.xml"/></doc>\n},
+        'inner.xml' => qq{<inner>three four five six</inner>\n},
+    );
+    for my $file ( keys %files ) {
+        open( my $out, '>', "$dir/$file" ) or die "$dir/$file: $!";
+        print $out $files{$file};
+    }
+    my $conf = "$topdir/src/test_configs/limits_xinclude.conf";
+    my $o = join( ' ', `./swish_lint -v --config $conf $dir/outer.xml 2>/dev/null` );
+    unlink map {"$dir/$_"} keys %files;
+    rmdir $dir;
+    like( $o, qr/outer\.xml was truncated.*nwords: 3\b/s, "xincluded tokens count against the includer's limit" );
+}
+
+{
+    my $o = join( ' ', `./swish_lint --dedup 16 $test_docs/words.xml $test_docs/words.xml 2>/dev/null` );
+    like( $o, qr/1 duplicates/, "--dedup spots the repeated doc" );
+    like( $o, qr/total words: $docs{'words.xml'}\b/, "and does not parse it twice" );
+    my $state = "dedup-$$.bin";
+    `./swish_lint --dedup-file $state $test_docs/words.xml 2>/dev/null`;
+    $o = join( ' ', `./swish_lint --dedup-file $state $test_docs/words.xml 2>/dev/null` );
+    unlink $state;
+    like( $o, qr/1 duplicates/, "--dedup-file remembers docs across runs" );
+}
+
+{
+    my $dir = "manifest-$$";
+    mkdir $dir or die "$dir: $!";
+    for my $file (qw( words.xml t.html )) {
+        open( my $in,  '<', "$test_docs/$file" ) or die "$test_docs/$file: $!";
+        open( my $out, '>', "$dir/$file" )       or die "$dir/$file: $!";
+        print $out do { local $/; <$in> };
+    }
+    my $lint = "./swish_lint --manifest $dir.manifest $dir 2>/dev/null";
+    my $o = join( ' ', `$lint` );
+    like( $o, qr/2 files parsed/, "--manifest parses new files" );
+    $o = join( ' ', `$lint` );
+    like( $o, qr/0 files parsed.*2 files unchanged/s, "and skips them next time" );
+    utime( time(), time() + 10, "$dir/t.html" );
+    $o = join( ' ', `$lint` );
+    like( $o, qr/0 files parsed.*2 files unchanged/s, "a touched file hashes the same" );
+    unlink "$dir/t.html";
+    $o = join( ' ', `$lint` );
+    like( $o, qr/deleted: \S+t\.html.*1 files deleted/s, "removed files are reported" );
+    $o = join( ' ', `./swish_lint --manifest $dir.manifest $test_docs/foo.txt 2>/dev/null` );
+    like( $o, qr/1 files parsed.*0 files deleted/s, "files under other paths are not deleted" );
+    $o = join( ' ', `$lint` );
+    like( $o, qr/1 files unchanged\s+0 files deleted.*2 files saved/s,
+        "and are kept in the manifest" );
+    unlink "$dir/words.xml", "$dir.manifest";
+    rmdir $dir;
+}
+
+{
+    # a gzip trailer claiming ~95mb must not size the buffer
+    my $gz = "forged-$$.txt.gz";
+    open( my $in, '<', "$test_docs/multi-member.txt.gz" ) or die "multi-member.txt.gz: $!";
+    my $bytes = do { local $/; <$in> };
+    substr( $bytes, -4 ) = pack( 'V', 95_000_000 );
+    open( my $out, '>', $gz ) or die "$gz: $!";
+    print $out $bytes;
+    close $out;
+    my $o = join( ' ', `SWISH_DEBUG_IO=1 ./swish_lint $gz 2>&1` );
+    unlink $gz;
+    my ($initial) = ( $o =~ m/initial buffer (\d+)/ );
+    cmp_ok( $initial, '<', 1_000_000, "gzip ISIZE is only a hint" );
+}
+
+{
+    my $conf = "$topdir/src/test_configs/limits.conf";
+    my $o = join( ' ', `./swish_lint -v --config $conf $test_docs/words.txt 2>/dev/null` );
+    like( $o, qr/words\.txt was truncated.*nwords: 10\b/s, "TXT stops at its token limit" );
+    $o = join( ' ', `./swish_lint -v --config $conf $test_docs/words.xml 2>/dev/null` );
+    my ($words) = ( $o =~ m/nwords: (\d+)/ );
+    like( $o, qr/words\.xml was truncated/, "application/xml over its byte limit" );
+    cmp_ok( $words, '<', $docs{'words.xml'}, "is only partly parsed" );
+    $conf = "$topdir/src/test_configs/limits_time.conf";
+    $o = join( ' ', `SWISH_DEBUG_CONFIG=1 ./swish_lint --config $conf $test_docs/words.txt 2>&1` );
+    like( $o, qr/limits for TXT: bytes 0 tokens 0 seconds 0\.001/, "time limit is read" );
+
+    # far more text than any machine tokenizes in a millisecond
+    my $big   = "big-$$.txt";
+    my $nbig  = 1_000_000;
+    open( my $out, '>', $big ) or die "$big: $!";
+    print $out "lorem ipsum dolor sit amet\n" x ( $nbig / 5 );
+    close $out;
+    $o = join( ' ', `./swish_lint -v --config $conf $big 2>/dev/null` );
+    unlink $big;
+    ($words) = ( $o =~ m/nwords: (\d+)/ );
+    like( $o, qr/\Q$big\E was truncated/, "TXT tokenizer stops at its time limit" );
+    cmp_ok( $words, '<', $nbig, "before the end of the text" );
+}
+
+{
+    local $ENV{SWISH_CONFIG_CACHE} = 1;
+    my $conf = "limits-$$.conf";
+    open( my $fh, '<', "$topdir/src/test_configs/limits.conf" ) or die "limits.conf: $!";
+    my $xml = do { local $/; <$fh> };
+    close $fh;
+    open( $fh, '>', $conf ) or die "$conf: $!";
+    print $fh $xml;
+    close $fh;
+    utime( time() - 10, time() - 10, $conf );
+
+    `./swish_lint --config $conf $test_docs/words.txt 2>/dev/null`;
+    ok( -s "$conf.cache", "config cache written" );
+    my $o = join( ' ',
+        `SWISH_DEBUG_CONFIG=1 ./swish_lint -v --config $conf $test_docs/words.txt 2>&1` );
+    like( $o, qr/config read from cache.*nwords: 10\b/s, "config read back from cache" );
+
+    open( $fh, '+<', "$conf.cache" ) or die "$conf.cache: $!";
+    seek( $fh, 4, 0 );
+    print $fh pack( 'n', 0xffff );
+    close $fh;
+    $o = join( ' ',
+        `SWISH_DEBUG_CONFIG=1 ./swish_lint -v --config $conf $test_docs/words.txt 2>&1` );
+    like( $o, qr/from another version.*nwords: 10\b/s, "cache from another version is ignored" );
+
+    $xml =~ s/tokens="10"/tokens="12"/;
+    open( $fh, '>', $conf ) or die "$conf: $!";
+    print $fh $xml;
+    close $fh;
+    utime( time() - 5, time() - 5, $conf );
+    $o = join( ' ', `./swish_lint -v --config $conf $test_docs/words.txt 2>/dev/null` );
+    like( $o, qr/nwords: 12\b/, "stale config cache is ignored" );
+    unlink $conf, "$conf.cache";
+}
+
+{
+    my $o = join( ' ',
+        `./swish_lint -v $test_docs/image.html $test_docs/binary.txt $test_docs/has_nulls.txt 2>/dev/null` );
+    like( $o, qr/image\.html skipped as binary: PNG image/, "sniff PNG magic" );
+    like( $o, qr/binary\.txt skipped as binary: control characters.*2 binary files skipped/s,
+        "sniff byte distribution, one stray NUL is still text" );
+}
+
 sub words {
     my $file = shift;
     my $errors = $ENV{SWISH_DEBUG} ? '' : '2>/dev/null';
@@ -134,3 +361,26 @@ sub fromstdin {
     return $count || 0;
 }
 
+
+sub fromstdin_framed {
+    my @files  = @_;
+    my $frames = '';
+    for my $file (@files) {
+        open( my $fh, '<', "$test_docs/$file" ) or die "$test_docs/$file: $!";
+        binmode $fh;
+        my $body = do { local $/; <$fh> };
+        close $fh;
+        $frames .= pack( 'a4 Q> Q> a1 n/a* n/a* n/a*',
+            'SW3F', length($body), time(), "\0", $file, '', '' )
+            . $body;
+    }
+    my $tmp = "framed-$$.bin";
+    open( my $out, '>', $tmp ) or die "$tmp: $!";
+    binmode $out;
+    print $out $frames;
+    close $out;
+    my $o = join( ' ', `./swish_lint -v --framed - < $tmp` );
+    unlink $tmp;
+    my ($count) = ( $o =~ m/total words: (\d+)/ );
+    return $count || 0;
+}
@@ -1,7 +1,7 @@
 #!/usr/bin/env perl
 use strict;
 use warnings;
-use Test::More tests => 6;
+use Test::More tests => 7;
 use SwishTestUtils;
 
 my $topdir = $ENV{SVNDIR} || '..';
@@ -28,3 +28,9 @@ ok( my $xmlns = SwishTestUtils::run_get_stderr(
 #diag($xmlns);
 like( $xmlns, qr/m->name\ += swish:color/, "swish: xmlns" );
 like( $xmlns, qr/m->name\ += foo:name/,    "foo: xmlns" );
+
+# sort settings survive merging the config file into the defaults
+my $props = SwishTestUtils::run_get_stderr(
+    "SWISH_DEBUG=16 ./swish_header --test $test_configs/swish.xml");
+like( $props, qr/p->name\ += foo\s.*?p->presort\ += 0\s+p->sort_length\ += 3\b/s,
+    "presort and sort_length from config file" );
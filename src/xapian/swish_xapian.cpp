@@ -30,10 +30,18 @@
 #include <string>
 #include <map>
 #include <vector>
+#if __cplusplus >= 201103L
+#include <unordered_map>
+#else
+#include <tr1/unordered_map>
+#endif
 
 #include <time.h>
+#include <locale.h>
+#include <limits.h>
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -43,6 +51,13 @@
 #include <ctype.h>
 #include <getopt.h>
 #include <netinet/in.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <signal.h>
 
 #include <xapian.h>
 
@@ -52,14 +67,34 @@
 #include "libswish3.h"
 
 #define SWISH_MAX_OUTPUT_PROPS 64
-#define SWISH_PROP_OUTPUT_PLACEHOLDER '\3'
+#define SWISH_PROP_OUTPUT_LITERAL -2      /* an outputSegment of plain text */
+#define SWISH_OUTPUT_BUFFER 65536         /* bytes of results rendered per write */
 #define SWISH_SPLIT_PROPERTIES 0
-#define SWISH_FACET_FINDER_LIMIT 1000000
-#define SWISH_MAX_FACETS 128
+#define SWISH_FACET_SLOT_BASE 0x10000   /* + prop id: pre-split multi-valued property */
+#define SWISH_SORT_SLOT_BASE  0x20000   /* + prop id: presort key */
 #define SWISH_XAPIAN_VERSION "1.0"
 
 using namespace std;
 
+#if __cplusplus >= 201103L
+typedef unordered_map<string, unsigned long> facet_counts;
+typedef unordered_map<string, Xapian::docid> docid_map;
+#else
+typedef tr1::unordered_map<string, unsigned long> facet_counts;
+typedef tr1::unordered_map<string, Xapian::docid> docid_map;
+#endif
+
+/*
+ * A search that cannot be made as asked: an unknown property name, a
+ * malformed request field. Thrown before anything that would croak on
+ * the same input, so the server can answer it and carry on.
+ */
+class RequestError {
+  public:
+    string msg;
+    RequestError(const string & m) : msg(m) {}
+};
+
 /* prototypes */
 int main(
     int argc,
@@ -85,18 +120,70 @@ int search(
     xmlChar *output_format,
     xmlChar *sort_string,
     unsigned int results_offset,
-    unsigned int results_limit  
+    unsigned int results_limit,
+    FILE *out,
+    vector<unsigned int> *docids
+);
+static void
+json_escape(
+    string & buf,
+    const char *s,
+    size_t len
 );
 static boolean 
 delete_document(
     xmlChar *uri
 );
+static char *
+add_limit(
+    char *query_extra,
+    const char *limit
+);
+static boolean
+known_property(
+    xmlChar *propname
+);
+static void
+refresh_readable_index(
+    char *dbpath
+);
+static void
+serve(
+    FILE *in,
+    char *dbpath
+);
+static void
+serve_socket(
+    char *path,
+    char *dbpath
+);
+static void
+batch_begin(
+);
+static void
+batch_end(
+    off_t bytes
+);
+static void
+batch_finish(
+);
 
 char*
 make_header_path(
     char *dbpath
 );
 
+char*
+make_manifest_path(
+    char *dbpath
+);
+
+char*
+make_shard_path(
+    char *dbpath,
+    int n
+);
+
 static void
 get_db_data(
     char *dbpath,
@@ -113,6 +200,11 @@ static
 static
     Xapian::Database::Database
     rdb;
+#ifdef HAVE_XAPIAN_GET_REVISION
+static
+    vector<Xapian::Database>
+    rdb_parts;          // each index in rdb, for its revision
+#endif
 static
     Xapian::Stem
 stemmer(
@@ -127,20 +219,49 @@ static int
     skip_duplicates = 0;
 static int
     overwrite = 0;
-static map<string, int>
-    property_name_id_map;
-static map<string, unsigned long> 
-    facets[SWISH_MAX_FACETS];
+static unsigned long
+    batch_size = 0;
+static unsigned long
+    flush_mb = 0;
+static unsigned long
+    batch_docs = 0;
+static off_t
+    unflushed_bytes = 0;
+static boolean
+    in_transaction = SWISH_FALSE;
+static int
+    nshards = 0;
+static int
+    shard_id = -1;
 static unsigned int
     num_facets;
+static unsigned int
+    facet_top = 0;
+static boolean
+    json_output = SWISH_FALSE;
 static swish_StringList 
     *facet_list;
 static
     vector <
     bool >
     updated;
+static docid_map
+    added;              // --overwrite: unique id => docid, for URIs seen twice
 static swish_3 *
     s3;
+static
+    Xapian::QueryParser
+    qparser;
+static boolean
+    qparser_ready = SWISH_FALSE;
+static time_t
+    header_mtime = 0;
+static swish_QueryCache *
+    qcache = NULL;
+static unsigned long
+    cache_entries = SWISH_QUERY_CACHE_ENTRIES;
+static size_t
+    cache_bytes = SWISH_QUERY_CACHE_SIZE;
 
 extern int
     SWISH_DEBUG;
@@ -152,6 +273,7 @@ static struct option
     {"debug",       required_argument, 0,   'd'},
     {"help",        no_argument, 0,         'h'},
     {"index",       required_argument, 0,   'i'},
+    {"incremental", no_argument, 0,         'I'},
     {"Skip-duplicates", no_argument, 0,     'S'},
     {"sort",        required_argument, 0,   's'},
     {"stemmer",     required_argument, 0,   't'},
@@ -166,6 +288,15 @@ static struct option
     {"max",         required_argument, 0,   'm'},
     {"follow-symlinks", no_argument,   0,   'l'},
     {"limit",       required_argument, 0,   'L'},
+    {"batch-size",  required_argument, 0,   'B'},
+    {"flush-mb",    required_argument, 0,   'M'},
+    {"shards",      required_argument, 0,   'N'},
+    {"facet-top",   required_argument, 0,   'k'},
+    {"serve",       no_argument, 0,         'Q'},
+    {"socket",      required_argument, 0,   'U'},
+    {"cache-size",  required_argument, 0,   'C'},
+    {"cache-mb",    required_argument, 0,   'E'},
+    {"json",        no_argument, 0,         'j'},
     {0, 0, 0, 0}
 };
 
@@ -178,20 +309,30 @@ usage(
     printf("usage: swish_xapian [opts] [- | file(s)]\n");
     printf(" opts:\n");
     printf("  -b, --begin=NUM           begin results at NUM\n");
+    printf("  -B, --batch-size=NUM      add documents in transactions of NUM (Index BatchSize)\n");
     printf("  -c, --config=FILE         name a config file for indexing\n");
+    printf("  -C, --cache-size=NUM      with --serve, cache the results of NUM queries (0 is off)\n");
     printf("  -d, --debug[=NUM]         set debug level (see also env vars in swish_lint)\n");
     printf("  -D, --Delete              with --filelist, remove files from index\n");
+    printf("  -E, --cache-mb=NUM        with --serve, cache at most NUM MB of results\n");
     printf("  -F, --Facets=STRING       list result property counts according to STRING \"prop1 prop2\"\n");
     printf("  -f, --filelist=FILE       index filenames in FILE (one per line)\n");
     printf("  -h, --help                print this usage statement\n");
-    printf("  -i, --index=PATH          name a directory for the index files\n");
+    printf("  -i, --index=PATH          name a directory for the index files (repeat to search several)\n");
+    printf("  -I, --incremental         skip files unchanged since the last run, delete removed ones\n");
+    printf("  -j, --json                print results as JSON Lines, one object per result\n");
+    printf("  -k, --facet-top=NUM       list only the NUM most frequent values of each facet\n");
     printf("  -l, --follow-symlinks     follow symbolic links when indexing\n");
     printf("  -L, --limit=STRING        limit results to a range of property values \"prop low high\"\n");
     printf("  -m, --max=NUM             maximum number of results to return (defaults to 100)\n");
+    printf("  -M, --flush-mb=NUM        flush to disk after NUM MB of documents (Index FlushMB)\n");
+    printf("  -N, --shards=NUM          index in NUM parallel workers, then merge (implies -o)\n");
     printf("  -o, --overwrite           overwrite existing index (fresh start)\n");
     printf("  -q, --query=STRING        search for STRING in index\n");
+    printf("  -Q, --serve               answer queries read from stdin, one per line, until EOF\n");
     printf("  -S, --Skip-duplicates     ignore duplicate filenames (do not update them in index)\n");
     printf("  -s, --sort=STRING         sort results according to STRING \"prop1 prop2 ...\"\n");
+    printf("  -U, --socket=PATH         answer queries from clients of a Unix socket at PATH\n");
     printf("  -t, --stemmer=LANG        apply term stemming in language LANG (default is 'none')\n");
     printf("  -x, --output=STRING       format search results with STRING\n");
     printf("\n%s\n", descr);
@@ -221,56 +362,171 @@ usage(
 #endif
 
 
-class FacetFinder : public Xapian::MatchDecider {
+/*
+ * A multi-valued property is also stored pre-split, in the value slot
+ * SWISH_FACET_SLOT_BASE + its id, as (varint length, bytes) pairs, so
+ * that counting facets never has to search for SWISH_TOKENPOS_BUMPER.
+ */
+static string
+facet_serialise(
+    const xmlChar *buf
+)
+{
+    string
+        packed;
+    const xmlChar *
+        end;
+    size_t
+        len;
+
+    while (buf != NULL) {
+        end = xmlStrstr(buf, (const xmlChar *)SWISH_TOKENPOS_BUMPER);
+        len = end != NULL ? (size_t)(end - buf) : (size_t)xmlStrlen(buf);
+        while (len >= 0x80) {
+            packed += (char)((len & 0x7f) | 0x80);
+            len >>= 7;
+        }
+        packed += (char)len;
+        packed.append((const char *)buf, end != NULL ? end - buf : xmlStrlen(buf));
+        buf = end != NULL ? end + 1 : NULL;
+    }
+    return packed;
+}
+
+static void
+count_packed_values(
+    const string & packed,
+    facet_counts & counts
+)
+{
+    size_t
+        pos = 0,
+        len;
+    int
+        shift;
+
+    while (pos < packed.size()) {
+        len = 0;
+        shift = 0;
+        while (pos < packed.size() && (packed[pos] & 0x80)) {
+            len |= (size_t)(packed[pos++] & 0x7f) << shift;
+            shift += 7;
+        }
+        if (pos >= packed.size())
+            return;             /* corrupt; count what we have */
+        len |= (size_t)(unsigned char)packed[pos++] << shift;
+        if (len > packed.size() - pos)
+            return;
+        if (len)
+            ++counts[packed.substr(pos, len)];
+        pos += len;
+    }
+}
+
+/* indexes written before the facet slots existed */
+static void
+count_bumped_values(
+    const string & value,
+    facet_counts & counts
+)
+{
+    size_t
+        pos = 0,
+        end;
+
+    while (pos < value.size()) {
+        end = value.find(SWISH_TOKENPOS_BUMPER[0], pos);
+        if (end == string::npos)
+            end = value.size();
+        if (end > pos)
+            ++counts[value.substr(pos, end - pos)];
+        pos = end + 1;
+    }
+}
+
+/*
+ * Counts the values of each --Facets property over every match, in hash
+ * maps. Property names are resolved to slots once, when it is made.
+ */
+class FacetCounter : public Xapian::MatchDecider {
   public:
+    vector<Xapian::valueno> slots;
+    mutable vector<facet_counts> counts;
+
+    FacetCounter(swish_StringList *names) {
+        unsigned int i;
+        for (i = 0; names != NULL && i < names->n; i++) {
+            if (!known_property(names->word[i]))
+                throw RequestError(string("No such PropertyName: ") + (char*)names->word[i]);
+            slots.push_back(swish_property_get_id(names->word[i], s3->config->properties));
+        }
+        counts.resize(slots.size());
+    }
+
     bool operator()(const Xapian::Document &doc) const {
-        //SWISH_DEBUG_MSG("examining doc %s", doc.get_value(1).c_str());
-	    int i;
-        
-        for (i=0; i < num_facets; i++) {
-            int prop_id = property_name_id_map[string((const char*)facet_list->word[i])];
-            //SWISH_DEBUG_MSG("prop_id [%d]", prop_id);
-            string value(doc.get_value(prop_id));
-            const xmlChar *buf = (const xmlChar *)value.c_str();
-            const xmlChar *substr;
-            while ((substr = xmlStrstr(buf, (const xmlChar *)SWISH_TOKENPOS_BUMPER)) != NULL) {
-                int sub_len = substr - buf;
-                ++facets[i][string((const char *)xmlStrsub(buf, 0, sub_len))];
-                buf = substr + 1; /* move ahead */
-            }
-            // last one
-            if (buf != NULL) {
-                ++facets[i][string((const char *)buf)];
-            }
-            //SWISH_DEBUG_MSG("facet '%s' => %ld (0x%lx)", 
-                  //value.c_str(), facets[i][value], &facets[i]);
+        unsigned int i;
+        for (i = 0; i < slots.size(); i++) {
+            string packed(doc.get_value(SWISH_FACET_SLOT_BASE + slots[i]));
+            if (!packed.empty())
+                count_packed_values(packed, counts[i]);
+            else
+                count_bumped_values(doc.get_value(slots[i]), counts[i]);
         }
-	    return true;
-    };
-    
+        return true;
+    }
 };
 
-static void
-facet_finder_init()
+static bool
+by_count(
+    const pair<string, unsigned long> & a,
+    const pair<string, unsigned long> & b
+)
 {
-    int i;
-    for (i=0; i<num_facets; i++) {
-        map<string,unsigned long> facet_counter;
-        facets[i] = facet_counter;
-        property_name_id_map[string((const char*)facet_list->word[i])] = 
-            swish_property_get_id(facet_list->word[i], s3->config->properties);
-    }
+    return a.second != b.second ? a.second > b.second : a.first < b.first;
 }
 
+/*
+ * print each facet's top facet_top values (all of them if 0), most frequent
+ * first. with json_output, each facet is one {"facet":..,"counts":{..}} line.
+ */
 static void
-facet_finder_show()
+show_facets(
+    FacetCounter & counter,
+    FILE *out
+)
 {
-    int i;
-    for (i=0; i<num_facets; i++) {
-        printf("Facet %s (%d)\n", facet_list->word[i], i);
-        map<string,unsigned long>::const_iterator it;
-        for (it=facets[i].begin(); it != facets[i].end(); ++it) {
-            printf(" :%s: %ld\n", it->first.c_str(), it->second);
+    unsigned int
+        i,
+        j,
+        top;
+    string
+        line;
+    char
+        num[32];
+
+    for (i = 0; i < counter.slots.size(); i++) {
+        vector< pair<string, unsigned long> >
+            sorted(counter.counts[i].begin(), counter.counts[i].end());
+        top = facet_top && facet_top < sorted.size() ? facet_top : sorted.size();
+        partial_sort(sorted.begin(), sorted.begin() + top, sorted.end(), by_count);
+
+        if (json_output) {
+            line = "{\"facet\":\"";
+            json_escape(line, (char*)facet_list->word[i], xmlStrlen(facet_list->word[i]));
+            line += "\",\"counts\":{";
+            for (j = 0; j < top; j++) {
+                line += j ? ",\"" : "\"";
+                json_escape(line, sorted[j].first.data(), sorted[j].first.size());
+                snprintf(num, sizeof(num), "\":%lu", sorted[j].second);
+                line += num;
+            }
+            line += "}}\n";
+            fwrite(line.data(), 1, line.size(), out);
+            continue;
+        }
+        fprintf(out, "Facet %s (%d)\n", facet_list->word[i], i);
+        for (j = 0; j < top; j++) {
+            fprintf(out, " :%s: %ld\n", sorted[j].first.c_str(), sorted[j].second);
         }
     }
 }
@@ -434,6 +690,51 @@ add_metanames(
     }
 }
 
+/*
+ * A presort property also gets a sort key, in the value slot
+ * SWISH_SORT_SLOT_BASE + its id, made by swish_property_sort_key() for
+ * the LC_COLLATE locale the index was created under. Sorting compares
+ * those keys as bytes and never normalizes anything per query.
+ */
+static void
+add_sort_key(
+    Xapian::Document & doc,
+    swish_Property *prop,
+    const string & value
+)
+{
+    xmlChar *
+        key;
+    int
+        len;
+
+    if (!prop->presort || value.empty())
+        return;
+    key = swish_property_sort_key(prop, BAD_CAST value.c_str(), &len);
+    doc.add_value(SWISH_SORT_SLOT_BASE + prop->id, string((const char *)key, len));
+    swish_xfree(key);
+}
+
+/* the docinfo properties are not in the config, but sort keys are made alike */
+static void
+add_builtin_sort_key(
+    Xapian::Document & doc,
+    int id,
+    int type,
+    const string & value
+)
+{
+    swish_Property
+        prop;
+
+    memset(&prop, 0, sizeof(prop));
+    prop.id = id;
+    prop.type = type;
+    prop.ignore_case = SWISH_TRUE;
+    prop.presort = SWISH_TRUE;
+    add_sort_key(doc, &prop, value);
+}
+
 static void
 add_properties(
     xmlBufferPtr buffer,
@@ -473,6 +774,9 @@ add_properties(
     else {
         prop_buf = string((const char *)xmlBufferContent(buffer));
     }
+    if (xmlStrstr(xmlBufferContent(buffer), (const xmlChar *)SWISH_TOKENPOS_BUMPER) != NULL) {
+        doc.add_value(SWISH_FACET_SLOT_BASE + prop->id, facet_serialise(xmlBufferContent(buffer)));
+    }
     if (prop->type == SWISH_PROP_INT && prop_buf.length()) {
         //SWISH_DEBUG_MSG("add prop %s: %s", name, prop_buf.c_str());
         doc.add_value(prop->id, Xapian::sortable_serialise(string_to_int(prop_buf)));
@@ -480,6 +784,7 @@ add_properties(
     else {
         doc.add_value(prop->id, prop_buf);
     }
+    add_sort_key(doc, prop, prop_buf);
 }
 
 void
@@ -502,6 +807,22 @@ handler(
         swish_nb_debug(parser_data->metanames, BAD_CAST "MetaName");
     }
 
+    // Nothing was parsed from a binary body; drop any older text version
+    if (parser_data->docinfo->binary != NULL) {
+        string
+            binary_id = SWISH_PREFIX_URL + string((const char *)parser_data->docinfo->uri);
+        if (verbose)
+            printf("%s   ... skipped (%s)\n", (char *)parser_data->docinfo->uri,
+                   parser_data->docinfo->binary);
+        if (!overwrite && wdb.term_exists(binary_id))
+            wdb.delete_document(binary_id);
+        else if (overwrite && added.count(binary_id)) {
+            wdb.delete_document(added[binary_id]);
+            added.erase(binary_id);
+        }
+        return;
+    }
+
     // Put the data in the document
     Xapian::Document newdocument;
     xmlChar *
@@ -556,11 +877,45 @@ handler(
     // title is special value
     newdocument.add_value(SWISH_PROP_TITLE_ID, string((const char *)title));
 
+    add_builtin_sort_key(newdocument, SWISH_PROP_MTIME_ID, SWISH_PROP_DATE,
+                         long_to_string(parser_data->docinfo->mtime));
+    add_builtin_sort_key(newdocument, SWISH_PROP_DOCPATH_ID, SWISH_PROP_STRING,
+                         string((const char *)parser_data->docinfo->uri));
+    add_builtin_sort_key(newdocument, SWISH_PROP_SIZE_ID, SWISH_PROP_INT,
+                         long_to_string(parser_data->docinfo->size));
+    add_builtin_sort_key(newdocument, SWISH_PROP_MIME_ID, SWISH_PROP_STRING,
+                         string((const char *)parser_data->docinfo->mime));
+    add_builtin_sort_key(newdocument, SWISH_PROP_PARSER_ID, SWISH_PROP_STRING,
+                         string((const char *)parser_data->docinfo->parser));
+    add_builtin_sort_key(newdocument, SWISH_PROP_NWORDS_ID, SWISH_PROP_INT,
+                         long_to_string(parser_data->docinfo->nwords));
+    add_sort_key(newdocument,
+                 (swish_Property *)swish_hash_fetch(s3->config->properties, BAD_CAST SWISH_PROP_TITLE),
+                 string((const char *)title));
+
     // add all metanames and properties
     xmlHashScan(parser_data->metanames->hash, (xmlHashScanner)add_metanames, s3->config);
     xmlHashScan(parser_data->properties->hash, (xmlHashScanner)add_properties, &newdocument);
 
-    if (!skip_duplicates) {
+    batch_begin();
+    if (overwrite) {
+        // A fresh index has nothing to replace but what this run added,
+        // so skip the unique term lookup and remember the docid instead
+        docid_map::iterator seen = added.find(unique_id);
+        if (seen != added.end()) {
+            wdb.replace_document(seen->second, newdocument);
+            if (verbose) {
+                cout << "        .... updated." << endl;
+            }
+        }
+        else {
+            added[unique_id] = wdb.add_document(newdocument);
+            if (verbose) {
+                cout << "         .... added." << endl;
+            }
+        }
+    }
+    else if (!skip_duplicates) {
         // If this document has already been indexed, update the existing
         // entry.
         try {
@@ -599,6 +954,62 @@ handler(
             }
         }
     }
+    batch_end(parser_data->docinfo->size);
+}
+
+/*
+ * With a batch size or flush size, every document is added inside a
+ * transaction, so Xapian never autoflushes on its own. A transaction
+ * is committed every batch_size documents (or flush_mb MB, if sooner),
+ * and the database is flushed once flush_mb MB of documents have been
+ * committed since the last flush, or at every commit without flush_mb.
+ */
+static void
+batch_begin(
+)
+{
+    if ((batch_size || flush_mb) && !in_transaction) {
+        wdb.begin_transaction(false);
+        in_transaction = SWISH_TRUE;
+    }
+}
+
+static void
+batch_end(
+    off_t bytes
+)
+{
+    off_t
+        flush_bytes = (off_t)flush_mb * 1048576;
+
+    if (!in_transaction)
+        return;
+
+    batch_docs++;
+    unflushed_bytes += bytes;
+    if ((batch_size && batch_docs >= batch_size)
+        || (flush_mb && unflushed_bytes >= flush_bytes)) {
+        wdb.commit_transaction();
+        in_transaction = SWISH_FALSE;
+        batch_docs = 0;
+        if (!flush_mb || unflushed_bytes >= flush_bytes) {
+            wdb.flush();
+            unflushed_bytes = 0;
+        }
+    }
+}
+
+/* commit a part-filled batch; the caller flushes */
+static void
+batch_finish(
+)
+{
+    if (in_transaction) {
+        wdb.commit_transaction();
+        in_transaction = SWISH_FALSE;
+    }
+    batch_docs = 0;
+    unflushed_bytes = 0;
 }
 
 int
@@ -677,6 +1088,39 @@ make_header_path(
     return header;
 }
 
+/* the manifest lives beside the header, inside the index dir */
+char *
+make_manifest_path(
+    char *dbpath
+)
+{
+    char *manifest;
+    int len;
+    len = strlen(dbpath) + 1 + strlen(SWISH_MANIFEST_FILE) + 1;
+    manifest = (char*)swish_xmalloc(len);
+    if (!snprintf(manifest, len, "%s%c%s", dbpath, SWISH_PATH_SEP, SWISH_MANIFEST_FILE)) {
+        SWISH_CROAK("Failed to make manifest path from %s%c%s", dbpath, SWISH_PATH_SEP, SWISH_MANIFEST_FILE);
+    }
+    return manifest;
+}
+
+/* shards sit beside the index they are merged into */
+char *
+make_shard_path(
+    char *dbpath,
+    int n
+)
+{
+    char *shard;
+    int len;
+    len = strlen(dbpath) + 32;
+    shard = (char*)swish_xmalloc(len);
+    if (!snprintf(shard, len, "%s.shard%d", dbpath, n)) {
+        SWISH_CROAK("Failed to make shard path from %s.shard%d", dbpath, n);
+    }
+    return shard;
+}
+
 int
 open_readable_index(
     char *dbpath,
@@ -694,11 +1138,16 @@ open_readable_index(
 
     try {
         rdb = Xapian::Database::Database(dbpath);
+#ifdef HAVE_XAPIAN_GET_REVISION
+        rdb_parts.assign(1, rdb);
+#endif
 
         header = make_header_path(dbpath);
         if (swish_fs_file_exists(BAD_CAST header)) {
             swish_header_merge(header, s3->config);
+            header_mtime = swish_fs_get_file_mtime(BAD_CAST header);
         }
+        swish_xfree(header);
         
         // check for stemmer lang
         if (stemmer_lang != NULL
@@ -755,34 +1204,131 @@ get_control_char(
     return se;
 }
 
+/*
+ * an output template compiled into runs of literal text and property
+ * values, so a result is rendered a segment, not a character, at a time
+ */
+struct outputSegment
+{
+    int     prop;       // SWISH_PROP_OUTPUT_LITERAL for text
+    string  text;       // the text, or the property name
+    boolean number;     // value is an integer: a JSON number, not a string
+    boolean serialised; // ... kept as Xapian::sortable_serialise() bytes
+};
+
 struct outputFormat 
 {
-    string  tmpl;
-    int     props[SWISH_MAX_OUTPUT_PROPS];
-    int     num_props;
+    vector<outputSegment>   segs;
+    int                     num_props;
 };
 
+static void
+add_literal(
+    outputFormat *of,
+    const char *text,
+    size_t len
+)
+{
+    outputSegment seg;
+
+    if (!of->segs.empty() && of->segs.back().prop == SWISH_PROP_OUTPUT_LITERAL) {
+        of->segs.back().text.append(text, len);
+        return;
+    }
+    seg.prop = SWISH_PROP_OUTPUT_LITERAL;
+    seg.text.assign(text, len);
+    of->segs.push_back(seg);
+}
+
+static void
+add_output_prop(
+    outputFormat *of,
+    int prop_id,
+    const char *name
+)
+{
+    outputSegment seg;
+    swish_Property *prop;
+
+    seg.prop = prop_id;
+    seg.text = name;
+    seg.number = SWISH_FALSE;
+    seg.serialised = SWISH_FALSE;
+
+    // the builtin sizes are stored as decimal strings; INT PropertyNames sortable
+    if (prop_id == SWISH_PROP_SIZE_ID || prop_id == SWISH_PROP_NWORDS_ID) {
+        seg.number = SWISH_TRUE;
+    }
+    else if ((prop = (swish_Property*)swish_hash_fetch(s3->config->properties,
+                                                      BAD_CAST name)) != NULL
+             && prop->type == SWISH_PROP_INT) {
+        seg.number = SWISH_TRUE;
+        seg.serialised = SWISH_TRUE;
+    }
+    of->segs.push_back(seg);
+    of->num_props++;
+}
+
 static outputFormat
 init_outputFormat(
 )
 {
     outputFormat of;
-    char tmpl[] = "%c %c \"%c\" \"%c\"\n";
-    char buf[strlen(tmpl)+1];
-    sprintf(buf, tmpl, 
-        SWISH_PROP_OUTPUT_PLACEHOLDER, 
-        SWISH_PROP_OUTPUT_PLACEHOLDER, 
-        SWISH_PROP_OUTPUT_PLACEHOLDER, 
-        SWISH_PROP_OUTPUT_PLACEHOLDER);
-    of.tmpl = buf;
-    of.props[0] = SWISH_PROP_RANK_ID;
-    of.props[1] = SWISH_PROP_DOCPATH_ID;
-    of.props[2] = SWISH_PROP_TITLE_ID;
-    of.props[3] = SWISH_PROP_SIZE_ID;
-    of.num_props = 4;
+
+    of.num_props = 0;
+    add_output_prop(&of, SWISH_PROP_RANK_ID, SWISH_PROP_RANK);
+    add_literal(&of, " ", 1);
+    add_output_prop(&of, SWISH_PROP_DOCPATH_ID, SWISH_PROP_DOCPATH);
+    add_literal(&of, " \"", 2);
+    add_output_prop(&of, SWISH_PROP_TITLE_ID, SWISH_PROP_TITLE);
+    add_literal(&of, "\" \"", 3);
+    add_output_prop(&of, SWISH_PROP_SIZE_ID, SWISH_PROP_SIZE);
+    add_literal(&of, "\"\n", 2);
     return of;
 }
 
+/* SWISH_TRUE if swish_property_get_id() knows propname (and so won't croak) */
+static boolean
+known_property(
+    xmlChar *propname
+)
+{
+    return swish_property_get_builtin_id(propname) != -2
+        || swish_hash_exists(s3->config->properties, propname);
+}
+
+/*
+ * every property in a sort string must exist before
+ * swish_stringlist_parse_sort_string() sees it
+ */
+static void
+check_sort_string(
+    xmlChar *sort_string
+)
+{
+    swish_StringList *
+        sl;
+    unsigned int
+        i;
+    string
+        bad;
+
+    sl = swish_stringlist_build(sort_string);
+    for (i = 0; i < sl->n; i++) {
+        if (!known_property(sl->word[i])) {
+            bad = (char*)sl->word[i];
+            break;
+        }
+        if (i + 1 < sl->n
+            && (xmlStrEqual(sl->word[i+1], BAD_CAST "asc")
+                || xmlStrEqual(sl->word[i+1], BAD_CAST "desc")))
+            i++;
+    }
+    swish_stringlist_free(sl);
+    if (!bad.empty())
+        throw RequestError("No such PropertyName: " + bad);
+}
+
 static void
 build_output_format(
     xmlChar *tmpl,
@@ -798,7 +1344,7 @@ build_output_format(
 
     // reset in case it's been set before
     of->num_props = 0;
-    of->tmpl.clear();
+    of->segs.clear();
 
     while (*tmpl) {
         switch (*tmpl) {
@@ -828,28 +1374,32 @@ build_output_format(
                 tmpl = ++tmp;
                 
                 //SWISH_DEBUG_MSG("propname = '%s'", propname);
+                if (!known_property(propname)) {
+                    string bad((char*)propname);
+                    swish_xfree(propname);
+                    throw RequestError("No such PropertyName in output template: " + bad);
+                }
                 prop_id = swish_property_get_id(propname, s3->config->properties);
                 
                 if (of->num_props == SWISH_MAX_OUTPUT_PROPS) {
-                    SWISH_CROAK("Max number of PropertyNames reached in output template: %d",
-                        SWISH_MAX_OUTPUT_PROPS);
+                    swish_xfree(propname);
+                    throw RequestError("Too many PropertyNames in output template");
                 }
                 
                 // update the outputFormat
-                of->tmpl += SWISH_PROP_OUTPUT_PLACEHOLDER;
-                of->props[of->num_props++] = prop_id;
+                add_output_prop(of, prop_id, (char*)propname);
                 swish_xfree(propname);
                 
                 break;
 
             case '\\':             /* print format controls */
                 tmpl = get_control_char(tmpl, &ctrl);
-                of->tmpl += ctrl;
+                add_literal(of, (char*)&ctrl, 1);
                 break;
 
 
             default:               /* verbatim */
-                of->tmpl += *tmpl;
+                add_literal(of, (char*)tmpl, 1);
                 tmpl++;
                 break;
                 
@@ -857,6 +1407,170 @@ build_output_format(
     }    
 }
 
+/*
+ * length of the well-formed UTF-8 sequence at s (at most len bytes),
+ * or 0 if it is not one: a stray continuation byte, a cut-off or
+ * overlong sequence, a surrogate or anything past U+10FFFF.
+ */
+static size_t
+utf8_seq_len(
+    const unsigned char *s,
+    size_t len
+)
+{
+    size_t n, i;
+    unsigned char lo = 0x80, hi = 0xBF;
+
+    if (s[0] < 0x80)
+        return 1;
+    else if (s[0] >= 0xC2 && s[0] <= 0xDF)
+        n = 2;
+    else if (s[0] >= 0xE0 && s[0] <= 0xEF) {
+        n = 3;
+        if (s[0] == 0xE0)
+            lo = 0xA0;
+        else if (s[0] == 0xED)
+            hi = 0x9F;
+    }
+    else if (s[0] >= 0xF0 && s[0] <= 0xF4) {
+        n = 4;
+        if (s[0] == 0xF0)
+            lo = 0x90;
+        else if (s[0] == 0xF4)
+            hi = 0x8F;
+    }
+    else
+        return 0;
+
+    if (n > len || s[1] < lo || s[1] > hi)
+        return 0;
+    for (i = 2; i < n; i++) {
+        if (s[i] < 0x80 || s[i] > 0xBF)
+            return 0;
+    }
+    return n;
+}
+
+/*
+ * append len bytes of s to buf as the inside of a JSON string.
+ * bytes that are not valid UTF-8 become U+FFFD.
+ */
+static void
+json_escape(
+    string & buf,
+    const char *s,
+    size_t len
+)
+{
+    char hex[8];
+    size_t i, n;
+
+    for (i = 0; i < len; i++) {
+        if ((unsigned char)s[i] >= 0x80) {
+            n = utf8_seq_len((const unsigned char*)s + i, len - i);
+            if (n == 0) {
+                buf += "\\ufffd";
+            }
+            else {
+                buf.append(s + i, n);
+                i += n - 1;
+            }
+            continue;
+        }
+        switch (s[i]) {
+            case '"':   buf += "\\\""; break;
+            case '\\':  buf += "\\\\"; break;
+            case '\n':  buf += "\\n"; break;
+            case '\r':  buf += "\\r"; break;
+            case '\t':  buf += "\\t"; break;
+            default:
+                if ((unsigned char)s[i] < 0x20) {
+                    snprintf(hex, sizeof(hex), "\\u%04x", (unsigned char)s[i]);
+                    buf += hex;
+                }
+                else {
+                    buf += s[i];
+                }
+        }
+    }
+}
+
+/*
+ * append one result to buf: the template's segments in turn, or with
+ * json_output one JSON object per line keyed by property name.
+ */
+static void
+render_result(
+    string & buf,
+    outputFormat & of,
+    Xapian::MSetIterator & iterator
+)
+{
+    Xapian::Document doc;
+    string value;
+    char scratch[64];
+    struct tm tm;
+    time_t epoch;
+    size_t i, len;
+    boolean first = SWISH_TRUE;
+
+    doc = iterator.get_document();
+    if (json_output)
+        buf += '{';
+
+    for (i = 0; i < of.segs.size(); i++) {
+        outputSegment & seg = of.segs[i];
+        if (seg.prop == SWISH_PROP_OUTPUT_LITERAL) {
+            if (!json_output)
+                buf += seg.text;
+            continue;
+        }
+
+        if (json_output) {
+            if (!first)
+                buf += ',';
+            first = SWISH_FALSE;
+            buf += '"';
+            json_escape(buf, seg.text.data(), seg.text.size());
+            buf += "\":";
+        }
+
+        if (seg.prop == SWISH_PROP_RANK_ID) {
+            len = snprintf(scratch, sizeof(scratch), json_output ? "%d0" : "%3d0",
+                iterator.get_percent());
+            buf.append(scratch, len);
+            continue;
+        }
+
+        value = doc.get_value(seg.prop);
+        if (seg.prop == SWISH_PROP_MTIME_ID) {
+            epoch = (time_t)strtol(value.c_str(), NULL, 10);
+            len = strftime(scratch, sizeof(scratch), SWISH_DATE_FORMAT_STRING,
+                localtime_r(&epoch, &tm));
+            value.assign(scratch, len);
+        }
+        else if (seg.serialised && !value.empty()) {
+            len = snprintf(scratch, sizeof(scratch), "%.0f",
+                Xapian::sortable_unserialise(value));
+            value.assign(scratch, len);
+        }
+        if (json_output && seg.number) {
+            buf += value.empty() ? "null" : value;
+        }
+        else if (json_output) {
+            buf += '"';
+            json_escape(buf, value.data(), value.size());
+            buf += '"';
+        }
+        else {
+            buf += value;
+        }
+    }
+
+    if (json_output)
+        buf += "}\n";
+}
+
 struct PropertyValueRangeProcessor : public Xapian::ValueRangeProcessor {
     swish_Property *prop;
     PropertyValueRangeProcessor(swish_Property *prop_) : prop(prop_) {}
@@ -965,137 +1679,147 @@ add_property_range_processor(
 }
 
 
-int
-search(
+/*
+ * the value slot to sort on for propname: its presort key if the index
+ * was built with them, else the raw property value.
+ */
+static int
+sort_slot(
+    xmlChar *propname
+)
+{
+    swish_Property *
+        prop;
+    int
+        prop_id = swish_property_get_id(propname, s3->config->properties);
+
+    if (prop_id < 0 || !swish_hash_exists(s3->config->index, BAD_CAST SWISH_INDEX_SORT_KEYS))
+        return prop_id;
+
+    // the docinfo properties always have one
+    if (swish_property_get_builtin_id(propname) != -2)
+        return SWISH_SORT_SLOT_BASE + prop_id;
+
+    prop = (swish_Property *)swish_hash_fetch(s3->config->properties, propname);
+    return prop->presort ? SWISH_SORT_SLOT_BASE + prop_id : prop_id;
+}
+
+/*
+ * run qstr and write the results to out. the docids of the results
+ * printed are appended to docids, unless it is NULL. returns how many
+ * results were printed. a bad property name throws RequestError and a
+ * bad query Xapian::QueryParserError; nothing allocated here outlives
+ * the throw.
+ */
+int
+search(
     char *qstr,
     xmlChar *output_format,
     xmlChar *sort_string,
     unsigned int results_offset,
-    unsigned int results_limit
+    unsigned int results_limit,
+    FILE *out,
+    vector<unsigned int> *docids
 )
 {
     int total_matches;
-    Xapian::Enquire * enquire;
+    Xapian::Enquire enquire(rdb);
     Xapian::Query query;
-    Xapian::QueryParser qparser;
     Xapian::MSet mset;
     Xapian::MSetIterator iterator;
-    Xapian::Document doc;
     Xapian::MultiValueSorter sorter;
-    FacetFinder facet_finder;
+    FacetCounter facet_counter(num_facets ? facet_list : NULL);
     outputFormat of;
-    int i, j;
-    const char *ofbuf;
+    int i;
+    string obuf;
     swish_StringList *sort_sl;
 
     if (sort_string != NULL) {
+        check_sort_string(sort_string);
         sort_sl = swish_stringlist_parse_sort_string(sort_string, s3->config);
-    }
-    else {
-        sort_sl = NULL;
+        swish_stringlist_debug(sort_sl);
+        int prop_id;
+        bool dir;
+        for (i=sort_sl->n-1; i>0; i-=2) {
+            prop_id = sort_slot(sort_sl->word[i-1]);
+            dir = xmlStrEqual(sort_sl->word[i], BAD_CAST "asc") ? false : true;
+            SWISH_DEBUG_MSG("sorter.add(%d, %d)", prop_id, dir);
+            sorter.add(prop_id, dir);
+        }
+        swish_stringlist_free(sort_sl);
+        enquire.set_sort_by_key(&sorter, true);
     }
             
     total_matches = 0;
-    qparser.set_stemmer(stemmer);
-    qparser.set_database(rdb);
     of = init_outputFormat();
     if (output_format) {
         build_output_format(output_format, &of);
     }
 
-    // map all human metanames to internal prefix
-    xmlHashScan(s3->config->metanames, (xmlHashScanner)add_prefix, &qparser);
-
-    /*
-     * for each property, add the ValueRangeProcessor
-     * NOTE that we intentionally leak the ValueRangeProcessor objects created
-     * in each hash scan, because otherwise they are destroyed before the qparser
-     * can use them, causing a segfault.
-     * See http://lists.xapian.org/pipermail/xapian-devel/2009-November/001193.html
-     */
-    xmlHashScan(s3->config->properties, (xmlHashScanner)add_property_range_processor, &qparser);
+    // set up once per process (or per header change, when serving)
+    if (!qparser_ready) {
+        qparser = Xapian::QueryParser();
+        qparser.set_stemmer(stemmer);
+        qparser.set_database(rdb);
+
+        // map all human metanames to internal prefix
+        xmlHashScan(s3->config->metanames, (xmlHashScanner)add_prefix, &qparser);
+
+        /*
+         * for each property, add the ValueRangeProcessor
+         * NOTE that we intentionally leak the ValueRangeProcessor objects created
+         * in each hash scan, because otherwise they are destroyed before the qparser
+         * can use them, causing a segfault.
+         * See http://lists.xapian.org/pipermail/xapian-devel/2009-November/001193.html
+         */
+        xmlHashScan(s3->config->properties, (xmlHashScanner)add_property_range_processor, &qparser);
+        qparser_ready = SWISH_TRUE;
+    }
     
     // TODO boolean_prefix?
 
-    try {
-        query = qparser.parse_query(string(qstr),
-            Xapian::QueryParser::FLAG_WILDCARD | 
-            Xapian::QueryParser::FLAG_BOOLEAN | 
-            Xapian::QueryParser::FLAG_BOOLEAN_ANY_CASE | 
-            Xapian::QueryParser::FLAG_PHRASE
-        );
-        //cout << "# " + query.get_description() << endl;
-    }
-    catch(Xapian::QueryParserError &e) {
-        SWISH_CROAK("query parser error: %s", e.get_msg().c_str());
-    }
-    
-    enquire = new Xapian::Enquire(rdb);
-    enquire->set_query(query);
+    query = qparser.parse_query(string(qstr),
+        Xapian::QueryParser::FLAG_WILDCARD | 
+        Xapian::QueryParser::FLAG_BOOLEAN | 
+        Xapian::QueryParser::FLAG_BOOLEAN_ANY_CASE | 
+        Xapian::QueryParser::FLAG_PHRASE
+    );
+    //cout << "# " + query.get_description() << endl;
     
-    if (sort_sl != NULL) {
-        swish_stringlist_debug(sort_sl);
-        int prop_id;
-        bool dir;
-        for (i=sort_sl->n-1; i>0; i-=2) {
-            prop_id = swish_property_get_id(sort_sl->word[i-1], s3->config->properties);
-            dir = xmlStrEqual(sort_sl->word[i], BAD_CAST "asc") ? false : true;
-            SWISH_DEBUG_MSG("sorter.add(%d, %d)", prop_id, dir);
-            sorter.add(prop_id, dir);
-        }
-        enquire->set_sort_by_key(&sorter, true);
-    }
+    enquire.set_query(query);
 
     if (num_facets) {
-        facet_finder_init();
-        mset = enquire->get_mset(results_offset, results_limit, SWISH_FACET_FINDER_LIMIT, NULL, &facet_finder);
+        // look at every match, not just the page we print
+        mset = enquire.get_mset(results_offset, results_limit, rdb.get_doccount(), NULL, &facet_counter);
     }
     else {
-        mset = enquire->get_mset(results_offset, results_limit);
+        mset = enquire.get_mset(results_offset, results_limit);
     }
-    printf("# Results include %d of %d estimated total matches\n", mset.size(), mset.get_matches_estimated());
-    cout << "# " + query.get_description() << endl;
-    iterator = mset.begin();
-        
-    for (; iterator != mset.end(); ++iterator) {
-        doc = iterator.get_document();
-        
-        // this looks a little convoluted but basically
-        // just iterating over the outputFormat template
-        // and fetching values from the doc as needed.
-        i = 0;
-        ofbuf = of.tmpl.c_str();
-        for ( j=0; ofbuf[j] != '\0'; j++ ) {
-            if (ofbuf[j] == SWISH_PROP_OUTPUT_PLACEHOLDER) {
-                // a property placeholder
-                if (of.props[i] == SWISH_PROP_RANK_ID) {
-                    printf("%3d0", iterator.get_percent());
-                }
-                else if (of.props[i] == SWISH_PROP_MTIME_ID) {
-                    printf("%s", swish_time_format(
-                            (time_t)swish_string_to_int((char*)doc.get_value(of.props[i]).c_str())
-                    ));
-                }
-                else {
-                    cout << doc.get_value(of.props[i]);
-                }
-                i++;
-            }
-            else {
-                // literal char
-                printf("%c", ofbuf[j]);
-            }
+    if (!json_output) {
+        fprintf(out, "# Results include %d of %d estimated total matches\n", mset.size(), mset.get_matches_estimated());
+        fprintf(out, "# %s\n", query.get_description().c_str());
+    }
+
+    // render into one buffer, written out a batch at a time
+    obuf.reserve(SWISH_OUTPUT_BUFFER + SWISH_MAXSTRLEN);
+    for (iterator = mset.begin(); iterator != mset.end(); ++iterator) {
+        if (docids != NULL)
+            docids->push_back(*iterator);
+        render_result(obuf, of, iterator);
+        if (obuf.size() >= SWISH_OUTPUT_BUFFER) {
+            fwrite(obuf.data(), 1, obuf.size(), out);
+            obuf.clear();
         }
-        
         total_matches++;
     }
+    fwrite(obuf.data(), 1, obuf.size(), out);
     
     if (num_facets) {
-        facet_finder_show();
+        show_facets(facet_counter, out);
     }
     
     //printf("# %d total matches\n", total_matches);
-    
+    return total_matches;
 }
 
 void
@@ -1139,6 +1863,629 @@ delete_document(
     }
 }
 
+/* swish_manifest_deleted() callback: the file is gone, so is its document */
+static void
+manifest_deleted(
+    const xmlChar *path,
+    void *data
+)
+{
+    if (delete_document((xmlChar *)path))
+        (*(long int *)data)++;
+}
+
+/*
+ * Fork one worker per shard. A worker returns straight away with
+ * shard_id set, to index its part as an ordinary run. The parent
+ * returns once every worker has exited, with the number that failed.
+ * Workers are processes rather than threads, so each has its own
+ * swish_3, Xapian database and libswish3 globals.
+ */
+static int
+fork_shards(
+)
+{
+    pid_t
+        pid;
+    int
+        i,
+        status,
+        failed = 0;
+
+    fflush(stdout);
+    for (i = 0; i < nshards; i++) {
+        pid = fork();
+        if (pid < 0) {
+            SWISH_CROAK("Failed to fork worker for shard %d: %s", i, strerror(errno));
+        }
+        if (pid == 0) {
+            shard_id = i;
+            return 0;
+        }
+    }
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed++;
+    }
+    return failed;
+}
+
+#ifdef HAVE_XAPIAN_COMPACT
+/* Xapian leaves a version stamp file in every database directory */
+static boolean
+is_index_dir(
+    const char *path
+)
+{
+    const char *
+        stamps[] = { "iamglass", "iamchert", "iamflint", "iamhoney", NULL };
+    string
+        file;
+    int
+        i;
+
+    if (!swish_fs_is_dir(BAD_CAST path))
+        return SWISH_FALSE;
+    for (i = 0; stamps[i] != NULL; i++) {
+        file = string(path) + SWISH_PATH_SEP_STR + stamps[i];
+        if (swish_fs_file_exists(BAD_CAST file.c_str()))
+            return SWISH_TRUE;
+    }
+    return SWISH_FALSE;
+}
+
+static void
+remove_tree(
+    const char *path
+)
+{
+    DIR *
+        dir;
+    struct dirent *
+        entry;
+    struct stat
+        st;
+    string
+        file;
+
+    if ((dir = opendir(path)) == NULL) {
+        SWISH_CROAK("Failed to open %s: %s", path, strerror(errno));
+    }
+    while ((entry = readdir(dir)) != NULL) {
+        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+            continue;
+        file = string(path) + SWISH_PATH_SEP_STR + entry->d_name;
+        if (lstat(file.c_str(), &st) == -1) {
+            SWISH_CROAK("Failed to stat %s: %s", file.c_str(), strerror(errno));
+        }
+        if (S_ISDIR(st.st_mode)) {
+            remove_tree(file.c_str());
+        }
+        else if (unlink(file.c_str()) == -1) {
+            SWISH_CROAK("Failed to unlink %s: %s", file.c_str(), strerror(errno));
+        }
+    }
+    closedir(dir);
+    if (rmdir(path) == -1) {
+        SWISH_CROAK("Failed to remove %s: %s", path, strerror(errno));
+    }
+}
+
+/* remove an index directory, refusing anything that is not one */
+static void
+remove_index_dir(
+    const char *path
+)
+{
+    if (!is_index_dir(path)) {
+        SWISH_CROAK("%s is not a Xapian index; not removing it", path);
+    }
+    remove_tree(path);
+}
+#endif
+
+/*
+ * Compact the shards into dbpath.tmp, write its header there from
+ * shard 0's (it has the config the workers indexed with), then swap
+ * it in for dbpath. An existing dbpath is only replaced if it is an
+ * index itself. Without the compaction API the shards are left for
+ * searching side by side.
+ */
+static void
+merge_shards(
+    char *dbpath
+)
+{
+    int
+        i;
+    char *
+        shard;
+
+#ifdef HAVE_XAPIAN_COMPACT
+    char *
+        header;
+    string
+        tmp = string(dbpath) + ".tmp";
+    string
+        old = string(dbpath) + ".old";
+    boolean
+        replace = swish_fs_file_exists(BAD_CAST dbpath);
+
+    if (replace && !is_index_dir(dbpath)) {
+        SWISH_CROAK("%s exists and is not a Xapian index; not replacing it", dbpath);
+    }
+    if (swish_fs_file_exists(BAD_CAST tmp.c_str()))
+        remove_index_dir(tmp.c_str());
+    if (swish_fs_file_exists(BAD_CAST old.c_str()))
+        remove_index_dir(old.c_str());
+
+    shard = make_shard_path(dbpath, 0);
+    header = make_header_path(shard);
+    swish_header_merge(header, s3->config);
+    swish_xfree(header);
+    swish_xfree(shard);
+    swish_hash_replace(s3->config->index, BAD_CAST "Name", swish_xstrdup(BAD_CAST dbpath));
+
+    try {
+        Xapian::Database
+            shards;
+        for (i = 0; i < nshards; i++) {
+            shard = make_shard_path(dbpath, i);
+            shards.add_database(Xapian::Database(string(shard)));
+            swish_xfree(shard);
+        }
+        printf("compacting %d shards into %s ... ", nshards, tmp.c_str());
+        fflush(stdout);
+        shards.compact(tmp);
+        shards.close();
+    }
+    catch(const Xapian::Error & e) {
+        SWISH_CROAK("Failed to compact shards into %s: %s", tmp.c_str(), e.get_msg().c_str());
+    }
+    printf("ok\n");
+
+    header = make_header_path((char*)tmp.c_str());
+    printf("writing header to %s ... ", header);
+    swish_header_write(header, s3->config);
+    printf("\n");
+    swish_xfree(header);
+
+    // move the old index aside rather than delete it first, so
+    // dbpath is never missing for longer than two renames
+    if (replace && rename(dbpath, old.c_str()) == -1) {
+        SWISH_CROAK("Failed to rename %s to %s: %s", dbpath, old.c_str(), strerror(errno));
+    }
+    if (rename(tmp.c_str(), dbpath) == -1) {
+        SWISH_CROAK("Failed to rename %s to %s: %s", tmp.c_str(), dbpath, strerror(errno));
+    }
+    if (replace)
+        remove_index_dir(old.c_str());
+
+    for (i = 0; i < nshards; i++) {
+        shard = make_shard_path(dbpath, i);
+        remove_index_dir(shard);
+        swish_xfree(shard);
+    }
+#else
+    printf("this Xapian cannot compact; search the shards together with:\n  ");
+    for (i = 0; i < nshards; i++) {
+        shard = make_shard_path(dbpath, i);
+        printf(" -i %s", shard);
+        swish_xfree(shard);
+    }
+    printf("\n");
+#endif
+}
+
+/* search more indexes (e.g. shards) alongside the first, unmerged */
+static void
+add_readable_indexes(
+    swish_StringList *dbpaths
+)
+{
+    unsigned int
+        i;
+
+    for (i = 0; i < dbpaths->n; i++) {
+        if (!swish_fs_is_dir(dbpaths->word[i])) {
+            SWISH_CROAK("No such index at %s", dbpaths->word[i]);
+        }
+        try {
+            Xapian::Database part(string((const char *)dbpaths->word[i]));
+            rdb.add_database(part);
+#ifdef HAVE_XAPIAN_GET_REVISION
+            rdb_parts.push_back(part);
+#endif
+        }
+        catch(const Xapian::Error & e) {
+            SWISH_CROAK("Failed to open index %s: %s", dbpaths->word[i], e.get_msg().c_str());
+        }
+    }
+}
+
+/* AND a --limit "prop low high" range onto query_extra, which may be NULL */
+static char *
+add_limit(
+    char *query_extra,
+    const char *limit
+)
+{
+    swish_StringList *
+        limit_string;
+    char *
+        extra;
+    unsigned int
+        j,
+        len;
+
+    limit_string = swish_stringlist_build(BAD_CAST limit);
+    if (limit_string->n != 3) {
+        SWISH_CROAK("Bad format in --limit string: %s", limit);
+    }
+    // get the lengths so we know how much to malloc
+    len = query_extra != NULL ? strlen(query_extra) + 5 : 0;
+    for (j = 0; j < limit_string->n; j++) {
+        len += xmlStrlen(limit_string->word[j]);
+    }
+    len += 4;
+    extra = (char*)swish_xmalloc(len);
+    snprintf(extra, len, "%s%s%s:%s..%s",
+        query_extra != NULL ? query_extra : "", query_extra != NULL ? " AND " : "",
+        limit_string->word[0], limit_string->word[1], limit_string->word[2]);
+    swish_stringlist_free(limit_string);
+    if (query_extra != NULL)
+        swish_xfree(query_extra);
+    return extra;
+}
+
+/*
+ * Between server requests, pick up any new revision of the index, and
+ * re-read its header (so rebuild the query parser) if it was rewritten.
+ */
+static void
+refresh_readable_index(
+    char *dbpath
+)
+{
+    char *
+        header;
+    time_t
+        mtime;
+
+    rdb.reopen();
+    header = make_header_path(dbpath);
+    if (swish_fs_file_exists(BAD_CAST header)
+        && (mtime = swish_fs_get_file_mtime(BAD_CAST header)) != header_mtime) {
+        swish_header_merge(header, s3->config);
+        header_mtime = mtime;
+        qparser_ready = SWISH_FALSE;
+    }
+    swish_xfree(header);
+}
+
+/* a numeric request field, or RequestError (swish_string_to_int() exits) */
+static unsigned int
+request_uint(
+    const char *field,
+    const char *value
+)
+{
+    char *
+        end;
+    unsigned long
+        n;
+
+    errno = 0;
+    n = strtoul(value, &end, 10);
+    if (errno || end == value || *end || n > UINT_MAX)
+        throw RequestError(string("Bad number for ") + field + ": " + value);
+    return (unsigned int)n;
+}
+
+/* a limit request field as a query clause, or RequestError */
+static string
+request_limit(
+    const char *value
+)
+{
+    swish_StringList *
+        words;
+    unsigned int
+        n;
+    char *
+        clause;
+    string
+        limit;
+
+    words = swish_stringlist_build(BAD_CAST value);
+    n = words->n;
+    swish_stringlist_free(words);
+    if (n != 3)
+        throw RequestError(string("Bad format in limit: ") + value);
+
+    clause = add_limit(NULL, value);
+    limit = clause;
+    swish_xfree(clause);
+    return limit;
+}
+
+/*
+ * Answer one server request. Its TAB separated fields are name=value
+ * for begin, max, sort, output, Facets, facet-top, limit and json, as on the
+ * command line, and the query itself: query=..., or any field with no
+ * '=' in it. With a query cache, a request already answered against
+ * this revision of the index is answered from the cache. A request
+ * that cannot be answered throws RequestError or a Xapian::Error,
+ * with nothing left allocated.
+ */
+static void
+answer_request(
+    char *line
+)
+{
+    char *
+        field;
+    char *
+        next;
+    char *
+        value;
+    char *
+        query = NULL;
+    string
+        query_extra;
+    xmlChar *
+        output_format = NULL;
+    xmlChar *
+        sort_string = NULL;
+    unsigned int
+        results_offset = 0,
+        results_limit = 100;
+    string
+        qstr,
+        extra;
+    char
+        stamp[128];
+    xmlChar *
+        key;
+    swish_QueryResult *
+        res;
+    FILE *
+        out;
+    char *
+        buf;
+    size_t
+        len;
+    vector<unsigned int>
+        docids;
+    boolean
+        facets_given = SWISH_FALSE;
+#ifdef HAVE_XAPIAN_GET_REVISION
+    size_t
+        i;
+#endif
+
+    for (field = line; field != NULL; field = next) {
+        if ((next = strchr(field, '\t')) != NULL)
+            *next++ = '\0';
+        if ((value = strchr(field, '=')) == NULL) {
+            query = field;
+            continue;
+        }
+        *value++ = '\0';
+        if (!strcmp(field, "query"))
+            query = value;
+        else if (!strcmp(field, "begin"))
+            results_offset = request_uint(field, value);
+        else if (!strcmp(field, "max"))
+            results_limit = request_uint(field, value);
+        else if (!strcmp(field, "sort"))
+            sort_string = BAD_CAST value;
+        else if (!strcmp(field, "output"))
+            output_format = BAD_CAST value;
+        else if (!strcmp(field, "Facets")) {
+            /* the last Facets wins; the command line's list is serve()'s */
+            if (facets_given)
+                swish_stringlist_free(facet_list);
+            facet_list = swish_stringlist_build(BAD_CAST value);
+            num_facets = facet_list->n;
+            facets_given = SWISH_TRUE;
+        }
+        else if (!strcmp(field, "facet-top"))
+            facet_top = request_uint(field, value);
+        else if (!strcmp(field, "json"))
+            json_output = request_uint(field, value) ? SWISH_TRUE : SWISH_FALSE;
+        else if (!strcmp(field, "limit"))
+            query_extra += " AND " + request_limit(value);
+        else
+            throw RequestError(string("Unknown request field '") + field + "'");
+    }
+    if (query == NULL) {
+        throw RequestError("No query in request");
+    }
+
+    qstr = query + query_extra;
+    if (qcache == NULL) {
+        search((char*)qstr.c_str(), output_format, sort_string, results_offset,
+            results_limit, stdout, NULL);
+        return;
+    }
+
+    /*
+     * a result is good until the index changes: every commit bumps the
+     * revision of the index it went to. rdb shares its indexes with
+     * rdb_parts, so reopen_readable_index() moves them too. without
+     * Database::get_revision() in older Xapian, take the header's
+     * mtime (rewritten by every indexing run) and the statistics any
+     * commit moves.
+     */
+#ifdef HAVE_XAPIAN_GET_REVISION
+    extra.clear();
+    for (i = 0; i < rdb_parts.size(); i++) {
+        snprintf(stamp, sizeof(stamp), "%lu ", (unsigned long)rdb_parts[i].get_revision());
+        extra += stamp;
+    }
+    swish_query_cache_validate(qcache, BAD_CAST extra.c_str());
+#else
+    snprintf(stamp, sizeof(stamp), "%ld %u %u %.17g", (long)header_mtime,
+        rdb.get_doccount(), rdb.get_lastdocid(), rdb.get_avlength());
+    swish_query_cache_validate(qcache, BAD_CAST stamp);
+#endif
+
+    snprintf(stamp, sizeof(stamp), "%u %d", facet_top, json_output);
+    extra = string(output_format != NULL ? (char*)output_format : "") + '\t' + stamp;
+    key = swish_query_cache_key(BAD_CAST qstr.c_str(), sort_string, results_offset,
+        results_limit, num_facets ? facet_list : NULL, BAD_CAST extra.c_str());
+
+    if ((res = swish_query_cache_fetch(qcache, key)) == NULL) {
+        if ((out = open_memstream(&buf, &len)) == NULL) {
+            swish_xfree(key);
+            throw RequestError(string("Failed to open memory stream: ") + strerror(errno));
+        }
+        try {
+            search((char*)qstr.c_str(), output_format, sort_string, results_offset,
+                results_limit, out, &docids);
+        }
+        catch(...) {
+            fclose(out);
+            free(buf);
+            swish_xfree(key);
+            throw;
+        }
+        fclose(out);
+        swish_query_cache_store(qcache, key, BAD_CAST buf, len,
+            docids.empty() ? NULL : &docids[0], docids.size());
+        fwrite(buf, 1, len, stdout);
+        free(buf);
+    }
+    else {
+        fwrite(res->output, 1, res->len, stdout);
+    }
+    swish_xfree(key);
+}
+
+/*
+ * Answer requests, one per line of in, on stdout until EOF. The index,
+ * header and query parser are already loaded. Each answer ends with a
+ * line holding just ".". A request that cannot be answered gets
+ * "# error: ..." and the server carries on. Requests are checked
+ * before anything that croaks sees them, so a croak here is a real
+ * failure (an unreadable header, say) and ends the server.
+ */
+static void
+serve(
+    FILE *in,
+    char *dbpath
+)
+{
+    char *
+        line = NULL;
+    size_t
+        size = 0;
+    ssize_t
+        len;
+    unsigned int
+        default_facet_top = facet_top;
+    boolean
+        default_json_output = json_output;
+    swish_StringList *
+        default_facet_list = facet_list;
+
+    while ((len = getline(&line, &size, in)) != -1) {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (!len)
+            continue;
+
+        // per-request options start from the command line's
+        if (facet_list != default_facet_list)
+            swish_stringlist_free(facet_list);
+        facet_list = default_facet_list;
+        num_facets = facet_list != NULL ? facet_list->n : 0;
+        facet_top = default_facet_top;
+        json_output = default_json_output;
+
+        try {
+            refresh_readable_index(dbpath);
+            answer_request(line);
+        }
+        catch(const RequestError & e) {
+            printf("# error: %s\n", e.msg.c_str());
+        }
+        catch(const Xapian::QueryParserError & e) {
+            printf("# error: query parser error: %s\n", e.get_msg().c_str());
+        }
+        catch(const Xapian::Error & e) {
+            printf("# error: %s\n", e.get_msg().c_str());
+        }
+
+        cout.flush();
+        printf(".\n");
+        fflush(stdout);
+    }
+    if (facet_list != default_facet_list)
+        swish_stringlist_free(facet_list);
+    facet_list = default_facet_list;
+    free(line);
+}
+
+/*
+ * Serve each client of a Unix socket at path in turn, until killed. A
+ * client writes request lines and reads answers exactly as with
+ * --serve on stdin; its connection stands in for stdout meanwhile.
+ */
+static void
+serve_socket(
+    char *path,
+    char *dbpath
+)
+{
+    int
+        sock,
+        conn,
+        saved_stdout;
+    struct sockaddr_un
+        addr;
+    FILE *
+        in;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        SWISH_CROAK("Socket path is too long: %s", path);
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+        SWISH_CROAK("Failed to create socket: %s", strerror(errno));
+    }
+    unlink(path);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(sock, 16) == -1) {
+        SWISH_CROAK("Failed to listen on %s: %s", path, strerror(errno));
+    }
+
+    // a client that hangs up early must not take the server with it
+    signal(SIGPIPE, SIG_IGN);
+    saved_stdout = dup(STDOUT_FILENO);
+    fprintf(stderr, "listening on %s\n", path);
+
+    for (;;) {
+        if ((conn = accept(sock, NULL, NULL)) == -1) {
+            if (errno == EINTR)
+                continue;
+            SWISH_CROAK("Failed to accept on %s: %s", path, strerror(errno));
+        }
+        if ((in = fdopen(conn, "r")) == NULL) {
+            SWISH_CROAK("Failed to fdopen socket: %s", strerror(errno));
+        }
+        fflush(stdout);
+        dup2(conn, STDOUT_FILENO);
+        serve(in, dbpath);
+        fflush(stdout);
+        dup2(saved_stdout, STDOUT_FILENO);
+        fclose(in);
+    }
+}
+
 static void
 get_db_data(
     char *dbpath,
@@ -1190,6 +2537,8 @@ main(
         sort_string;
     xmlChar *
         stemmer_lang;
+    xmlChar *
+        collation;
     char *
         header;
     double
@@ -1199,13 +2548,28 @@ main(
     xmlChar *
         db_data;
     boolean delete_mode;
+    boolean incremental;
+    char *
+        manifest;
+    long int
+        deleted;
     unsigned int results_offset, results_limit;
     boolean follow_symlinks;
     swish_StringList *
-        limit_string;
-    unsigned int stringlengths;
+        more_dbpaths;
+    char *
+        shard_path;
+    boolean
+        serve_mode;
+    char *
+        socket_path;
+    int
+        failed;
 
     delete_mode = SWISH_FALSE;
+    incremental = SWISH_FALSE;
+    manifest = NULL;
+    deleted = 0;
     config_file = NULL;
     output_format = NULL;
     filelist = NULL;
@@ -1214,6 +2578,9 @@ main(
     files = 0;
     query = NULL;
     dbpath = NULL;
+    more_dbpaths = NULL;
+    serve_mode = SWISH_FALSE;
+    socket_path = NULL;
     
     swish_setup();
     start_time = swish_time_elapsed();
@@ -1226,7 +2593,7 @@ main(
     db_data = NULL;
     query_extra = NULL;
 
-    while ((ch = getopt_long(argc, argv, "c:d:f:i:q:s:SohDlL:x:vF:b:m:t:T:", longopts, &option_index)) != -1) {
+    while ((ch = getopt_long(argc, argv, "c:C:d:E:f:i:Ijq:Qs:SohDlL:x:vF:b:B:k:m:M:N:t:T:U:", longopts, &option_index)) != -1) {
 
         switch (ch) {
         case 0:                /* If this option set a flag, do nothing else now. */
@@ -1262,7 +2629,14 @@ main(
             break;
 
         case 'i':
-            dbpath = (char *)swish_xstrdup(BAD_CAST optarg);
+            if (dbpath == NULL) {
+                dbpath = (char *)swish_xstrdup(BAD_CAST optarg);
+            }
+            else {
+                if (more_dbpaths == NULL)
+                    more_dbpaths = swish_stringlist_init();
+                swish_stringlist_add_string(more_dbpaths, swish_xstrdup(BAD_CAST optarg));
+            }
             break;
 
         case 'S':
@@ -1305,6 +2679,10 @@ main(
         case 'D':
             delete_mode = SWISH_TRUE;
             break;
+
+        case 'I':
+            incremental = SWISH_TRUE;
+            break;
             
         case 'x':
             output_format = swish_xstrdup(BAD_CAST optarg);
@@ -1317,34 +2695,50 @@ main(
         case 'm':
             results_limit = swish_string_to_int(optarg);
             break;
+
+        case 'B':
+            batch_size = swish_string_to_int(optarg);
+            break;
+
+        case 'M':
+            flush_mb = swish_string_to_int(optarg);
+            break;
+
+        case 'N':
+            nshards = swish_string_to_int(optarg);
+            break;
+
+        case 'k':
+            facet_top = swish_string_to_int(optarg);
+            break;
+
+        case 'j':
+            json_output = SWISH_TRUE;
+            break;
+
+        case 'Q':
+            serve_mode = SWISH_TRUE;
+            break;
+
+        case 'U':
+            serve_mode = SWISH_TRUE;
+            socket_path = (char *)swish_xstrdup(BAD_CAST optarg);
+            break;
+
+        case 'C':
+            cache_entries = swish_string_to_int(optarg);
+            break;
+
+        case 'E':
+            cache_bytes = (size_t)swish_string_to_int(optarg) * 1024 * 1024;
+            break;
             
         case 'l':
             follow_symlinks = SWISH_TRUE;
             break;
             
         case 'L':
-            limit_string = swish_stringlist_build(BAD_CAST optarg);
-            if (limit_string->n != 3) {
-                SWISH_CROAK("Bad format in --limit string: %s", optarg);
-            }
-            stringlengths = 0;
-            // get the lengths so we know how much to malloc
-            for (j=0; j<limit_string->n; j++) {
-                stringlengths += xmlStrlen(limit_string->word[j]);
-            }
-            if (query_extra == NULL) {
-                query_extra = (char*)swish_xmalloc((stringlengths+4)*sizeof(char));
-                snprintf(query_extra, (stringlengths+4)*sizeof(char), "%s:%s..%s",
-                    limit_string->word[0], limit_string->word[1], limit_string->word[2]);
-            }
-            else {
-                query_extra = (char*)swish_xrealloc(query_extra, 
-                    (strlen(query_extra)+stringlengths+6)*(sizeof(char)));
-                snprintf(query_extra, (strlen(query_extra)+stringlengths+6)*(sizeof(char)),
-                    "%s AND %s:%s..%s", query_extra, limit_string->word[0], 
-                    limit_string->word[1], limit_string->word[2]);
-            }
-            swish_stringlist_free(limit_string);
+            query_extra = add_limit(query_extra, optarg);
             break;
 
         case '?':
@@ -1361,7 +2755,7 @@ main(
     /*
        die with no args or filelist
      */
-    if ((!i || i >= argc) && !query && !filelist) {
+    if ((!i || i >= argc) && !query && !filelist && !serve_mode) {
         swish_3_free(s3);
         usage();
 
@@ -1382,8 +2776,65 @@ main(
         return 0;
     }
     
+    if (!query && !serve_mode && more_dbpaths != NULL) {
+        SWISH_CROAK("Only searching takes more than one --index");
+    }
+
+    // with --shards, fork the workers. each carries on below as an
+    // ordinary (overwriting) indexing run into its own shard directory
+    if (!query && !serve_mode && nshards > 1) {
+        if (delete_mode || incremental) {
+            SWISH_CROAK("--shards builds a fresh index; it cannot --Delete or be --incremental");
+        }
+        for (j = i; j < argc; j++) {
+            if (argv[j][0] == '-' && !argv[j][1])
+                SWISH_CROAK("--shards cannot read documents from stdin");
+        }
+        overwrite = 1;
+        if ((failed = fork_shards()) > 0) {
+            SWISH_CROAK("%d of %d shard workers failed", failed, nshards);
+        }
+        if (shard_id >= 0) {
+            s3->shard = shard_id;
+            s3->nshards = nshards;
+            shard_path = make_shard_path(dbpath, shard_id);
+            swish_xfree(dbpath);
+            dbpath = shard_path;
+        }
+    }
+
+    // server mode: load the index, header and query parser once
+    if (serve_mode) {
+        open_readable_index(dbpath, stemmer_lang);
+        if (more_dbpaths != NULL) {
+            add_readable_indexes(more_dbpaths);
+            swish_stringlist_free(more_dbpaths);
+        }
+        if (cache_entries && cache_bytes) {
+            qcache = swish_query_cache_init(cache_entries, cache_bytes);
+        }
+        if (socket_path != NULL) {
+            serve_socket(socket_path, dbpath);
+        }
+        else {
+            serve(stdin, dbpath);
+        }
+        if (qcache != NULL) {
+            if (verbose) {
+                fprintf(stderr, "query cache: %lu hits %lu misses\n",
+                    qcache->hits, qcache->misses);
+            }
+            swish_query_cache_free(qcache);
+        }
+    }
+
+    // all the parent of the shard workers has left to do is merge
+    else if (!query && shard_id < 0 && nshards > 1) {
+        merge_shards(dbpath);
+    }
+
     // indexing mode
-    if (!query) {
+    else if (!query) {
 
         if (open_writeable_index(dbpath)) {
             SWISH_CROAK("Failed to open writeable index '%s'", dbpath);
@@ -1428,10 +2879,53 @@ main(
             swish_hash_add(s3->config->index, BAD_CAST SWISH_INDEX_STEMMER_LANG, swish_xstrdup(BAD_CAST "none"));
         }
 
+        // sort keys are only good for searching if every document has them,
+        // all made with the same collation
+        collation = BAD_CAST setlocale(LC_COLLATE, NULL);
+        if (swish_hash_exists(s3->config->index, BAD_CAST SWISH_INDEX_SORT_KEYS)) {
+            if (!delete_mode
+                && !xmlStrEqual(collation, BAD_CAST swish_hash_fetch(s3->config->index, BAD_CAST SWISH_INDEX_SORT_KEYS))) {
+                SWISH_CROAK("index sort keys were made with LC_COLLATE=%s, not %s; use that or --overwrite",
+                    swish_hash_fetch(s3->config->index, BAD_CAST SWISH_INDEX_SORT_KEYS), collation);
+            }
+        }
+        else if (!wdb.get_doccount()) {
+            swish_hash_add(s3->config->index, BAD_CAST SWISH_INDEX_SORT_KEYS, swish_xstrdup(collation));
+        }
+
+        // each shard numbers new names as it meets them, so they would not agree
+        if (shard_id >= 0
+            && (s3->config->flags->undef_metas == SWISH_UNDEF_METAS_AUTO
+                || s3->config->flags->undef_metas == SWISH_UNDEF_METAS_AUTOALL
+                || s3->config->flags->undef_attrs == SWISH_UNDEF_ATTRS_AUTO
+                || s3->config->flags->undef_attrs == SWISH_UNDEF_ATTRS_AUTOALL)) {
+            SWISH_CROAK("--shards needs every MetaName and PropertyName declared, not auto");
+        }
+
         // always turn tokenizing off since we use the Xapian term tokenizer.
         s3->config->flags->tokenize = SWISH_FALSE;
         s3->analyzer->tokenize = SWISH_FALSE;
 
+        // the command line wins over the Index section
+        if (!batch_size && swish_hash_exists(s3->config->index, BAD_CAST SWISH_INDEX_BATCH_SIZE)) {
+            batch_size = swish_string_to_int((char*)swish_hash_fetch(s3->config->index,
+                                                                      BAD_CAST SWISH_INDEX_BATCH_SIZE));
+        }
+        if (!flush_mb && swish_hash_exists(s3->config->index, BAD_CAST SWISH_INDEX_FLUSH_MB)) {
+            flush_mb = swish_string_to_int((char*)swish_hash_fetch(s3->config->index,
+                                                                    BAD_CAST SWISH_INDEX_FLUSH_MB));
+        }
+
+        // an overwritten index starts with an empty manifest too.
+        if (incremental && !delete_mode) {
+            manifest = make_manifest_path(dbpath);
+            s3->manifest = swish_manifest_init();
+            if (!overwrite) {
+                printf("%ld files in manifest %s\n",
+                    swish_manifest_load(s3->manifest, manifest), manifest);
+            }
+        }
+
         for (; i < argc; i++) {
             if (argv[i][0] != '-') {
                 if (delete_mode) {
@@ -1441,6 +2935,8 @@ main(
                 else {
                     printf("~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~\n");
                     printf("%s ... ", argv[i]);
+                    if (s3->manifest != NULL)
+                        swish_manifest_add_root(s3->manifest, BAD_CAST argv[i]);
                     if (swish_fs_is_dir(BAD_CAST argv[i])) {
                         files += swish_parse_directory(s3, BAD_CAST argv[i], follow_symlinks);
                         printf(" ok\n");
@@ -1492,6 +2988,8 @@ main(
                         if (verbose) {
                             cout << line_in_file;
                         }
+                        if (s3->manifest != NULL)
+                            swish_manifest_add_root(s3->manifest, buf);
                         if (!swish_parse_file(s3, buf)) {
                             files++;
                             if (!verbose) {
@@ -1517,7 +3015,16 @@ main(
             printf("%ld documents deleted from database\n", files);
         }
         else {
+            // no transaction may be open at the final flush
+            batch_finish();
             printf("\n\n%ld files indexed\n", files);
+
+            if (manifest != NULL) {
+                // only files under the paths given this run can be deleted
+                swish_manifest_deleted(s3->manifest, manifest_deleted, &deleted);
+                printf("%lu files unchanged, %ld deleted\n",
+                    s3->manifest->unchanged, deleted);
+            }
             //printf("# total tokenized words: %ld\n", twords);
 
             // how do we know when to write a header file?
@@ -1540,6 +3047,12 @@ main(
 
             /* flush explicitly so that total time does not print before object destroy */
             wdb.flush();
+
+            /* not before the flush, or a crash could leave it ahead of the index */
+            if (manifest != NULL) {
+                swish_manifest_save(s3->manifest, manifest);
+                swish_xfree(manifest);
+            }
         }
 
     }
@@ -1555,7 +3068,19 @@ main(
             swish_xfree(query_extra);
         }
         open_readable_index(dbpath, stemmer_lang);
-        search(query, output_format, sort_string, results_offset, results_limit);
+        if (more_dbpaths != NULL) {
+            add_readable_indexes(more_dbpaths);
+            swish_stringlist_free(more_dbpaths);
+        }
+        try {
+            search(query, output_format, sort_string, results_offset, results_limit, stdout, NULL);
+        }
+        catch(const RequestError & e) {
+            SWISH_CROAK("%s", e.msg.c_str());
+        }
+        catch(const Xapian::QueryParserError & e) {
+            SWISH_CROAK("query parser error: %s", e.get_msg().c_str());
+        }
         swish_xfree(BAD_CAST query);
     }
 
@@ -2,7 +2,7 @@
 use strict;
 use warnings;
 use Carp;
-use Test::More tests => 5;
+use Test::More tests => 17;
 use FindBin;
 
 my $testdir = $ENV{SVNDIR} || "$FindBin::Bin/..";
@@ -10,6 +10,9 @@ my $testdir = $ENV{SVNDIR} || "$FindBin::Bin/..";
 ok( run(''), 'usage' );
 
 # indexing
+ok( run(" --overwrite --batch-size 3 --flush-mb 1 $testdir/test_docs/*xml"),
+    'batched index xml' );
+ok( run(" --shards 2 $testdir/test_docs/*xml"), 'sharded index xml' );
 ok( run(" $testdir/test_docs/*xml"),  'index xml' );
 ok( run(" $testdir/test_docs/*html"), 'index html' );
 
@@ -17,10 +20,43 @@ ok( run(" $testdir/test_docs/*html"), 'index html' );
 ok( ( grep {m/2 estimated total matches/} run(' --query swishtitle:foobar') ),
     'search swishtitle:foobar'
 );
+ok( ( grep {m/^Facet xapian_tag /} run(' --query foobar --Facets xapian_tag --facet-top 3') ),
+    'facet counts for xapian_tag'
+);
+my @sizes = map { m/"swishdocsize":(\d+)/ ? $1 : () }
+    run(' --query foobar --sort "swishdocsize desc" --json');
+ok( @sizes > 1 && !( grep { $sizes[ $_ - 1 ] < $sizes[$_] } 1 .. $#sizes ),
+    'sort by swishdocsize is numeric' );
+my @json = run(' --query swishtitle:foobar --json');
+ok( @json == 2
+        && !( grep { !m/^\{"swishrank":\d+,"swishdocpath":"[^"]+","swishtitle":".*","swishdocsize":(?:\d+|null)\}$/ } @json ),
+    'JSON Lines results' );
+
+# serving
+my @answers = split( /^\.\n/m,
+    join( '', `printf 'swishtitle:foobar\\nquery=foobar\\tmax=1\\n  swishtitle:foobar \\n' | ./swish_xapian --config sx-conf.xml --serve` ) );
+ok( @answers == 3 && $answers[0] =~ m/2 estimated total matches/,
+    'serve three queries' );
+is( $answers[2], $answers[0], 'repeated query answered the same from cache' );
+like( `printf 'foobar\\nfoobar\\n' | ./swish_xapian --config sx-conf.xml --serve -v 2>&1 >/dev/null`,
+    qr/query cache: 1 hits 1 misses/, 'repeated query is a cache hit' );
+like( `(printf 'foobar\\n'; sleep 1; ./swish_xapian --config sx-conf.xml $testdir/test_docs/*xml >/dev/null; printf 'foobar\\n') | ./swish_xapian --config sx-conf.xml --serve -v 2>&1 >/dev/null`,
+    qr/query cache: 0 hits 2 misses/, 'indexing in between empties the cache' );
+@answers = split( /^\.\n/m,
+    join( '', `printf 'foobar\\tsort=nosuchprop\\nswishtitle:foobar\\n' | ./swish_xapian --config sx-conf.xml --serve` ) );
+ok( @answers == 2 && $answers[0] =~ m/^# error: No such PropertyName/
+        && $answers[1] =~ m/2 estimated total matches/,
+    'a bad request gets an error and the server carries on' );
 
 # deleting
 ok( run(" --Delete $testdir/test_docs/*.html"), "delete test_docs/*.html" );
 
+# a fresh index still holds each URI once
+ok( run(" --overwrite $testdir/test_docs/*xml $testdir/test_docs/*xml"),
+    'overwrite with every xml doc given twice' );
+ok( ( grep {m/2 estimated total matches/} run(' --query swishtitle:foobar') ),
+    'each doc indexed once' );
+
 sub run {
     my $cmd = shift;
     my @out = `./swish_xapian --config sx-conf.xml $cmd`;